@@ -15,6 +15,10 @@ DEP_FINDPARAMS := -x "*/.svn*" -x ".*" -x "*:*" -x "*\!*" -x "* *" -x "*\\\#*" -
 
 find_md5=find $(wildcard $(1)) -type f $(patsubst -x,-and -not -path,$(DEP_FINDPARAMS) $(2)) | mkhash md5
 
+# native replacement for find_md5 + timestamp.pl, built by prereq-build
+RDEP_CHECK:=$(wildcard $(TOPDIR)/staging_dir/host/bin/rdep-check)
+RDEP_CACHE:=$(TOPDIR)/tmp/.rdep-cache
+
 define rdep
   .PRECIOUS: $(2)
   .SILENT: $(2)_check
@@ -24,13 +28,15 @@ define rdep
 
 ifneq ($(wildcard $(2)),)
   $(2)_check::
-	$(if $(3), \
+	$(if $(RDEP_CHECK),,$(if $(3), \
 		$(call find_md5,$(1),$(4)) > $(3).1; \
 		{ [ \! -f "$(3)" ] || diff $(3) $(3).1 >/dev/null; } && \
-	) \
+	)) \
 	{ \
 		[ -f "$(2)_check.1" ] && mv "$(2)_check.1"; \
-	    $(TOPDIR)/scripts/timestamp.pl $(DEP_FINDPARAMS) $(4) -n $(2) $(1) && { \
+	    $(if $(RDEP_CHECK), \
+		$(RDEP_CHECK) $(DEP_FINDPARAMS) $(4) -C $(RDEP_CACHE) $(if $(3),-l $(3)) -n $(2) $(1), \
+		$(TOPDIR)/scripts/timestamp.pl $(DEP_FINDPARAMS) $(4) -n $(2) $(1)) && { \
 			$(call debug_eval,$(SUBDIR),r,echo "No need to rebuild $(2)";) \
 			touch -r "$(2)" "$(2)_check"; \
 		} \
@@ -38,7 +44,7 @@ ifneq ($(wildcard $(2)),)
 		$(call debug_eval,$(SUBDIR),r,echo "Need to rebuild $(2)";) \
 		touch "$(2)_check"; \
 	}
-	$(if $(3), mv $(3).1 $(3))
+	$(if $(RDEP_CHECK),,$(if $(3), mv $(3).1 $(3)))
 else
   $(2)_check::
 	$(if $(3), rm -f $(3) $(3).1)
@@ -113,9 +113,36 @@ $(foreach data, \
 	$(call $(2),$(strip $(subst ^,$(space),$(data)))))
 endef
 
+# Build steps whose result only depends on the input file and the expanded
+# recipe are looked up in a content addressed cache shared by all devices,
+# so e.g. the same vmlinux is only compressed once per subtarget.
+IMAGE_CACHE_STEPS ?= lzma lzma-no-dict gzip uImage
+IMAGE_CACHE_DIR ?= $(KDIR)/image-cache
+IMAGE_CACHE = IMAGE_CACHE_DIR="$(IMAGE_CACHE_DIR)" $(SCRIPT_DIR)/image-cache.sh
+
+_cache_tab := $(empty)	$(empty)
+_cache_sp := @@SP@@
+
+cache_lstrip = $(if $(filter $(_cache_sp)%,$(1)),$(call cache_lstrip,$(patsubst $(_cache_sp)%,%,$(1))),$(1))
+
+# join the recipe lines of a step into a single shell command,
+# dropping empty lines, comments and @ prefixes
+define cache_join_lines
+$(subst $(_cache_sp),$(space),$(subst $(space), && ,$(strip \
+	$(filter-out #%,$(patsubst @%,%,$(foreach line, \
+		$(subst $(newline),$(space),$(subst $(space),$(_cache_sp),$(subst $(_cache_tab),$(_cache_sp),$(subst \$(newline),$(space),$(1))))), \
+		$(call cache_lstrip,$(line))))))))
+endef
+
+define build_cmd_cached
+	$(IMAGE_CACHE) get $@ '$(subst ','\'',$(subst $@,@OUT@,$(2)))' || { $(2) && $(IMAGE_CACHE) put $@; }
+endef
+
 define build_cmd
 $(if $(Build/$(word 1,$(1))),,$(error Missing Build/$(word 1,$(1))))
-$(call Build/$(word 1,$(1)),$(wordlist 2,$(words $(1)),$(1)))
+$(if $(filter $(word 1,$(1)),$(IMAGE_CACHE_STEPS)), \
+	$(call build_cmd_cached,$(1),$(call cache_join_lines,$(call Build/$(word 1,$(1)),$(wordlist 2,$(words $(1)),$(1))))), \
+	$(call Build/$(word 1,$(1)),$(wordlist 2,$(words $(1)),$(1))))
 
 endef
 
@@ -124,8 +151,9 @@ $(call split_args,$(1),build_cmd)
 endef
 
 # pad to 4k, 8k, 16k, 64k, 128k, 256k and add jffs2 end-of-filesystem mark
+# $(1): image to pad; $(2): if set, source image copied to $(1) while padding
 define prepare_generic_squashfs
-	$(STAGING_DIR_HOST)/bin/padjffs2 $(1) 4 8 16 64 128 256
+	$(STAGING_DIR_HOST)/bin/padjffs2 $(if $(2),$(2) -o $(1),$(1)) 4 8 16 64 128 256
 endef
 
 define Image/BuildKernel/Initramfs
@@ -238,14 +266,11 @@ endef
 # $(4): compat string
 ifneq ($(CONFIG_NAND_SUPPORT),)
    define Image/Build/SysupgradeNAND
-	mkdir -p "$(KDIR_TMP)/sysupgrade-$(if $(4),$(4),$(1))/"
-	echo "BOARD=$(if $(4),$(4),$(1))" > "$(KDIR_TMP)/sysupgrade-$(if $(4),$(4),$(1))/CONTROL"
-	[ -z "$(2)" ] || $(CP) "$(KDIR)/root.$(2)" "$(KDIR_TMP)/sysupgrade-$(if $(4),$(4),$(1))/root"
-	[ -z "$(3)" ] || $(CP) "$(3)" "$(KDIR_TMP)/sysupgrade-$(if $(4),$(4),$(1))/kernel"
-	(cd "$(KDIR_TMP)"; $(TAR) cvf \
-		"$(BIN_DIR)/$(IMG_PREFIX)-$(1)-$(2)-sysupgrade.tar" sysupgrade-$(if $(4),$(4),$(1)) \
-			$(if $(SOURCE_DATE_EPOCH),--mtime="@$(SOURCE_DATE_EPOCH)") \
-	)
+	sh $(TOPDIR)/scripts/sysupgrade-tar.sh \
+		--board $(if $(4),$(4),$(1)) \
+		$(if $(3),--kernel "$(3)") \
+		$(if $(2),--rootfs "$(KDIR)/root.$(2)") \
+		"$(BIN_DIR)/$(IMG_PREFIX)-$(1)-$(2)-sysupgrade.tar"
    endef
 
 # $(1) board name
@@ -607,6 +632,7 @@ define BuildImage
 
     image_prepare: compile
 		mkdir -p $(BIN_DIR) $(KDIR)/tmp
+		$(IMAGE_CACHE) stats reset
 		$(call Image/Prepare)
 
     legacy-images-prepare-make: image_prepare
@@ -638,5 +664,6 @@ define BuildImage
 
   install: install-images
 	$(call Image/Manifest)
+	$(IMAGE_CACHE) stats
 
 endef
@@ -158,6 +158,18 @@ $(STAGING_DIR_HOST)/bin/mkhash: $(SCRIPT_DIR)/mkhash.c
 
 prereq: $(STAGING_DIR_HOST)/bin/mkhash
 
+$(STAGING_DIR_HOST)/bin/rdep-check: $(SCRIPT_DIR)/rdep-check.c $(SCRIPT_DIR)/mkhash.c
+	mkdir -p $(dir $@)
+	$(CC) -O2 -I$(TOPDIR)/tools/include -o $@ $< -lpthread
+
+prereq: $(STAGING_DIR_HOST)/bin/rdep-check
+
+$(STAGING_DIR_HOST)/bin/sysupgrade-tar: $(SCRIPT_DIR)/sysupgrade-tar.c
+	mkdir -p $(dir $@)
+	$(CC) -O2 -o $@ $<
+
+prereq: $(STAGING_DIR_HOST)/bin/sysupgrade-tar
+
 # Install ldconfig stub
 $(eval $(call TestHostCommand,ldconfig-stub,Failed to install stub, \
 	touch $(STAGING_DIR_HOST)/bin/ldconfig && \
@@ -0,0 +1,12 @@
+#
+# Copyright (C) 2020 OpenWrt.org
+#
+# This is free software, licensed under the GNU General Public License v2.
+# See /LICENSE for more information.
+#
+# Read after a package Makefile by scripts/scan-package.sh to record the
+# makefiles that went into its DUMP=1 output.
+
+ifneq ($(SCAN_RECORD),)
+  $(shell printf '%s\n' $(abspath $(filter-out $(lastword $(MAKEFILE_LIST)),$(MAKEFILE_LIST))) > $(SCAN_RECORD))
+endif
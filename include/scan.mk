@@ -34,26 +34,24 @@ else
   endef
 endif
 
+# Dumps are memoised by scripts/scan-package.sh, misses run in parallel
+SCAN_CACHE:=$(TMP_DIR)/info/.scan-cache
+SCAN_TIMES:=$(TMP_DIR)/info/.scan-times-$(SCAN_TARGET)
+SCAN_ENV:=TOPDIR="$(TOPDIR)" SCAN_NAME="$(SCAN_NAME)" SCAN_MAKEOPTS="$(SCAN_MAKEOPTS)" \
+	SCAN_CACHE="$(SCAN_CACHE)" SCAN_TIMES="$(SCAN_TIMES)" NO_COLOR="$(NO_COLOR)"
+
 define feedname
 $(if $(patsubst feeds/%,,$(1)),,$(word 2,$(subst /, ,$(1))))
 endef
 
+define scandeps
+$(foreach DEP,$(DEPS_$(SCAN_DIR)/$(1)/Makefile) $(SCAN_DEPS),$(wildcard $(if $(filter /%,$(DEP)),$(DEP),$(SCAN_DIR)/$(1)/$(DEP))))
+endef
+
 define PackageDir
   $(TMP_DIR)/.$(SCAN_TARGET): $(TMP_DIR)/info/.$(SCAN_TARGET)-$(1)
-  $(TMP_DIR)/info/.$(SCAN_TARGET)-$(1): $(SCAN_DIR)/$(2)/Makefile $(foreach DEP,$(DEPS_$(SCAN_DIR)/$(2)/Makefile) $(SCAN_DEPS),$(wildcard $(if $(filter /%,$(DEP)),$(DEP),$(SCAN_DIR)/$(2)/$(DEP))))
-	{ \
-		$$(call progress,Collecting $(SCAN_NAME) info: $(SCAN_DIR)/$(2)) \
-		echo Source-Makefile: $(SCAN_DIR)/$(2)/Makefile; \
-		$(if $(3),echo Override: $(3),true); \
-		$(NO_TRACE_MAKE) --no-print-dir -r DUMP=1 FEED="$(call feedname,$(2))" -C $(SCAN_DIR)/$(2) $(SCAN_MAKEOPTS) 2>/dev/null || { \
-			mkdir -p "$(TOPDIR)/logs/$(SCAN_DIR)/$(2)"; \
-			$(NO_TRACE_MAKE) --no-print-dir -r DUMP=1 FEED="$(call feedname,$(2))" -C $(SCAN_DIR)/$(2) $(SCAN_MAKEOPTS) > $(TOPDIR)/logs/$(SCAN_DIR)/$(2)/dump.txt 2>&1; \
-			$$(call progress,ERROR: please fix $(SCAN_DIR)/$(2)/Makefile - see logs/$(SCAN_DIR)/$(2)/dump.txt for details\n) \
-			rm -f $$@; \
-		}; \
-		echo; \
-	} > $$@.tmp
-	mv $$@.tmp $$@
+  $(TMP_DIR)/info/.$(SCAN_TARGET)-$(1): $(SCAN_DIR)/$(2)/Makefile $(call scandeps,$(2))
+	$(SCAN_ENV) $(TOPDIR)/scripts/scan-package.sh $$@ $(SCAN_DIR)/$(2) "$(call feedname,$(2))" "$(3)" $(call scandeps,$(2))
 endef
 
 $(OVERRIDELIST):
@@ -110,7 +108,11 @@ $(TMP_DIR)/.$(SCAN_TARGET): $(TARGET_STAMP)
 	-cat $(FILELIST) | awk '{gsub(/\//, "_", $$0);print "$(TMP_DIR)/info/.$(SCAN_TARGET)-" $$0}' | xargs cat > $@ 2>/dev/null
 	$(call progress,Collecting $(SCAN_NAME) info: done)
 	echo
+	[ ! -s $(SCAN_TIMES) ] || sort -rn $(SCAN_TIMES) | awk ' \
+		{ t += $$1 } \
+		NR == 1 { slow = $$2 " (" $$1 "ms)" } \
+		END { printf "Collecting $(SCAN_NAME) info: %d scanned, %.1fs total, slowest %s\n", NR, t / 1000, slow }' >&2
+	rm -f $(SCAN_TIMES) $(SCAN_TIMES).count
 
 FORCE:
 .PHONY: FORCE
-.NOTPARALLEL:
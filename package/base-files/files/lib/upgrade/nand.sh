@@ -97,6 +97,34 @@ identify_tar() {
 	identify_magic $(get_magic_long_tar "$1" "$2")
 }
 
+# Index of a sysupgrade tar, one "<offset> <size> <magic> <name>" line per
+# member, read in a single pass over the tar headers
+nand_tar_index() {
+	local index
+
+	index="$(fwtool -q -l "$1" 2> /dev/null)" && echo "$index"
+}
+
+# $(1): tar index
+# $(2): member name
+# $(3): field (1: offset, 2: size, 3: magic)
+nand_tar_index_get() {
+	echo "$1" | awk -v name="$2" -v field="$3" '$4 == name { print $field; exit }'
+}
+
+# Write a tar member to stdout, seeking to it directly if the tar is indexed
+nand_tar_cat() {
+	local tar_file="$1"
+	local member="$2"
+	local indexed="$3"
+
+	if [ "$indexed" = 1 ]; then
+		fwtool -q -x "$member" "$tar_file"
+	else
+		tar xf "$tar_file" "$member" -O
+	fi
+}
+
 nand_restore_config() {
 	sync
 	local ubidev=$( nand_find_ubi $CI_UBIPART )
@@ -246,19 +274,36 @@ nand_upgrade_tar() {
 	local tar_file="$1"
 	local kernel_mtd="$(find_mtd_index $CI_KERNPART)"
 
-	local board_dir=$(tar tf $tar_file | grep -m 1 '^sysupgrade-.*/$')
-	board_dir=${board_dir%/}
+	local tar_index="$(nand_tar_index "$tar_file")"
+	local indexed=0
+	local board_dir kernel_length rootfs_length rootfs_type
+
+	if [ -n "$tar_index" ]; then
+		indexed=1
+		board_dir=$(echo "$tar_index" | awk '$4 ~ /^sysupgrade-.*\/$/ { print $4; exit }')
+		board_dir=${board_dir%/}
 
-	local kernel_length=`(tar xf $tar_file ${board_dir}/kernel -O | wc -c) 2> /dev/null`
-	local rootfs_length=`(tar xf $tar_file ${board_dir}/root -O | wc -c) 2> /dev/null`
+		kernel_length=$(nand_tar_index_get "$tar_index" ${board_dir}/kernel 2)
+		rootfs_length=$(nand_tar_index_get "$tar_index" ${board_dir}/root 2)
+		kernel_length=${kernel_length:-0}
+		rootfs_length=${rootfs_length:-0}
 
-	local rootfs_type="$(identify_tar "$tar_file" ${board_dir}/root)"
+		rootfs_type="$(identify_magic $(nand_tar_index_get "$tar_index" ${board_dir}/root 3))"
+	else
+		board_dir=$(tar tf $tar_file | grep -m 1 '^sysupgrade-.*/$')
+		board_dir=${board_dir%/}
+
+		kernel_length=`(tar xf $tar_file ${board_dir}/kernel -O | wc -c) 2> /dev/null`
+		rootfs_length=`(tar xf $tar_file ${board_dir}/root -O | wc -c) 2> /dev/null`
+
+		rootfs_type="$(identify_tar "$tar_file" ${board_dir}/root)"
+	fi
 
 	local has_kernel=1
 	local has_env=0
 
 	[ "$kernel_length" != 0 -a -n "$kernel_mtd" ] && {
-		tar xf $tar_file ${board_dir}/kernel -O | mtd write - $CI_KERNPART
+		nand_tar_cat $tar_file ${board_dir}/kernel $indexed | mtd write - $CI_KERNPART
 	}
 	[ "$kernel_length" = 0 -o ! -z "$kernel_mtd" ] && has_kernel=0
 
@@ -267,12 +312,12 @@ nand_upgrade_tar() {
 	local ubidev="$( nand_find_ubi "$CI_UBIPART" )"
 	[ "$has_kernel" = "1" ] && {
 		local kern_ubivol="$(nand_find_volume $ubidev $CI_KERNPART)"
-		tar xf $tar_file ${board_dir}/kernel -O | \
+		nand_tar_cat $tar_file ${board_dir}/kernel $indexed | \
 			ubiupdatevol /dev/$kern_ubivol -s $kernel_length -
 	}
 
 	local root_ubivol="$(nand_find_volume $ubidev $CI_ROOTPART)"
-	tar xf $tar_file ${board_dir}/root -O | \
+	nand_tar_cat $tar_file ${board_dir}/root $indexed | \
 		ubiupdatevol /dev/$root_ubivol -s $rootfs_length -
 
 	nand_do_upgrade_success
@@ -320,7 +365,15 @@ nand_do_upgrade() {
 nand_do_platform_check() {
 	local board_name="$1"
 	local tar_file="$2"
-	local control_length=`(tar xf $tar_file sysupgrade-$board_name/CONTROL -O | wc -c) 2> /dev/null`
+	local tar_index="$(nand_tar_index "$tar_file")"
+	local control_length
+
+	if [ -n "$tar_index" ]; then
+		control_length=$(nand_tar_index_get "$tar_index" sysupgrade-$board_name/CONTROL 2)
+		control_length=${control_length:-0}
+	else
+		control_length=`(tar xf $tar_file sysupgrade-$board_name/CONTROL -O | wc -c) 2> /dev/null`
+	fi
 	local file_type="$(identify $2)"
 
 	[ "$control_length" = 0 -a "$file_type" != "ubi" -a "$file_type" != "ubifs" ] && {
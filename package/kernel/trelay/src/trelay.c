@@ -19,33 +19,189 @@
 #include <linux/netdevice.h>
 #include <linux/rtnetlink.h>
 #include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/interrupt.h>
+#include <linux/u64_stats_sync.h>
+
+#define TRELAY_MAX_PTYPES	16
+#define TRELAY_BATCH_MAX	64
+
+static bool batch = true;
+module_param(batch, bool, 0644);
+MODULE_PARM_DESC(batch, "Defer transmission to the end of the receive softirq");
 
 static LIST_HEAD(trelay_devs);
 static struct dentry *debugfs_dir;
 
+struct trelay_stats {
+	u64 rx_packets;
+	u64 rx_bytes;
+	u64 tx_packets;
+	u64 tx_bytes;
+	u64 tx_dropped;
+	u64 passthrough;
+	struct u64_stats_sync syncp;
+};
+
+struct trelay_ptypes {
+	struct rcu_head rcu;
+	unsigned int n;
+	__be16 type[];
+};
+
 struct trelay {
 	struct list_head list;
 	struct net_device *dev1, *dev2;
 	struct dentry *debugfs;
+	struct trelay_stats __percpu *stats;
+	struct trelay_ptypes __rcu *ptypes;
 	char name[];
 };
 
+/*
+ * Frames are collected per CPU while the receive softirq runs and handed to
+ * dev_queue_xmit() as one burst from a tasklet, which is processed after
+ * NET_RX has finished its NAPI polls.
+ */
+struct trelay_pcpu {
+	struct sk_buff_head queue;
+	struct tasklet_struct tasklet;
+};
+
+struct trelay_skb_cb {
+	struct trelay *tr;
+};
+
+#define TRELAY_CB(skb) ((struct trelay_skb_cb *)(skb)->cb)
+
+static DEFINE_PER_CPU(struct trelay_pcpu, trelay_pcpu);
+
+static bool trelay_passthrough(struct trelay *tr, __be16 proto)
+{
+	struct trelay_ptypes *pt;
+	int i;
+
+	pt = rcu_dereference(tr->ptypes);
+	if (!pt)
+		return false;
+
+	for (i = 0; i < pt->n; i++)
+		if (pt->type[i] == proto)
+			return true;
+
+	return false;
+}
+
+static void trelay_xmit(struct trelay *tr, struct sk_buff *skb)
+{
+	struct trelay_stats *stats = this_cpu_ptr(tr->stats);
+	unsigned int len = skb->len;
+	int ret;
+
+	ret = dev_queue_xmit(skb);
+
+	u64_stats_update_begin(&stats->syncp);
+	if (likely(ret == NET_XMIT_SUCCESS || ret == NET_XMIT_CN)) {
+		stats->tx_packets++;
+		stats->tx_bytes += len;
+	} else {
+		stats->tx_dropped++;
+	}
+	u64_stats_update_end(&stats->syncp);
+}
+
+static void trelay_flush(struct trelay_pcpu *pcpu)
+{
+	struct sk_buff_head list;
+	struct sk_buff *skb;
+
+	__skb_queue_head_init(&list);
+
+	rcu_read_lock();
+
+	spin_lock_bh(&pcpu->queue.lock);
+	skb_queue_splice_tail_init(&pcpu->queue, &list);
+	spin_unlock_bh(&pcpu->queue.lock);
+
+	while ((skb = __skb_dequeue(&list)) != NULL)
+		trelay_xmit(TRELAY_CB(skb)->tr, skb);
+
+	rcu_read_unlock();
+}
+
+static void trelay_tasklet(unsigned long data)
+{
+	trelay_flush((struct trelay_pcpu *) data);
+}
+
+static void trelay_purge(struct trelay *tr)
+{
+	struct sk_buff *skb, *tmp;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct trelay_pcpu *pcpu = per_cpu_ptr(&trelay_pcpu, cpu);
+
+		spin_lock_bh(&pcpu->queue.lock);
+		skb_queue_walk_safe(&pcpu->queue, skb, tmp) {
+			if (TRELAY_CB(skb)->tr != tr)
+				continue;
+
+			__skb_unlink(skb, &pcpu->queue);
+			kfree_skb(skb);
+		}
+		spin_unlock_bh(&pcpu->queue.lock);
+	}
+}
+
 rx_handler_result_t trelay_handle_frame(struct sk_buff **pskb)
 {
-	struct net_device *dev;
+	struct trelay_stats *stats;
+	struct trelay_pcpu *pcpu;
+	struct trelay *tr;
 	struct sk_buff *skb = *pskb;
+	unsigned int qlen;
 
-	dev = rcu_dereference(skb->dev->rx_handler_data);
-	if (!dev)
+	tr = rcu_dereference(skb->dev->rx_handler_data);
+	if (!tr)
 		return RX_HANDLER_PASS;
 
-	if (skb->protocol == htons(ETH_P_PAE))
+	stats = this_cpu_ptr(tr->stats);
+
+	if (trelay_passthrough(tr, skb->protocol)) {
+		u64_stats_update_begin(&stats->syncp);
+		stats->passthrough++;
+		u64_stats_update_end(&stats->syncp);
 		return RX_HANDLER_PASS;
+	}
 
 	skb_push(skb, ETH_HLEN);
-	skb->dev = dev;
+
+	u64_stats_update_begin(&stats->syncp);
+	stats->rx_packets++;
+	stats->rx_bytes += skb->len;
+	u64_stats_update_end(&stats->syncp);
+
+	skb->dev = skb->dev == tr->dev1 ? tr->dev2 : tr->dev1;
 	skb_forward_csum(skb);
-	dev_queue_xmit(skb);
+
+	if (!READ_ONCE(batch)) {
+		trelay_xmit(tr, skb);
+		return RX_HANDLER_CONSUMED;
+	}
+
+	TRELAY_CB(skb)->tr = tr;
+
+	pcpu = this_cpu_ptr(&trelay_pcpu);
+	spin_lock(&pcpu->queue.lock);
+	__skb_queue_tail(&pcpu->queue, skb);
+	qlen = skb_queue_len(&pcpu->queue);
+	spin_unlock(&pcpu->queue.lock);
+
+	if (qlen >= TRELAY_BATCH_MAX)
+		trelay_flush(pcpu);
+	else if (qlen == 1)
+		tasklet_schedule(&pcpu->tasklet);
 
 	return RX_HANDLER_CONSUMED;
 }
@@ -60,13 +216,19 @@ static int trelay_do_remove(struct trelay *tr)
 {
 	list_del(&tr->list);
 
-	dev_put(tr->dev1);
-	dev_put(tr->dev2);
-
 	netdev_rx_handler_unregister(tr->dev1);
 	netdev_rx_handler_unregister(tr->dev2);
 
+	/* drop deferred frames, then wait for flushes already in progress */
+	trelay_purge(tr);
+	synchronize_net();
+
+	dev_put(tr->dev1);
+	dev_put(tr->dev2);
+
 	debugfs_remove_recursive(tr->debugfs);
+	free_percpu(tr->stats);
+	kfree(rcu_dereference_protected(tr->ptypes, 1));
 	kfree(tr);
 
 	return 0;
@@ -125,10 +287,156 @@ static const struct file_operations fops_remove = {
 	.llseek = default_llseek,
 };
 
+static int trelay_stats_show(struct seq_file *s, void *unused)
+{
+	struct trelay *tr = s->private;
+	struct trelay_stats sum = {};
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct trelay_stats *stats = per_cpu_ptr(tr->stats, cpu);
+		u64 rx_packets, rx_bytes, tx_packets, tx_bytes;
+		u64 tx_dropped, passthrough;
+		unsigned int start;
+
+		do {
+			start = u64_stats_fetch_begin_irq(&stats->syncp);
+			rx_packets = stats->rx_packets;
+			rx_bytes = stats->rx_bytes;
+			tx_packets = stats->tx_packets;
+			tx_bytes = stats->tx_bytes;
+			tx_dropped = stats->tx_dropped;
+			passthrough = stats->passthrough;
+		} while (u64_stats_fetch_retry_irq(&stats->syncp, start));
+
+		sum.rx_packets += rx_packets;
+		sum.rx_bytes += rx_bytes;
+		sum.tx_packets += tx_packets;
+		sum.tx_bytes += tx_bytes;
+		sum.tx_dropped += tx_dropped;
+		sum.passthrough += passthrough;
+	}
+
+	seq_printf(s, "rx_packets: %llu\n", sum.rx_packets);
+	seq_printf(s, "rx_bytes: %llu\n", sum.rx_bytes);
+	seq_printf(s, "tx_packets: %llu\n", sum.tx_packets);
+	seq_printf(s, "tx_bytes: %llu\n", sum.tx_bytes);
+	seq_printf(s, "tx_dropped: %llu\n", sum.tx_dropped);
+	seq_printf(s, "passthrough: %llu\n", sum.passthrough);
+
+	return 0;
+}
+
+static int trelay_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, trelay_stats_show, inode->i_private);
+}
+
+static const struct file_operations fops_stats = {
+	.owner = THIS_MODULE,
+	.open = trelay_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int trelay_ptypes_show(struct seq_file *s, void *unused)
+{
+	struct trelay *tr = s->private;
+	struct trelay_ptypes *pt;
+	int i;
+
+	rcu_read_lock();
+	pt = rcu_dereference(tr->ptypes);
+	for (i = 0; pt && i < pt->n; i++)
+		seq_printf(s, "%s0x%04x", i ? " " : "", ntohs(pt->type[i]));
+	rcu_read_unlock();
+
+	seq_putc(s, '\n');
+
+	return 0;
+}
+
+static int trelay_ptypes_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, trelay_ptypes_show, inode->i_private);
+}
+
+static struct trelay_ptypes *trelay_ptypes_alloc(unsigned int n)
+{
+	struct trelay_ptypes *pt;
+
+	pt = kzalloc(sizeof(*pt) + n * sizeof(pt->type[0]), GFP_KERNEL);
+	if (pt)
+		pt->n = n;
+
+	return pt;
+}
+
+static ssize_t trelay_ptypes_write(struct file *file, const char __user *ubuf,
+				   size_t count, loff_t *ppos)
+{
+	struct seq_file *s = file->private_data;
+	struct trelay *tr = s->private;
+	struct trelay_ptypes *pt, *old;
+	__be16 type[TRELAY_MAX_PTYPES];
+	char buf[256];
+	char *cur, *tok;
+	unsigned int n = 0;
+	ssize_t len;
+	u16 val;
+
+	len = min(count, sizeof(buf) - 1);
+	if (copy_from_user(buf, ubuf, len))
+		return -EFAULT;
+
+	buf[len] = 0;
+
+	cur = buf;
+	while ((tok = strsep(&cur, " ,\t\n")) != NULL) {
+		if (!*tok)
+			continue;
+
+		if (n >= ARRAY_SIZE(type))
+			return -E2BIG;
+
+		if (kstrtou16(tok, 0, &val))
+			return -EINVAL;
+
+		type[n++] = htons(val);
+	}
+
+	pt = trelay_ptypes_alloc(n);
+	if (!pt)
+		return -ENOMEM;
+
+	memcpy(pt->type, type, n * sizeof(type[0]));
+
+	rtnl_lock();
+	old = rcu_dereference_protected(tr->ptypes, lockdep_rtnl_is_held());
+	rcu_assign_pointer(tr->ptypes, pt);
+	rtnl_unlock();
+
+	if (old)
+		kfree_rcu(old, rcu);
+
+	return count;
+}
+
+static const struct file_operations fops_ptypes = {
+	.owner = THIS_MODULE,
+	.open = trelay_ptypes_open,
+	.read = seq_read,
+	.write = trelay_ptypes_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 
 static int trelay_do_add(char *name, char *devn1, char *devn2)
 {
 	struct net_device *dev1, *dev2;
+	struct trelay_ptypes *pt;
 	struct trelay *tr, *tr1;
 	int ret;
 
@@ -136,6 +444,18 @@ static int trelay_do_add(char *name, char *devn1, char *devn2)
 	if (!tr)
 		return -ENOMEM;
 
+	tr->stats = netdev_alloc_pcpu_stats(struct trelay_stats);
+	pt = trelay_ptypes_alloc(1);
+	if (!tr->stats || !pt) {
+		free_percpu(tr->stats);
+		kfree(pt);
+		kfree(tr);
+		return -ENOMEM;
+	}
+
+	pt->type[0] = htons(ETH_P_PAE);
+	RCU_INIT_POINTER(tr->ptypes, pt);
+
 	rtnl_lock();
 	rcu_read_lock();
 
@@ -151,11 +471,11 @@ static int trelay_do_add(char *name, char *devn1, char *devn2)
 	if (!dev1 || !dev2)
 		goto out;
 
-	ret = netdev_rx_handler_register(dev1, trelay_handle_frame, dev2);
+	ret = netdev_rx_handler_register(dev1, trelay_handle_frame, tr);
 	if (ret < 0)
 		goto out;
 
-	ret = netdev_rx_handler_register(dev2, trelay_handle_frame, dev1);
+	ret = netdev_rx_handler_register(dev2, trelay_handle_frame, tr);
 	if (ret < 0) {
 		netdev_rx_handler_unregister(dev1);
 		goto out;
@@ -171,13 +491,19 @@ static int trelay_do_add(char *name, char *devn1, char *devn2)
 
 	tr->debugfs = debugfs_create_dir(name, debugfs_dir);
 	debugfs_create_file("remove", S_IWUSR, tr->debugfs, tr, &fops_remove);
+	debugfs_create_file("stats", S_IRUSR, tr->debugfs, tr, &fops_stats);
+	debugfs_create_file("passthrough", S_IRUSR | S_IWUSR, tr->debugfs, tr,
+			    &fops_ptypes);
 	ret = 0;
 
 out:
 	rcu_read_unlock();
 	rtnl_unlock();
-	if (ret < 0)
+	if (ret < 0) {
+		free_percpu(tr->stats);
+		kfree(pt);
 		kfree(tr);
+	}
 
 	return ret;
 }
@@ -234,7 +560,15 @@ static struct notifier_block tr_dev_notifier = {
 
 static int __init trelay_init(void)
 {
-	int ret;
+	int ret, cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct trelay_pcpu *pcpu = per_cpu_ptr(&trelay_pcpu, cpu);
+
+		skb_queue_head_init(&pcpu->queue);
+		tasklet_init(&pcpu->tasklet, trelay_tasklet,
+			     (unsigned long) pcpu);
+	}
 
 	debugfs_dir = debugfs_create_dir("trelay", NULL);
 	if (!debugfs_dir)
@@ -256,6 +590,7 @@ error:
 static void __exit trelay_exit(void)
 {
 	struct trelay *tr, *tmp;
+	int cpu;
 
 	unregister_netdevice_notifier(&tr_dev_notifier);
 
@@ -264,6 +599,13 @@ static void __exit trelay_exit(void)
 		trelay_do_remove(tr);
 	rtnl_unlock();
 
+	for_each_possible_cpu(cpu) {
+		struct trelay_pcpu *pcpu = per_cpu_ptr(&trelay_pcpu, cpu);
+
+		tasklet_kill(&pcpu->tasklet);
+		skb_queue_purge(&pcpu->queue);
+	}
+
 	debugfs_remove_recursive(debugfs_dir);
 }
 
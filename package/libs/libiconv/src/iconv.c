@@ -140,75 +140,83 @@ static inline void put_16(unsigned char *s, wchar_t c, int endian)
 
 static inline int utf8enc_wchar(char *outb, wchar_t c)
 {
+	static const unsigned char lead[] = { 0, 0, 0xC0, 0xE0, 0xF0 };
+	unsigned char *out = (unsigned char *)outb;
+	int n, i;
+
 	if (c <= 0x7F) {
-		*outb = c;
+		*out = c;
 		return 1;
 	}
-	else if (c <= 0x7FF) {
-		*outb++ = ((c >>  6) & 0x1F) | 0xC0;
-		*outb++ = ( c        & 0x3F) | 0x80;
-		return 2;
-	}
-	else if (c <= 0xFFFF) {
-		*outb++ = ((c >> 12) & 0x0F) | 0xE0;
-		*outb++ = ((c >>  6) & 0x3F) | 0x80;
-		*outb++ = ( c        & 0x3F) | 0x80;
-		return 3;
-	}
-	else if (c <= 0x10FFFF) {
-		*outb++ = ((c >> 18) & 0x07) | 0xF0;
-		*outb++ = ((c >> 12) & 0x3F) | 0x80;
-		*outb++ = ((c >>  6) & 0x3F) | 0x80;
-		*outb++ = ( c        & 0x3F) | 0x80;
-		return 4;
-	}
+
+	if (c <= 0x7FF)
+		n = 2;
+	else if (c <= 0xFFFF)
+		n = 3;
+	else if (c <= 0x10FFFF)
+		n = 4;
 	else {
-		*outb++ = '?';
+		*out = '?';
 		return 1;
 	}
-}
 
-static inline int utf8seq_is_overlong(char *s, int n)
-{
-	switch (n)
-	{
-	case 2:
-		/* 1100000x (10xxxxxx) */
-		return (((*s >> 1) == 0x60) &&
-				((*(s+1) >> 6) == 0x02));
-
-	case 3:
-		/* 11100000 100xxxxx (10xxxxxx) */
-		return ((*s == 0xE0) &&
-				((*(s+1) >> 5) == 0x04) &&
-				((*(s+2) >> 6) == 0x02));
-
-	case 4:
-		/* 11110000 1000xxxx (10xxxxxx 10xxxxxx) */
-		return ((*s == 0xF0) &&
-				((*(s+1) >> 4) == 0x08) &&
-				((*(s+2) >> 6) == 0x02) &&
-				((*(s+3) >> 6) == 0x02));
+	for (i = n - 1; i > 0; i--) {
+		out[i] = (c & 0x3F) | 0x80;
+		c >>= 6;
 	}
+	out[0] = c | lead[n];
 
-	return 0;
+	return n;
 }
 
-static inline int utf8seq_is_surrogate(char *s, int n)
-{
-	return ((n == 3) && (*s == 0xED) && (*(s+1) >= 0xA0) && (*(s+1) <= 0xBF));
-}
+/*
+ * UTF-8 decoder DFA. Every byte is mapped to a class, the state machine
+ * then only accepts the well-formed sequences of Unicode table 3-7, i.e.
+ * no overlong forms, surrogates or code points above U+10FFFF.
+ */
+#define UTF8_ACCEPT 0
+#define UTF8_REJECT 1
+
+static const unsigned char utf8_class[256] = {
+	/* 00..7F */
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	/* 80..8F, 90..9F, A0..BF */
+	1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1, 2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,
+	3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3, 3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,
+	/* C0..C1 (overlong), C2..DF */
+	11,11,4,4,4,4,4,4,4,4,4,4,4,4,4,4, 4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,
+	/* E0, E1..EC, ED, EE..EF */
+	5,6,6,6,6,6,6,6,6,6,6,6,6,7,6,6,
+	/* F0, F1..F3, F4, F5..FF */
+	8,9,9,9,10,11,11,11,11,11,11,11,11,11,11,11,
+};
 
-static inline int utf8seq_is_illegal(char *s, int n)
-{
-	return ((n == 3) && (*s == 0xEF) && (*(s+1) == 0xBF) &&
-	        (*(s+2) >= 0xBE) && (*(s+2) <= 0xBF));
-}
+/* payload bits of a lead byte, by class */
+static const unsigned char utf8_lead_mask[12] = {
+	0x7F, 0, 0, 0, 0x1F, 0x0F, 0x0F, 0x0F, 0x07, 0x07, 0x07, 0,
+};
+
+static const unsigned char utf8_state[9][12] = {
+	/*            00 80 90 A0 C2 E0 E1 ED F0 F1 F4 C0 */
+	/* accept */ { 0, 1, 1, 1, 2, 4, 3, 5, 7, 6, 8, 1 },
+	/* reject */ { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 },
+	/* 1 left */ { 1, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1 },
+	/* 2 left */ { 1, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1 },
+	/* E0 xx  */ { 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 1 },
+	/* ED xx  */ { 1, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1 },
+	/* 3 left */ { 1, 3, 3, 3, 1, 1, 1, 1, 1, 1, 1, 1 },
+	/* F0 xx  */ { 1, 1, 3, 3, 1, 1, 1, 1, 1, 1, 1, 1 },
+	/* F4 xx  */ { 1, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 },
+};
 
 static inline int utf8dec_wchar(wchar_t *c, unsigned char *in, size_t inb)
 {
-	int i;
-	int n = -1;
+	unsigned char state = UTF8_ACCEPT, type;
+	wchar_t cp;
+	size_t i;
 
 	/* trivial char */
 	if (*in <= 0x7F) {
@@ -216,41 +224,94 @@ static inline int utf8dec_wchar(wchar_t *c, unsigned char *in, size_t inb)
 		return 1;
 	}
 
-	/* find utf8 sequence length */
-	if      ((*in & 0xE0) == 0xC0) n = 2;
-	else if ((*in & 0xF0) == 0xE0) n = 3;
-	else if ((*in & 0xF8) == 0xF0) n = 4;
-	else if ((*in & 0xFC) == 0xF8) n = 5;
-	else if ((*in & 0xFE) == 0xFC) n = 6;
-
-	/* starved? */
-	if (n > inb)
-		return -2;
-
-	/* decode ... */
-	if (n > 1 && n < 5) {
-		/* reject invalid sequences */
-		if (utf8seq_is_overlong(in, n) ||
-			utf8seq_is_surrogate(in, n) ||
-			utf8seq_is_illegal(in, n))
-			return -1;
-
-		/* decode ... */
-		*c = (char)(*in++ & (0x7F >> n));
-
-		for (i = 1; i < n; i++) {
-			/* illegal continuation byte */
-			if (*in < 0x80 || *in > 0xBF)
-				return -1;
-
-			*c = (*c << 6) | (*in++ & 0x3F);
-		}
+	type = utf8_class[*in];
+	cp = *in & utf8_lead_mask[type];
+	state = utf8_state[state][type];
 
-		return n;
+	for (i = 1; state > UTF8_REJECT; i++) {
+		/* starved? */
+		if (i >= inb)
+			return -2;
+
+		state = utf8_state[state][utf8_class[in[i]]];
+		cp = (cp << 6) | (in[i] & 0x3F);
 	}
 
-	/* unmapped sequence (> 4) */
-	return -1;
+	if (state == UTF8_REJECT)
+		return -1;
+
+	/* U+FFFE and U+FFFF are not characters */
+	if (cp >= 0xFFFE && cp <= 0xFFFF)
+		return -1;
+
+	*c = cp;
+	return i;
+}
+
+/*
+ * Length of the run of ASCII bytes at s, at most n. Checks a word at a time,
+ * with unaligned loads done through memcpy().
+ */
+static inline size_t ascii_run(const unsigned char *s, size_t n)
+{
+	const size_t high = (size_t)-1 / 0xFF * 0x80;
+	size_t i = 0, w;
+
+	for (; i + sizeof(w) <= n; i += sizeof(w)) {
+		memcpy(&w, s + i, sizeof(w));
+		if (w & high)
+			break;
+	}
+
+	while (i < n && s[i] < 0x80)
+		i++;
+
+	return i;
+}
+
+/* bytes per ASCII character in the target charset, 0 if not handled in bulk */
+static inline size_t ascii_width(unsigned char to)
+{
+	switch (to) {
+	case UTF_8:
+	case US_ASCII:
+	case LATIN_1:
+	case LATIN_9:
+		return 1;
+	case UTF_16BE:
+	case UTF_16LE:
+		return 2;
+	case WCHAR_T:
+		return sizeof(wchar_t);
+	default:
+		return 0;
+	}
+}
+
+/* Converts the run of ASCII at the start of the input in one go */
+static inline size_t ascii_copy(unsigned char to, size_t w, char **in,
+                                size_t *inb, char **out, size_t *outb)
+{
+	const unsigned char *s = (const unsigned char *)*in;
+	size_t i, k;
+
+	k = ascii_run(s, *inb < *outb / w ? *inb : *outb / w);
+
+	if (w == 1)
+		memcpy(*out, s, k);
+	else if (w == 2)
+		for (i = 0; i < k; i++)
+			put_16((unsigned char *)*out + 2*i, s[i], to);
+	else
+		for (i = 0; i < k; i++)
+			((wchar_t *)*out)[i] = s[i];
+
+	*in += k;
+	*inb -= k;
+	*out += k * w;
+	*outb -= k * w;
+
+	return k;
 }
 
 static inline wchar_t latin9_translit(wchar_t c)
@@ -277,7 +338,7 @@ size_t iconv(iconv_t cd, char **in, size_t *inb, char **out, size_t *outb)
 	const unsigned char *map = 0;
 	char tmp[MB_LEN_MAX];
 	wchar_t c, d;
-	size_t k, l;
+	size_t k, l, ascii = 0;
 	int err;
 
 	if (!in || !*in || !*inb) return 0;
@@ -287,7 +348,15 @@ size_t iconv(iconv_t cd, char **in, size_t *inb, char **out, size_t *outb)
 	else
 		from = cd>>8;
 
+	/* all sources from UTF_8 on, including the charmaps, are ASCII supersets */
+	if (from >= UTF_8)
+		ascii = ascii_width(to);
+
 	for (; *inb; *in+=l, *inb-=l) {
+		if (ascii && **(unsigned char **)in < 0x80 &&
+		    ascii_copy(to, ascii, in, inb, out, outb) && !*inb)
+			break;
+
 		c = *(unsigned char *)*in;
 		l = 1;
 		if (from >= UTF_8 && c < 0x80) goto charok;
@@ -0,0 +1,267 @@
+/*
+ * Measures the iconv() throughput per charset pair, in MB/s of input.
+ *
+ * Two inputs are used for every pair: plain ASCII, and text where about
+ * one character in four is a non-ASCII one that both charsets can
+ * represent. Each buffer is converted in a single call, repeatedly, until
+ * enough time has passed for a stable figure.
+ *
+ * usage: bench [-s <input size in KiB>] [<from> <to>]...
+ */
+
+#include <iconv.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_UNITS	256
+#define MIN_TIME	0.25
+
+struct unit {
+	unsigned char len;
+	char s[8];
+};
+
+static const char *const default_pairs[] = {
+	"ISO-8859-1",	"UTF-8",
+	"UTF-8",	"ISO-8859-1",
+	"US-ASCII",	"UTF-8",
+	"UTF-8",	"UTF-8",
+	"UTF-8",	"UTF-16LE",
+	"UTF-16LE",	"UTF-8",
+	"UTF-8",	"WCHAR_T",
+	"WCHAR_T",	"UTF-8",
+	"ISO-8859-15",	"UTF-8",
+	"TIS-620",	"UTF-8",
+	"WINDOWS-1250",	"UTF-8",
+	"KOI8-R",	"UTF-8",
+	"KOI8-R",	"UTF-16BE",
+	NULL
+};
+
+/* Latin-1, Latin-9, Latin Extended-A, Greek, Cyrillic, Thai, CJK, emoji */
+static const unsigned int candidates[][2] = {
+	{ 0x00a0, 0x00ff },
+	{ 0x0152, 0x0153 },
+	{ 0x0160, 0x0161 },
+	{ 0x0178, 0x017e },
+	{ 0x0391, 0x03c9 },
+	{ 0x0410, 0x044f },
+	{ 0x0e01, 0x0e3a },
+	{ 0x20ac, 0x20ac },
+	{ 0x4e00, 0x4e0f },
+	{ 0x1f600, 0x1f60f },
+};
+
+static int utf8_put(char *s, unsigned int c)
+{
+	if (c < 0x80) {
+		s[0] = c;
+		return 1;
+	}
+	if (c < 0x800) {
+		s[0] = 0xc0 | (c >> 6);
+		s[1] = 0x80 | (c & 0x3f);
+		return 2;
+	}
+	if (c < 0x10000) {
+		s[0] = 0xe0 | (c >> 12);
+		s[1] = 0x80 | ((c >> 6) & 0x3f);
+		s[2] = 0x80 | (c & 0x3f);
+		return 3;
+	}
+	s[0] = 0xf0 | (c >> 18);
+	s[1] = 0x80 | ((c >> 12) & 0x3f);
+	s[2] = 0x80 | ((c >> 6) & 0x3f);
+	s[3] = 0x80 | (c & 0x3f);
+	return 4;
+}
+
+/* converts all of in, returns the output length or -1 */
+static ssize_t convert(iconv_t cd, char *in, size_t inb, char *out,
+		       size_t outb)
+{
+	size_t left = outb;
+
+	if (iconv(cd, &in, &inb, &out, &left) == (size_t)-1 || inb)
+		return -1;
+
+	return outb - left;
+}
+
+/*
+ * Adds the source encoding of c to units, if the pair can convert it.
+ * Sources that cannot be written by iconv() are the charmaps, for those
+ * c is taken as a byte value.
+ */
+static void add_unit(iconv_t enc, iconv_t cd, unsigned int c,
+		     struct unit *units, int *n)
+{
+	char buf[8], out[32];
+	struct unit *u = &units[*n];
+	ssize_t len;
+
+	if (*n == MAX_UNITS)
+		return;
+
+	if (enc == (iconv_t)-1) {
+		if (c > 0xff)
+			return;
+		u->s[0] = c;
+		u->len = 1;
+	} else {
+		len = convert(enc, buf, utf8_put(buf, c), u->s, sizeof(u->s));
+		if (len <= 0)
+			return;
+		u->len = len;
+	}
+
+	if (convert(cd, u->s, u->len, out, sizeof(out)) > 0)
+		(*n)++;
+}
+
+static void fill(char *buf, size_t size, const struct unit *ascii, int n_ascii,
+		 const struct unit *other, int n_other, size_t *len)
+{
+	const struct unit *u;
+	size_t pos = 0;
+
+	for (;;) {
+		if (n_other && !(rand() % 4))
+			u = &other[rand() % n_other];
+		else
+			u = &ascii[rand() % n_ascii];
+		if (pos + u->len > size)
+			break;
+		memcpy(buf + pos, u->s, u->len);
+		pos += u->len;
+	}
+	*len = pos;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* returns MB/s, or a negative value if the conversion failed */
+static double measure(iconv_t cd, char *in, size_t len, char *out,
+		      size_t outb)
+{
+	double start, t;
+	long runs = 0;
+
+	if (convert(cd, in, len, out, outb) < 0)
+		return -1;
+
+	start = now();
+	do {
+		convert(cd, in, len, out, outb);
+		runs++;
+		t = now() - start;
+	} while (t < MIN_TIME);
+
+	return len * runs / t / 1e6;
+}
+
+static void print_rate(double rate)
+{
+	if (rate < 0)
+		printf("  %10s", "failed");
+	else
+		printf("  %10.0f", rate);
+}
+
+static int bench(const char *from, const char *to, size_t size)
+{
+	static struct unit ascii[MAX_UNITS], other[MAX_UNITS];
+	int n_ascii = 0, n_other = 0;
+	unsigned int c;
+	iconv_t enc, cd;
+	char *in, *out;
+	size_t i, len;
+
+	cd = iconv_open(to, from);
+	if (cd == (iconv_t)-1) {
+		fprintf(stderr, "%s -> %s: not supported\n", from, to);
+		return 1;
+	}
+	enc = iconv_open(from, "UTF-8");
+
+	for (c = 0x20; c < 0x7f; c++)
+		add_unit(enc, cd, c, ascii, &n_ascii);
+	for (i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++)
+		for (c = candidates[i][0]; c <= candidates[i][1]; c++)
+			add_unit(enc, cd, c, other, &n_other);
+
+	in = malloc(size);
+	out = malloc(4 * size + 16);
+	if (!in || !out) {
+		perror("malloc");
+		exit(1);
+	}
+
+	printf("%-14s -> %-14s", from, to);
+	srand(1);
+	fill(in, size, ascii, n_ascii, NULL, 0, &len);
+	print_rate(measure(cd, in, len, out, 4 * size + 16));
+	if (n_other) {
+		fill(in, size, ascii, n_ascii, other, n_other, &len);
+		print_rate(measure(cd, in, len, out, 4 * size + 16));
+	} else {
+		printf("  %10s", "-");
+	}
+	putchar('\n');
+	fflush(stdout);
+
+	free(in);
+	free(out);
+	iconv_close(cd);
+	if (enc != (iconv_t)-1)
+		iconv_close(enc);
+	return 0;
+}
+
+static int usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-s <input size in KiB>] [<from> <to>]...\n",
+		prog);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	const char *const *pairs = default_pairs;
+	size_t size = 1024 * 1024;
+	int ch, ret = 0;
+
+	while ((ch = getopt(argc, argv, "s:")) != -1) {
+		switch (ch) {
+		case 's':
+			size = strtoul(optarg, NULL, 0) * 1024;
+			if (!size)
+				return usage(argv[0]);
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	if (optind < argc) {
+		if ((argc - optind) % 2)
+			return usage(argv[0]);
+		argv[argc] = NULL;
+		pairs = (const char *const *)&argv[optind];
+	}
+
+	printf("%-32s  %10s  %10s\n", "MB/s", "ASCII", "mixed");
+	for (; *pairs; pairs += 2)
+		ret |= bench(pairs[0], pairs[1], size);
+
+	return ret;
+}
@@ -59,6 +59,7 @@ static bool quiet = false;
 static bool printed = false;
 
 static struct cidr *stack = NULL;
+static struct cidr *pool = NULL;
 
 #define qprintf(...) \
 	do { \
@@ -66,6 +67,34 @@ static struct cidr *stack = NULL;
 		printed = true; \
 	} while(0)
 
+static struct cidr * cidr_alloc(void)
+{
+	struct cidr *a = pool;
+
+	if (a)
+	{
+		pool = a->next;
+		return a;
+	}
+
+	a = malloc(sizeof(*a));
+
+	if (!a)
+	{
+		fprintf(stderr, "out of memory\n");
+		exit(255);
+	}
+
+	return a;
+}
+
+/* keep freed entries for reuse, batch mode parses and clones a lot of them */
+static void cidr_free(struct cidr *a)
+{
+	a->next = pool;
+	pool = a;
+}
+
 static void cidr_push(struct cidr *a)
 {
 	if (a)
@@ -82,7 +111,7 @@ static bool cidr_pop(struct cidr *a)
 	if (old)
 	{
 		stack = stack->next;
-		free(old);
+		cidr_free(old);
 
 		return true;
 	}
@@ -92,13 +121,7 @@ static bool cidr_pop(struct cidr *a)
 
 static struct cidr * cidr_clone(struct cidr *a)
 {
-	struct cidr *b = malloc(sizeof(*b));
-
-	if (!b)
-	{
-		fprintf(stderr, "out of memory\n");
-		exit(255);
-	}
+	struct cidr *b = cidr_alloc();
 
 	memcpy(b, a, sizeof(*b));
 	cidr_push(b);
@@ -111,9 +134,9 @@ static struct cidr * cidr_parse4(const char *s)
 {
 	char *p = NULL, *r;
 	struct in_addr mask;
-	struct cidr *addr = malloc(sizeof(struct cidr));
+	struct cidr *addr = cidr_alloc();
 
-	if (!addr || (strlen(s) >= sizeof(addr->buf.v4)))
+	if (strlen(s) >= sizeof(addr->buf.v4))
 		goto err;
 
 	snprintf(addr->buf.v4, sizeof(addr->buf.v4), "%s", s);
@@ -153,8 +176,7 @@ static struct cidr * cidr_parse4(const char *s)
 	return addr;
 
 err:
-	if (addr)
-		free(addr);
+	cidr_free(addr);
 
 	return NULL;
 }
@@ -356,9 +378,9 @@ static bool cidr_print4(struct cidr *a)
 static struct cidr * cidr_parse6(const char *s)
 {
 	char *p = NULL, *r;
-	struct cidr *addr = malloc(sizeof(struct cidr));
+	struct cidr *addr = cidr_alloc();
 
-	if (!addr || (strlen(s) >= sizeof(addr->buf.v6)))
+	if (strlen(s) >= sizeof(addr->buf.v6))
 		goto err;
 
 	snprintf(addr->buf.v4, sizeof(addr->buf.v6), "%s", s);
@@ -387,8 +409,7 @@ static struct cidr * cidr_parse6(const char *s)
 	return addr;
 
 err:
-	if (addr)
-		free(addr);
+	cidr_free(addr);
 
 	return NULL;
 }
@@ -612,7 +633,8 @@ static bool cidr_print6(struct cidr *a)
 }
 
 
-static struct cidr * cidr_parse(const char *op, const char *s, int af_hint)
+static struct cidr * cidr_parse(const char *op, const char *s, int af_hint,
+                                 int *status)
 {
 	char *r;
 	struct cidr *a;
@@ -622,10 +644,7 @@ static struct cidr * cidr_parse(const char *op, const char *s, int af_hint)
 
 	if ((r > s) && (*r == 0))
 	{
-		a = malloc(sizeof(struct cidr));
-
-		if (!a)
-			return NULL;
+		a = cidr_alloc();
 
 		if (af_hint == AF_INET)
 		{
@@ -662,7 +681,10 @@ static struct cidr * cidr_parse(const char *op, const char *s, int af_hint)
 				op,
 				(af_hint == AF_INET) ? "ipv4" : "ipv6",
 				(af_hint != AF_INET) ? "ipv4" : "ipv6");
-		exit(4);
+
+		cidr_free(a);
+		*status = 4;
+		return NULL;
 	}
 
 	return a;
@@ -694,6 +716,430 @@ static bool cidr_quiet(struct cidr *a)
 }
 
 
+/*
+ * Range sets: lists of prefixes are turned into sorted arrays of disjoint
+ * address intervals, which makes merging, subtracting and lookups over large
+ * prefix lists O(n log n). Addresses are kept as 128 bit big endian numbers,
+ * ipv4 addresses in the last 4 bytes.
+ */
+
+struct range {
+	struct in6_addr lo;
+	struct in6_addr hi;
+};
+
+struct rset {
+	uint8_t family;
+	uint8_t bits;
+	size_t len;
+	size_t size;
+	struct range *r;
+};
+
+static int addr_cmp(const struct in6_addr *a, const struct in6_addr *b)
+{
+	return memcmp(a->s6_addr, b->s6_addr, sizeof(a->s6_addr));
+}
+
+/* set or clear the lowest n bits */
+static void addr_fill(struct in6_addr *a, int n, bool set)
+{
+	int i;
+
+	for (i = 15; n > 0; i--, n -= 8)
+	{
+		uint8_t m = (n >= 8) ? 0xFF : ((1 << n) - 1);
+
+		if (set)
+			a->s6_addr[i] |= m;
+		else
+			a->s6_addr[i] &= ~m;
+	}
+}
+
+/* returns false on wrap around */
+static bool addr_step(struct in6_addr *a, int dir)
+{
+	int i;
+
+	for (i = 15; i >= 0; i--)
+	{
+		a->s6_addr[i] += dir;
+
+		if (a->s6_addr[i] != ((dir > 0) ? 0x00 : 0xFF))
+			return true;
+	}
+
+	return false;
+}
+
+static int addr_ctz(const struct in6_addr *a)
+{
+	int i, n = 0;
+	uint8_t x;
+
+	for (i = 15; i >= 0 && !a->s6_addr[i]; i--)
+		n += 8;
+
+	if (i >= 0)
+		for (x = a->s6_addr[i]; !(x & 1); x >>= 1)
+			n++;
+
+	return n;
+}
+
+static void rset_add(struct rset *s, struct cidr *a)
+{
+	struct range *r;
+
+	if (s->len == s->size)
+	{
+		s->size = s->size ? s->size * 2 : 64;
+		s->r = realloc(s->r, s->size * sizeof(*s->r));
+
+		if (!s->r)
+		{
+			fprintf(stderr, "out of memory\n");
+			exit(255);
+		}
+	}
+
+	r = &s->r[s->len++];
+	memset(&r->lo, 0, sizeof(r->lo));
+
+	if (a->family == AF_INET)
+		memcpy(&r->lo.s6_addr[12], &a->addr.v4, 4);
+	else
+		memcpy(&r->lo, &a->addr.v6, 16);
+
+	addr_fill(&r->lo, s->bits - a->prefix, false);
+	r->hi = r->lo;
+	addr_fill(&r->hi, s->bits - a->prefix, true);
+}
+
+static int range_cmp(const void *a, const void *b)
+{
+	return addr_cmp(&((const struct range *)a)->lo,
+	                &((const struct range *)b)->lo);
+}
+
+/* sort and coalesce overlapping or adjacent ranges */
+static void rset_normalize(struct rset *s)
+{
+	struct in6_addr next;
+	size_t i, n = 0;
+
+	if (!s->len)
+		return;
+
+	qsort(s->r, s->len, sizeof(*s->r), range_cmp);
+
+	for (i = 1; i < s->len; i++)
+	{
+		next = s->r[n].hi;
+
+		/* the last range reaches the end of the address space */
+		if (!addr_step(&next, 1))
+			break;
+
+		if (addr_cmp(&s->r[i].lo, &next) <= 0)
+		{
+			if (addr_cmp(&s->r[i].hi, &s->r[n].hi) > 0)
+				s->r[n].hi = s->r[i].hi;
+		}
+		else
+		{
+			s->r[++n] = s->r[i];
+		}
+	}
+
+	s->len = n + 1;
+}
+
+/* remove all addresses in x from s, both must be normalized */
+static void rset_subtract(struct rset *s, const struct rset *x)
+{
+	struct range *out = NULL;
+	struct in6_addr lo, end;
+	size_t i, j, k = 0, n = 0;
+	bool done;
+
+	if (!s->len || !x->len)
+		return;
+
+	/* each range of x splits at most one range of s into two */
+	out = malloc((s->len + x->len) * sizeof(*out));
+
+	if (!out)
+	{
+		fprintf(stderr, "out of memory\n");
+		exit(255);
+	}
+
+	for (i = 0; i < s->len; i++)
+	{
+		lo = s->r[i].lo;
+		done = false;
+
+		while ((k < x->len) && (addr_cmp(&x->r[k].hi, &lo) < 0))
+			k++;
+
+		for (j = k; j < x->len && addr_cmp(&x->r[j].lo, &s->r[i].hi) <= 0; j++)
+		{
+			if (addr_cmp(&x->r[j].lo, &lo) > 0)
+			{
+				end = x->r[j].lo;
+				addr_step(&end, -1);
+				out[n].lo = lo;
+				out[n++].hi = end;
+			}
+
+			lo = x->r[j].hi;
+
+			if ((addr_cmp(&lo, &s->r[i].hi) >= 0) || !addr_step(&lo, 1))
+			{
+				done = true;
+				break;
+			}
+		}
+
+		if (!done)
+		{
+			out[n].lo = lo;
+			out[n++].hi = s->r[i].hi;
+		}
+	}
+
+	free(s->r);
+	s->r = out;
+	s->len = s->size = n;
+}
+
+/* whether s (normalized) covers the whole prefix a */
+static bool rset_covers(const struct rset *s, struct cidr *a)
+{
+	struct rset q = { .bits = s->bits };
+	size_t lo = 0, hi = s->len;
+	bool rv = false;
+
+	rset_add(&q, a);
+
+	/* find the last range starting at or below the prefix */
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (addr_cmp(&s->r[mid].lo, &q.r[0].lo) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo > 0)
+		rv = (addr_cmp(&q.r[0].hi, &s->r[lo - 1].hi) <= 0);
+
+	free(q.r);
+	return rv;
+}
+
+/* print the smallest list of prefixes exactly covering s */
+static void rset_print(const struct rset *s)
+{
+	struct in6_addr lo, hi;
+	struct cidr *a;
+	size_t i;
+	int n;
+
+	for (i = 0; i < s->len; i++)
+	{
+		lo = s->r[i].lo;
+
+		while (true)
+		{
+			n = addr_ctz(&lo);
+
+			if (n > s->bits)
+				n = s->bits;
+
+			/* largest aligned block starting at lo that fits the range */
+			for (;; n--)
+			{
+				hi = lo;
+				addr_fill(&hi, n, true);
+
+				if (addr_cmp(&hi, &s->r[i].hi) <= 0)
+					break;
+			}
+
+			a = cidr_alloc();
+			a->family = s->family;
+			a->prefix = s->bits - n;
+
+			if (s->family == AF_INET)
+				memcpy(&a->addr.v4, &lo.s6_addr[12], 4);
+			else
+				a->addr.v6 = lo;
+
+			cidr_push(a);
+
+			if (s->family == AF_INET)
+				cidr_print4(a);
+			else
+				cidr_print6(a);
+
+			lo = hi;
+
+			if (!addr_cmp(&hi, &s->r[i].hi) || !addr_step(&lo, 1))
+				break;
+		}
+	}
+}
+
+static void rset_init(struct rset *s)
+{
+	memset(s, 0, sizeof(s[0]) * 2);
+
+	s[0].family = AF_INET;
+	s[0].bits = 32;
+	s[1].family = AF_INET6;
+	s[1].bits = 128;
+}
+
+static void rset_free(struct rset *s)
+{
+	free(s[0].r);
+	free(s[1].r);
+}
+
+/* parse prefixes into s (one set per family) until the given keyword */
+static bool rset_parse(struct rset *s, const char *op, char ***arg,
+                       const char *until)
+{
+	struct cidr *a;
+
+	for (; **arg && !(until && !strcmp(**arg, until)); (*arg)++)
+	{
+		a = strchr(**arg, ':') ? cidr_parse6(**arg) : cidr_parse4(**arg);
+
+		if (!a)
+		{
+			fprintf(stderr, "invalid address argument for '%s'\n", op);
+			return false;
+		}
+
+		rset_add(&s[a->family == AF_INET6], a);
+		cidr_free(a);
+	}
+
+	return true;
+}
+
+/* merge {prefix} ... [exclude {prefix} ...] */
+static int rset_merge(char **arg)
+{
+	struct rset s[2], x[2];
+	int i, status = 0;
+
+	rset_init(s);
+	rset_init(x);
+
+	if (!rset_parse(s, "merge", &arg, "exclude"))
+	{
+		status = 3;
+		goto out;
+	}
+
+	if (*arg)
+	{
+		arg++;
+
+		if (!rset_parse(x, "exclude", &arg, NULL))
+		{
+			status = 3;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < 2; i++)
+	{
+		rset_normalize(&s[i]);
+		rset_normalize(&x[i]);
+		rset_subtract(&s[i], &x[i]);
+		rset_print(&s[i]);
+	}
+
+out:
+	rset_free(s);
+	rset_free(x);
+
+	return status;
+}
+
+/* match {prefix} ... in {prefix} ... */
+static int rset_match(char **arg)
+{
+	struct rset s[2];
+	char **query = arg;
+	struct cidr *a;
+	int status = 0;
+
+	rset_init(s);
+
+	while (*arg && strcmp(*arg, "in"))
+		arg++;
+
+	if (!*arg)
+	{
+		fprintf(stderr, "'match' requires an 'in' argument\n");
+		status = 2;
+		goto out;
+	}
+
+	arg++;
+
+	if (!rset_parse(s, "match", &arg, NULL))
+	{
+		status = 3;
+		goto out;
+	}
+
+	rset_normalize(&s[0]);
+	rset_normalize(&s[1]);
+
+	for (; *query && strcmp(*query, "in"); query++)
+	{
+		a = strchr(*query, ':') ? cidr_parse6(*query) : cidr_parse4(*query);
+
+		if (!a)
+		{
+			fprintf(stderr, "invalid address argument for 'match'\n");
+			status = 3;
+			goto out;
+		}
+
+		if (printed)
+			qprintf(" ");
+
+		if (rset_covers(&s[a->family == AF_INET6], a))
+		{
+			qprintf("1");
+		}
+		else
+		{
+			qprintf("0");
+			status = 1;
+		}
+
+		cidr_free(a);
+	}
+
+out:
+	rset_free(s);
+
+	return status;
+}
+
+
 struct op ops[] = {
 	{ .name = "add",
 	  .desc = "Add argument to base address",
@@ -790,9 +1236,17 @@ static void usage(const char *prog)
 	        "\n"
 	        "Usage:\n\n"
 	        "  %s {base address} operation [argument] "
-	        "[operation [argument] ...]\n\n"
+	        "[operation [argument] ...]\n"
+	        "  %s merge {prefix} [...] [exclude {prefix} [...]]\n"
+	        "  %s match {prefix} [...] in {prefix} [...]\n"
+	        "  %s -\n\n"
+	        "  'merge' prints the smallest list of prefixes covering all given\n"
+	        "  prefixes except the excluded ones. 'match' prints '1' for each\n"
+	        "  left-hand prefix covered by the right-hand ones or '0' if not.\n"
+	        "  With '-', one calculation per line is read from stdin and one\n"
+	        "  line of output is printed for each.\n\n"
 	        "Operations:\n\n",
-	        prog);
+	        prog, prog, prog, prog);
 
 	for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++)
 	{
@@ -826,8 +1280,11 @@ static void usage(const char *prog)
 			"  192.168.1.250\n\n"
 			" Count number of prefixes:\n\n"
 			"  $ %s 2001:0DB8:FDEF::/48 howmany ::/64\n"
-			"  65536\n\n",
-	        prog, prog);
+			"  65536\n\n"
+			" Aggregate a prefix list:\n\n"
+			"  $ %s merge 10.0.0.0/24 10.0.1.0/24 10.0.2.0/23 exclude 10.0.3.0/24\n"
+			"  10.0.0.0/23 10.0.2.0/24\n\n",
+	        prog, prog, prog);
 
 	exit(1);
 }
@@ -858,14 +1315,18 @@ static bool runop(char ***arg, int *status)
 					return false;
 				}
 
-				b = cidr_parse(ops[i].name, arg2, a->family);
+				b = cidr_parse(ops[i].name, arg2, a->family, status);
 
 				if (!b)
 				{
-					fprintf(stderr, "invalid address argument for '%s'\n",
-							ops[i].name);
+					if (*status != 4)
+					{
+						fprintf(stderr, "invalid address argument for '%s'\n",
+								ops[i].name);
+
+						*status = 3;
+					}
 
-					*status = 3;
 					return false;
 				}
 
@@ -878,6 +1339,7 @@ static bool runop(char ***arg, int *status)
 					        ops[i].name,
 							(a->family == AF_INET) ? "ipv4" : "ipv6");
 
+					cidr_free(b);
 					*status = 5;
 					return false;
 				}
@@ -885,6 +1347,7 @@ static bool runop(char ***arg, int *status)
 				*status = !((a->family == AF_INET) ? ops[i].f4.a2(a, b)
 				                                   : ops[i].f6.a2(a, b));
 
+				cidr_free(b);
 				return true;
 			}
 			else
@@ -913,28 +1376,54 @@ static bool runop(char ***arg, int *status)
 	return false;
 }
 
-int main(int argc, char **argv)
+/*
+ * Evaluate one calculation, arg is the NULL terminated list of words. Returns
+ * the exit status; aborted is set if the calculation stopped with an error
+ * before its output line was terminated.
+ */
+static int calc(char **arg, bool *aborted)
 {
 	int status = 0;
-	char **arg = argv+2;
 	struct cidr *a;
 
-	if (argc < 3)
-		usage(argv[0]);
+	*aborted = true;
+
+	if (!strcmp(*arg, "merge"))
+		status = rset_merge(arg + 1);
+	else if (!strcmp(*arg, "match"))
+		status = rset_match(arg + 1);
+	else
+		goto expr;
+
+	if (status >= 2)
+		return status;
+
+	*aborted = false;
+	qprintf("\n");
 
-	a = strchr(argv[1], ':') ? cidr_parse6(argv[1]) : cidr_parse4(argv[1]);
+	return status;
+
+expr:
+	a = strchr(*arg, ':') ? cidr_parse6(*arg) : cidr_parse4(*arg);
 
 	if (!a)
-		usage(argv[0]);
+	{
+		fprintf(stderr, "invalid base address '%s'\n", *arg);
+		return 1;
+	}
 
 	cidr_push(a);
+	arg++;
 
 	while (runop(&arg, &status));
 
+	if (status == 4)
+		return status;
+
 	if (*arg)
 	{
 		fprintf(stderr, "unknown operation '%s'\n", *arg);
-		exit(6);
+		return 6;
 	}
 
 	if (!printed && (status < 2))
@@ -945,7 +1434,88 @@ int main(int argc, char **argv)
 			cidr_print6(stack);
 	}
 
+	*aborted = false;
 	qprintf("\n");
 
+	return status;
+}
+
+/* read calculations from stdin, one per line, and answer each with a line */
+static int batch(void)
+{
+	char **words = NULL, *line = NULL, *p;
+	size_t n, len = 0, size = 0;
+	int status, rv = 0;
+	bool aborted;
+
+	while (getline(&line, &len, stdin) != -1)
+	{
+		n = 0;
+
+		for (p = strtok(line, " \t\r\n"); p; p = strtok(NULL, " \t\r\n"))
+		{
+			if (n + 1 >= size)
+			{
+				size = size ? size * 2 : 16;
+				words = realloc(words, size * sizeof(*words));
+
+				if (!words)
+				{
+					fprintf(stderr, "out of memory\n");
+					exit(255);
+				}
+			}
+
+			words[n++] = p;
+		}
+
+		if (!n)
+		{
+			printf("\n");
+			continue;
+		}
+
+		words[n] = NULL;
+
+		status = calc(words, &aborted);
+
+		/* keep answers aligned with the input lines */
+		if (aborted || quiet)
+			printf("\n");
+
+		/* report the first hard error, test results do not count */
+		if ((status >= 2) && !rv)
+			rv = status;
+
+		while (cidr_pop(NULL));
+
+		quiet = false;
+		printed = false;
+
+		fflush(stdout);
+	}
+
+	free(words);
+	free(line);
+
+	return rv;
+}
+
+int main(int argc, char **argv)
+{
+	int status;
+	bool aborted;
+
+	if ((argc == 2) && !strcmp(argv[1], "-"))
+		return batch();
+
+	if (argc < 3)
+		usage(argv[0]);
+
+	status = calc(argv + 1, &aborted);
+
+	if ((status == 1) && aborted)
+		usage(argv[0]);
+
 	exit(status);
 }
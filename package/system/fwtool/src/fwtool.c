@@ -11,6 +11,7 @@
  * GNU General Public License for more details.
  */
 #include <sys/types.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <getopt.h>
 #include <stdbool.h>
@@ -21,6 +22,7 @@
 #include "fwimage.h"
 #include "utils.h"
 #include "crc32.h"
+#include "tar.h"
 
 #define METADATA_MAXLEN		30 * 1024
 #define SIGNATURE_MAXLEN	1 * 1024
@@ -45,6 +47,8 @@ static int file_mode = MODE_DEFAULT;
 static bool truncate_file;
 static bool write_truncated;
 static bool quiet = false;
+static bool tar_list;
+static const char *tar_extract;
 
 static uint32_t crc_table[256];
 
@@ -66,6 +70,8 @@ usage(const char *progname)
 		"  -i <file>:		Extract metadata file from firmware image\n"
 		"  -t:			Remove extracted chunks from firmare image (using -s, -i)\n"
 		"  -T:			Output firmware image without extracted chunks to stdout (using -s, -i)\n"
+		"  -l:			List tar image members as <offset> <size> <magic> <name>\n"
+		"  -x <name>:		Write tar image member to stdout\n"
 		"  -q:			Quiet (suppress error messages)\n"
 		"\n", progname);
 	return 1;
@@ -393,6 +399,77 @@ out:
 	return ret;
 }
 
+static int
+tar_list_cb(struct tar_file *tf, struct tar_member *m, void *priv)
+{
+	uint8_t magic[4];
+	size_t len = m->size < sizeof(magic) ? m->size : sizeof(magic);
+	size_t i;
+
+	if (len && tar_read(tf, magic, len))
+		return -1;
+
+	printf("%llu %llu ", (unsigned long long) m->offset, (unsigned long long) m->size);
+	for (i = 0; i < len; i++)
+		printf("%02x", magic[i]);
+	printf("%s %s\n", len ? "" : "-", m->name);
+
+	return 0;
+}
+
+static int
+tar_extract_cb(struct tar_file *tf, struct tar_member *m, void *priv)
+{
+	uint64_t left = m->size;
+	bool *found = priv;
+	char buf[4096];
+
+	if (strcmp(m->name, tar_extract) != 0)
+		return 0;
+
+	*found = true;
+	while (left) {
+		size_t len = left < sizeof(buf) ? left : sizeof(buf);
+
+		if (tar_read(tf, buf, len) ||
+		    fwrite(buf, len, 1, stdout) != 1)
+			return -1;
+		left -= len;
+	}
+
+	return 1;
+}
+
+static int
+tar_data(const char *name)
+{
+	bool found = false;
+	int ret;
+
+	firmware_file = open_file(name, false);
+	if (!firmware_file) {
+		msg("Failed to open firmware file\n");
+		return 1;
+	}
+
+	if (tar_extract)
+		ret = tar_walk(firmware_file, tar_extract_cb, &found);
+	else
+		ret = tar_walk(firmware_file, tar_list_cb, NULL);
+
+	if (ret) {
+		msg("Invalid tar image\n");
+		return 1;
+	}
+
+	if (tar_extract && !found) {
+		msg("Member %s not found\n", tar_extract);
+		return 1;
+	}
+
+	return fflush(stdout) != 0;
+}
+
 static void cleanup(void)
 {
 	if (signature_file)
@@ -410,7 +487,7 @@ int main(int argc, char **argv)
 
 	crc32_filltable(crc_table);
 
-	while ((ch = getopt(argc, argv, "i:I:qs:S:tT")) != -1) {
+	while ((ch = getopt(argc, argv, "i:I:lqs:S:tTx:")) != -1) {
 		ret = 0;
 		switch(ch) {
 		case 'S':
@@ -434,6 +511,12 @@ int main(int argc, char **argv)
 		case 'q':
 			quiet = true;
 			break;
+		case 'l':
+			tar_list = true;
+			break;
+		case 'x':
+			tar_extract = optarg;
+			break;
 		}
 
 		if (ret)
@@ -445,6 +528,11 @@ int main(int argc, char **argv)
 		goto out;
 	}
 
+	if (tar_list || tar_extract) {
+		ret = tar_data(argv[optind]);
+		goto out;
+	}
+
 	if (file_mode == MODE_DEFAULT) {
 		ret = usage(progname);
 		goto out;
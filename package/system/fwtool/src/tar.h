@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2020 OpenWrt.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#ifndef __FWTOOL_TAR_H
+#define __FWTOOL_TAR_H
+
+/*
+ * Minimal tar reader for sysupgrade images: walks the member headers in a
+ * single pass and seeks over the member data, so that listing an archive
+ * or extracting one member does not read the whole image.
+ * Supports ustar, GNU long names and pax path/size records.
+ */
+
+#define TAR_BLOCK	512
+
+struct tar_header {
+	char name[100];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];
+	char mtime[12];
+	char chksum[8];
+	char typeflag;
+	char linkname[100];
+	char magic[6];
+	char version[2];
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char prefix[155];
+	char pad[12];
+};
+
+struct tar_member {
+	char *name;
+	char type;
+	uint64_t offset;
+	uint64_t size;
+};
+
+struct tar_file {
+	FILE *f;
+	uint64_t pos;
+};
+
+/* return < 0 on error, > 0 to stop walking */
+typedef int (*tar_cb)(struct tar_file *tf, struct tar_member *m, void *priv);
+
+static uint64_t
+tar_number(const char *p, int len)
+{
+	uint64_t val = 0;
+	int i;
+
+	/* base-256 encoding used by GNU tar for large values */
+	if (*p & 0x80) {
+		val = *p & 0x3f;
+		for (i = 1; i < len; i++)
+			val = (val << 8) | (uint8_t) p[i];
+		return val;
+	}
+
+	for (i = 0; i < len && p[i] == ' '; i++);
+	for (; i < len && p[i] >= '0' && p[i] <= '7'; i++)
+		val = (val << 3) | (p[i] - '0');
+
+	return val;
+}
+
+static bool
+tar_checksum_ok(const struct tar_header *h)
+{
+	const uint8_t *p = (const uint8_t *) h;
+	uint64_t sum = 0;
+	size_t i;
+
+	for (i = 0; i < TAR_BLOCK; i++) {
+		if (i >= offsetof(struct tar_header, chksum) &&
+		    i < offsetof(struct tar_header, chksum) + sizeof(h->chksum))
+			sum += ' ';
+		else
+			sum += p[i];
+	}
+
+	return sum == tar_number(h->chksum, sizeof(h->chksum));
+}
+
+static int
+tar_read(struct tar_file *tf, void *buf, size_t len)
+{
+	if (fread(buf, len, 1, tf->f) != 1)
+		return -1;
+
+	tf->pos += len;
+	return 0;
+}
+
+static int
+tar_skip_to(struct tar_file *tf, uint64_t pos)
+{
+	char buf[4096];
+
+	if (pos < tf->pos)
+		return -1;
+
+	if (pos > tf->pos && !fseeko(tf->f, pos, SEEK_SET)) {
+		tf->pos = pos;
+		return 0;
+	}
+
+	/* not seekable, e.g. a pipe */
+	while (tf->pos < pos) {
+		size_t len = sizeof(buf);
+
+		if (len > pos - tf->pos)
+			len = pos - tf->pos;
+		if (tar_read(tf, buf, len))
+			return -1;
+	}
+
+	return 0;
+}
+
+static char *
+tar_read_data(struct tar_file *tf, uint64_t size)
+{
+	char *buf;
+
+	if (size > 64 * 1024)
+		return NULL;
+
+	buf = malloc(size + 1);
+	if (!buf)
+		return NULL;
+
+	if (size && tar_read(tf, buf, size)) {
+		free(buf);
+		return NULL;
+	}
+
+	buf[size] = 0;
+	return buf;
+}
+
+/* apply "<len> <key>=<value>\n" pax records */
+static void
+tar_parse_pax(char *data, uint64_t len, char **name, uint64_t *size, bool *has_size)
+{
+	char *end = data + len;
+
+	while (data < end) {
+		char *rec = data, *key, *val;
+		unsigned long rlen = strtoul(data, &key, 10);
+
+		if (!rlen || *key != ' ' || rlen > (unsigned long) (end - rec))
+			break;
+
+		data = rec + rlen;
+		key++;
+		val = memchr(key, '=', data - key);
+		if (!val || data[-1] != '\n')
+			continue;
+
+		*val++ = 0;
+		data[-1] = 0;
+		if (!strcmp(key, "path")) {
+			free(*name);
+			*name = strdup(val);
+		} else if (!strcmp(key, "size")) {
+			*size = strtoull(val, NULL, 10);
+			*has_size = true;
+		}
+	}
+}
+
+static int
+tar_walk(FILE *f, tar_cb cb, void *priv)
+{
+	struct tar_file tf = { .f = f };
+	struct tar_header h;
+	char *next_name = NULL;
+	uint64_t next_size = 0;
+	bool has_size = false;
+	int ret = 0;
+
+	while (!ret) {
+		struct tar_member m = {};
+		uint64_t end;
+		char *data;
+
+		if (tar_read(&tf, &h, sizeof(h))) {
+			ret = -1;
+			break;
+		}
+
+		/* end of archive */
+		if (!h.name[0])
+			break;
+
+		if (!tar_checksum_ok(&h)) {
+			ret = -1;
+			break;
+		}
+
+		m.type = h.typeflag ? h.typeflag : '0';
+		m.size = tar_number(h.size, sizeof(h.size));
+		m.offset = tf.pos;
+		end = m.offset + ((m.size + TAR_BLOCK - 1) & ~(uint64_t) (TAR_BLOCK - 1));
+
+		switch (m.type) {
+		case 'L':
+			data = tar_read_data(&tf, m.size);
+			if (!data) {
+				ret = -1;
+				goto skip;
+			}
+			free(next_name);
+			next_name = data;
+			goto skip;
+		case 'x':
+			data = tar_read_data(&tf, m.size);
+			if (!data) {
+				ret = -1;
+				goto skip;
+			}
+			tar_parse_pax(data, m.size, &next_name, &next_size, &has_size);
+			free(data);
+			goto skip;
+		case 'g':
+		case 'K':
+			goto skip;
+		}
+
+		if (has_size) {
+			m.size = next_size;
+			end = m.offset + ((m.size + TAR_BLOCK - 1) & ~(uint64_t) (TAR_BLOCK - 1));
+		}
+
+		if (next_name) {
+			m.name = next_name;
+			next_name = NULL;
+		} else if (h.prefix[0] && !memcmp(h.magic, "ustar", 6)) {
+			m.name = malloc(sizeof(h.prefix) + sizeof(h.name) + 2);
+			if (m.name)
+				sprintf(m.name, "%.*s/%.*s",
+					(int) sizeof(h.prefix), h.prefix,
+					(int) sizeof(h.name), h.name);
+		} else {
+			m.name = strndup(h.name, sizeof(h.name));
+		}
+
+		has_size = false;
+		if (!m.name) {
+			ret = -1;
+			break;
+		}
+
+		/* only regular files carry data */
+		if (m.type != '0' && m.type != '7')
+			m.size = 0;
+
+		ret = cb(&tf, &m, priv);
+		free(m.name);
+		if (ret)
+			break;
+
+skip:
+		if (ret || tar_skip_to(&tf, end)) {
+			ret = -1;
+			break;
+		}
+	}
+
+	free(next_name);
+	return ret < 0 ? ret : 0;
+}
+
+#endif
@@ -38,8 +38,13 @@
 # define CLEANMARKER "\x85\x19\x03\x20\x0c\x00\x00\x00\xb1\xb0\x1e\xe4"
 #endif
 
+/* number of erase blocks staged in memory before they are written out */
+#define STAGE_BLOCKS	16
+
 static int last_ino = 0;
 static int last_version = 0;
+static char *stage = NULL;
+static int staged = 0;
 static char *buf = NULL;
 static int ofs = 0;
 static int outfd = -1;
@@ -48,6 +53,57 @@ static int target_ino = 0;
 
 static void prep_eraseblock(void);
 
+/*
+ * Erase and write all staged blocks, skipping bad blocks. Runs of good
+ * blocks are written with a single write() call.
+ */
+static void flush_blocks(void)
+{
+	int i = 0, run = 0;
+
+	while (i < staged) {
+		if (mtdofs >= mtdsize) {
+			fprintf(stderr, "Insufficient space.\n");
+			exit(1);
+		}
+
+		if (mtd_block_is_bad(outfd, mtdofs)) {
+			if (!quiet)
+				fprintf(stderr, "\nSkipping bad block at 0x%08x   ", mtdofs);
+
+			if (run && write(outfd, stage + (i - run) * erasesize, run * erasesize) != run * erasesize)
+				goto write_error;
+			run = 0;
+
+			mtdofs += erasesize;
+
+			/* Move the file pointer along over the bad block. */
+			lseek(outfd, erasesize, SEEK_CUR);
+			continue;
+		}
+
+		if (mtd_erase_block(outfd, mtdofs) < 0) {
+			fprintf(stderr, "Failed to erase block\n");
+			exit(1);
+		}
+
+		mtdofs += erasesize;
+		run++;
+		i++;
+	}
+
+	if (run && write(outfd, stage + (i - run) * erasesize, run * erasesize) != run * erasesize)
+		goto write_error;
+
+	staged = 0;
+	buf = stage;
+	return;
+
+write_error:
+	fprintf(stderr, "Error writing jffs2 data.\n");
+	exit(1);
+}
+
 static void pad(int size)
 {
 	if ((ofs % size == 0) && (ofs < erasesize))
@@ -59,19 +115,26 @@ static void pad(int size)
 	}
 	ofs = ofs % erasesize;
 	if (ofs == 0) {
-		while (mtd_block_is_bad(outfd, mtdofs) && (mtdofs < mtdsize)) {
-			if (!quiet)
-				fprintf(stderr, "\nSkipping bad block at 0x%08x   ", mtdofs);
+		/* this block is complete, continue in the next staged one */
+		if (++staged == STAGE_BLOCKS)
+			flush_blocks();
+		buf = stage + staged * erasesize;
+	}
+}
 
-			mtdofs += erasesize;
+static int alloc_stage(void)
+{
+	stage = malloc(STAGE_BLOCKS * erasesize);
+	buf = stage;
+	staged = 0;
 
-			/* Move the file pointer along over the bad block. */
-			lseek(outfd, erasesize, SEEK_CUR);
-		}
-		mtd_erase_block(outfd, mtdofs);
-		write(outfd, buf, erasesize);
-		mtdofs += erasesize;
-	}
+	return stage ? 0 : -1;
+}
+
+static void free_stage(void)
+{
+	free(stage);
+	stage = buf = NULL;
 }
 
 static inline int rbytes(void)
@@ -236,22 +299,35 @@ static void add_file(const char *name, int parent)
 	close(fd);
 }
 
-int mtd_replace_jffs2(const char *mtd, int fd, int ofs, const char *filename)
+static void add_files(const char * const *files, int nfiles, int parent)
 {
-	outfd = fd;
-	mtdofs = ofs;
+	int i;
 
-	buf = malloc(erasesize);
-	target_ino = 1;
-	if (!last_ino)
-		last_ino = 1;
-	add_file(filename, target_ino);
+	for (i = 0; i < nfiles; i++)
+		add_file(files[i], parent);
 	pad(erasesize);
 
 	/* add eof marker, pad to eraseblock size and write the data */
 	add_data(JFFS2_EOF, sizeof(JFFS2_EOF) - 1);
 	pad(erasesize);
-	free(buf);
+	flush_blocks();
+}
+
+int mtd_replace_jffs2(const char *mtd, int fd, int ofs, const char * const *files, int nfiles)
+{
+	outfd = fd;
+	mtdofs = ofs;
+
+	if (alloc_stage()) {
+		fprintf(stderr, "Out of memory!\n");
+		exit(1);
+	}
+
+	target_ino = 1;
+	if (!last_ino)
+		last_ino = 1;
+	add_files(files, nfiles, target_ino);
+	free_stage();
 
 	return (mtdofs - ofs);
 }
@@ -283,19 +359,19 @@ void mtd_parse_jffs2data(const char *buf, const char *dir)
 	}
 }
 
-int mtd_write_jffs2(const char *mtd, const char *filename, const char *dir)
+int mtd_write_jffs2(const char *mtd, const char * const *files, int nfiles, const char *dir)
 {
-	int err = -1, fdeof = 0;
+	int err = -1, fdeof = 0, i;
 
 	outfd = mtd_check_open(mtd);
 	if (outfd < 0)
 		return -1;
 
 	if (quiet < 2)
-		fprintf(stderr, "Appending %s to jffs2 partition %s\n", filename, mtd);
-	
-	buf = malloc(erasesize);
-	if (!buf) {
+		for (i = 0; i < nfiles; i++)
+			fprintf(stderr, "Appending %s to jffs2 partition %s\n", files[i], mtd);
+
+	if (alloc_stage()) {
 		fprintf(stderr, "Out of memory!\n");
 		goto done;
 	}
@@ -344,12 +420,7 @@ int mtd_write_jffs2(const char *mtd, const char *filename, const char *dir)
 	if (!target_ino)
 		target_ino = add_dir(dir, 1);
 
-	add_file(filename, target_ino);
-	pad(erasesize);
-
-	/* add eof marker, pad to eraseblock size and write the data */
-	add_data(JFFS2_EOF, sizeof(JFFS2_EOF) - 1);
-	pad(erasesize);
+	add_files(files, nfiles, target_ino);
 
 	err = 0;
 
@@ -359,8 +430,7 @@ int mtd_write_jffs2(const char *mtd, const char *filename, const char *dir)
 
 done:
 	close(outfd);
-	if (buf)
-		free(buf);
+	free_stage();
 
 	return err;
 }
@@ -84,7 +84,8 @@ enum mtd_image_format {
 static char *buf = NULL;
 static char *imagefile = NULL;
 static enum mtd_image_format imageformat = MTD_IMAGE_FORMAT_UNKNOWN;
-static char *jffs2file = NULL, *jffs2dir = JFFS2_DEFAULT_DIR;
+static const char *jffs2files[MAX_ARGS], *jffs2dir = JFFS2_DEFAULT_DIR;
+static int jffs2nfiles = 0;
 static char *tpl_uboot_args_part;
 static int buflen = 0;
 int quiet;
@@ -469,7 +470,7 @@ mtd_write(int imagefd, const char *mtd, char *fis_layout, size_t part_offset)
 {
 	char *next = NULL;
 	char *str = NULL;
-	int fd, result;
+	int fd, result, i;
 	ssize_t r, w, e;
 	ssize_t skip = 0;
 	uint32_t offset = 0;
@@ -606,18 +607,19 @@ resume:
 			continue;
 		}
 
-		if (jffs2file && w >= jffs2_skip_bytes) {
+		if (jffs2nfiles && w >= jffs2_skip_bytes) {
 			if (memcmp(buf, JFFS2_EOF, sizeof(JFFS2_EOF) - 1) == 0) {
 				if (!quiet)
 					fprintf(stderr, "\b\b\b   ");
 				if (quiet < 2)
-					fprintf(stderr, "\nAppending jffs2 data from %s to %s..\n.", jffs2file, mtd);
+					for (i = 0; i < jffs2nfiles; i++)
+						fprintf(stderr, "\nAppending jffs2 data from %s to %s..\n.", jffs2files[i], mtd);
 				/* got an EOF marker - this is the place to add some jffs2 data */
-				skip = mtd_replace_jffs2(mtd, fd, e, jffs2file);
+				skip = mtd_replace_jffs2(mtd, fd, e, jffs2files, jffs2nfiles);
 				jffs2_replaced = 1;
 
 				/* don't add it again */
-				jffs2file = NULL;
+				jffs2nfiles = 0;
 
 				w += skip;
 				e += skip;
@@ -753,7 +755,7 @@ static void usage(void)
 	"        erase                   erase all data on device\n"
 	"        verify <imagefile>|-    verify <imagefile> (use - for stdin) to device\n"
 	"        write <imagefile>|-     write <imagefile> (use - for stdin) to device\n"
-	"        jffs2write <file>       append <file> to the jffs2 partition on the device\n");
+	"        jffs2write <file>...    append <file>s to the jffs2 partition on the device\n");
 	if (mtd_resetbc) {
 	    fprintf(stderr,
 	"        resetbc <device>        reset the uboot boot counter\n");
@@ -784,6 +786,7 @@ static void usage(void)
 	"        -e <device>             erase <device> before executing the command\n"
 	"        -d <name>               directory for jffs2write, defaults to \"tmp\"\n"
 	"        -j <name>               integrate <file> into jffs2 data when writing an image\n"
+	"                                (can be given more than once)\n"
 	"        -s <number>             skip the first n bytes when appending data to the jffs2 partiton, defaults to \"0\"\n"
 	"        -p <number>             write beginning at partition offset\n"
 	"        -l <length>             the length of data that we want to dump\n");
@@ -827,7 +830,7 @@ static void do_reboot(void)
 
 int main (int argc, char **argv)
 {
-	int ch, i, boot, imagefd = 0, force, unlocked;
+	int ch, i, boot, imagefd = 0, force, unlocked, nfiles = 0;
 	char *erase[MAX_ARGS], *device = NULL;
 	char *fis_layout = NULL;
 	size_t offset = 0, data_size = 0, part_offset = 0, dump_len = 0;
@@ -868,7 +871,11 @@ int main (int argc, char **argv)
 				no_erase = 1;
 				break;
 			case 'j':
-				jffs2file = optarg;
+				if (jffs2nfiles >= MAX_ARGS) {
+					fprintf(stderr, "-j: too many files\n");
+					usage();
+				}
+				jffs2files[jffs2nfiles++] = optarg;
 				break;
 			case 's':
 				errno = 0;
@@ -994,11 +1001,12 @@ int main (int argc, char **argv)
 			fprintf(stderr, "Image check failed.\n");
 			exit(1);
 		}
-	} else if ((strcmp(argv[0], "jffs2write") == 0) && (argc == 3)) {
+	} else if ((strcmp(argv[0], "jffs2write") == 0) && (argc >= 3)) {
 		cmd = CMD_JFFS2WRITE;
-		device = argv[2];
+		device = argv[argc - 1];
 
 		imagefile = argv[1];
+		nfiles = argc - 2;
 		if (!mtd_check(device)) {
 			fprintf(stderr, "Can't open device for writing!\n");
 			exit(1);
@@ -1043,7 +1051,7 @@ int main (int argc, char **argv)
 		case CMD_JFFS2WRITE:
 			if (!unlocked)
 				mtd_unlock(device);
-			mtd_write_jffs2(device, imagefile, jffs2dir);
+			mtd_write_jffs2(device, (const char * const *) &argv[1], nfiles, jffs2dir);
 			break;
 		case CMD_FIXTRX:
 			if (mtd_fixtrx) {
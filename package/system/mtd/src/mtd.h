@@ -18,8 +18,8 @@ extern int mtd_check_open(const char *mtd);
 extern int mtd_block_is_bad(int fd, int offset);
 extern int mtd_erase_block(int fd, int offset);
 extern int mtd_write_buffer(int fd, const char *buf, int offset, int length);
-extern int mtd_write_jffs2(const char *mtd, const char *filename, const char *dir);
-extern int mtd_replace_jffs2(const char *mtd, int fd, int ofs, const char *filename);
+extern int mtd_write_jffs2(const char *mtd, const char * const *files, int nfiles, const char *dir);
+extern int mtd_replace_jffs2(const char *mtd, int fd, int ofs, const char * const *files, int nfiles);
 extern void mtd_parse_jffs2data(const char *buf, const char *dir);
 
 /* target specific functions */
@@ -110,6 +110,24 @@ struct tffs_key_name_table {
 	struct tffs_name_table_entry *entries;
 };
 
+/* location of one segment of the latest revision of an entry */
+struct tffs_index_entry {
+	uint32_t id;
+	uint32_t rev;
+	uint32_t seg;
+	uint32_t next_seg;
+	uint32_t len;
+	off_t pos;
+};
+
+/* all live segments, sorted by id and segment number */
+struct tffs_index {
+	uint32_t size;
+	struct tffs_index_entry *entries;
+};
+
+static struct tffs_index tffs_index;
+
 static inline uint8_t read_uint8(void *buf, ptrdiff_t off)
 {
 	return *(uint8_t *)(buf + off);
@@ -168,11 +186,31 @@ static void print_entry_value(const struct tffs_entry *entry)
 	fwrite(entry->val, 1, entry->len, stdout);
 }
 
-static int find_entry(uint32_t id, struct tffs_entry *entry)
+static int index_entry_cmp(const void *a, const void *b)
+{
+	const struct tffs_index_entry *ea = a, *eb = b;
+
+	if (ea->id != eb->id)
+		return ea->id < eb->id ? -1 : 1;
+	/* newest revision first */
+	if (ea->rev != eb->rev)
+		return ea->rev > eb->rev ? -1 : 1;
+	if (ea->seg != eb->seg)
+		return ea->seg < eb->seg ? -1 : 1;
+	/* a segment written again later replaces the earlier copy */
+	if (ea->pos != eb->pos)
+		return ea->pos > eb->pos ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Walk all good sectors once and record where the segments of every entry
+ * are, keeping only the latest revision of each entry.
+ */
+static void build_index(void)
 {
-	uint32_t rev = 0;
-	uint32_t num_segments = 0;
-	struct tffs_entry_segment *segments = NULL;
+	struct tffs_index_entry *entries = NULL;
+	uint32_t num_entries = 0, alloc_entries = 0;
 
 	off_t pos = 0;
 	uint8_t block_end = 0;
@@ -182,19 +220,21 @@ static int find_entry(uint32_t id, struct tffs_entry *entry)
 				block_end = 0;
 			}
 		} else if (sector_get_good(sector)) {
-			if (read_sectoroob(pos) || read_sector(pos)) {
+			if ((read_oob_sector_health && read_sectoroob(pos)) || read_sector(pos)) {
 				fprintf(stderr, "ERROR: sector isn't readable, but has been previously!\n");
 				exit(EXIT_FAILURE);
 			}
-			uint32_t oob_id = read_uint32(oobbuf, 0x02);
-			uint32_t oob_len = read_uint32(oobbuf, 0x06);
-			uint32_t oob_rev = read_uint32(oobbuf, 0x0a);
 			uint32_t read_id = read_uint32(readbuf, 0x00);
 			uint32_t read_len = read_uint32(readbuf, 0x04);
 			uint32_t read_rev = read_uint32(readbuf, 0x0c);
-			if (read_oob_sector_health && (oob_id != read_id || oob_len != read_len || oob_rev != read_rev)) {
-				fprintf(stderr, "Warning: sector has inconsistent metadata\n");
-				continue;
+			if (read_oob_sector_health) {
+				uint32_t oob_id = read_uint32(oobbuf, 0x02);
+				uint32_t oob_len = read_uint32(oobbuf, 0x06);
+				uint32_t oob_rev = read_uint32(oobbuf, 0x0a);
+				if (oob_id != read_id || oob_len != read_len || oob_rev != read_rev) {
+					fprintf(stderr, "Warning: sector has inconsistent metadata\n");
+					continue;
+				}
 			}
 			if (read_id == TFFS_ID_END) {
 				/* no more entries in this block */
@@ -205,66 +245,114 @@ static int find_entry(uint32_t id, struct tffs_entry *entry)
 				fprintf(stderr, "Warning: segment is longer than possible\n");
 				continue;
 			}
-			if (read_id == id) {
-				if (read_rev < rev) {
-					/* obsolete revision => ignore this */
-					continue;
-				}
-				if (read_rev > rev) {
-					/* newer revision => clear old data */
-					for (uint32_t i = 0; i < num_segments; i++) {
-						free(segments[i].val);
-					}
-					free (segments);
-					rev = read_rev;
-					num_segments = 0;
-					segments = NULL;
+
+			if (num_entries == alloc_entries) {
+				alloc_entries = alloc_entries ? alloc_entries * 2 : 64;
+				entries = realloc(entries, alloc_entries * sizeof(*entries));
+				if (entries == NULL) {
+					fprintf(stderr, "ERROR: memory allocation failed!\n");
+					exit(EXIT_FAILURE);
 				}
+			}
 
-				uint32_t seg = read_uint32(readbuf, 0x10);
+			entries[num_entries++] = (struct tffs_index_entry) {
+				.id = read_id,
+				.rev = read_rev,
+				.seg = read_uint32(readbuf, 0x10),
+				.next_seg = read_uint32(readbuf, 0x14),
+				.len = read_len,
+				.pos = pos,
+			};
+		}
+	}
 
-				if (seg == TFFS_SEGMENT_CLEARED) {
-					continue;
-				}
+	if (num_entries)
+		qsort(entries, num_entries, sizeof(*entries), index_entry_cmp);
 
-				uint32_t next_seg = read_uint32(readbuf, 0x14);
+	/*
+	 * Keep the segments of the newest revision of each id. A cleared
+	 * segment still obsoletes older revisions, but has no data itself.
+	 */
+	uint32_t n = 0, id = 0, rev = 0, seg = 0;
+	for (uint32_t i = 0; i < num_entries; i++) {
+		struct tffs_index_entry e = entries[i];
 
-				uint32_t new_num_segs = next_seg == 0 ? seg + 1 : next_seg + 1;
-				if (new_num_segs > num_segments) {
-					segments = realloc(segments, new_num_segs * sizeof(struct tffs_entry_segment));
-					memset(segments + (num_segments * sizeof(struct tffs_entry_segment)), 0x0,
-							(new_num_segs - num_segments) * sizeof(struct tffs_entry_segment));
-					num_segments = new_num_segs;
-				}
-				segments[seg].len = read_len;
-				segments[seg].val = malloc(read_len);
-				memcpy(segments[seg].val, readbuf + TFFS_ENTRY_HEADER_SIZE, read_len);
-			}
+		if (i > 0 && e.id == id && (e.rev != rev || e.seg == seg)) {
+			/* older revision or older copy of the same segment */
+			continue;
+		}
+
+		if (i == 0 || e.id != id) {
+			id = e.id;
+			rev = e.rev;
 		}
+		seg = e.seg;
+
+		if (e.seg == TFFS_SEGMENT_CLEARED)
+			continue;
+
+		entries[n++] = e;
+	}
+
+	tffs_index.size = n;
+	tffs_index.entries = entries;
+}
+
+static int find_entry(uint32_t id, struct tffs_entry *entry)
+{
+	struct tffs_index_entry *entries = tffs_index.entries;
+	uint32_t lo = 0, hi = tffs_index.size;
+
+	/* first index entry for this id */
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		if (entries[mid].id < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	uint32_t first = lo, num_found = 0, num_segments = 0;
+	for (uint32_t i = first; i < tffs_index.size && entries[i].id == id; i++) {
+		uint32_t segs = entries[i].next_seg == 0 ? entries[i].seg + 1 : entries[i].next_seg + 1;
+
+		if (segs > num_segments)
+			num_segments = segs;
+		num_found++;
 	}
 
 	if (num_segments == 0) {
 		return 0;
 	}
 
-	assert (segments != NULL);
-
+	/* segments are sorted and unique, so all of them are there if these match */
 	uint32_t len = 0;
 	for (uint32_t i = 0; i < num_segments; i++) {
-		if (segments[i].val == NULL) {
+		if (i >= num_found || entries[first + i].seg != i) {
 			/* missing segment */
 			return 0;
 		}
 
-		len += segments[i].len;
+		len += entries[first + i].len;
 	}
 
 	void *p = malloc(len);
+	if (p == NULL) {
+		fprintf(stderr, "ERROR: memory allocation failed!\n");
+		exit(EXIT_FAILURE);
+	}
 	entry->val = p;
 	entry->len = len;
 	for (uint32_t i = 0; i < num_segments; i++) {
-		memcpy(p, segments[i].val, segments[i].len);
-		p += segments[i].len;
+		struct tffs_index_entry *e = &entries[first + i];
+
+		if (read_sector(e->pos)) {
+			fprintf(stderr, "ERROR: sector isn't readable, but has been previously!\n");
+			exit(EXIT_FAILURE);
+		}
+		memcpy(p, readbuf + TFFS_ENTRY_HEADER_SIZE, e->len);
+		p += e->len;
 	}
 
 	return 1;
@@ -538,6 +626,8 @@ int main(int argc, char *argv[])
 		goto out_close;
 	}
 
+	build_index();
+
 	if (!find_entry(TFFS_ID_TABLE_NAME, &name_table)) {
 		fprintf(stderr, "ERROR: No name table found on tffs device %s\n",
 			mtddev);
@@ -564,6 +654,7 @@ int main(int argc, char *argv[])
 out_free_entry:
 	free(name_table.val);
 out_free_sectors:
+	free(tffs_index.entries);
 	free(sectors);
 out_close:
 	close(mtdfd);
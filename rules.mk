@@ -334,7 +334,7 @@ else
     STRIP="$(STRIP)" \
     STRIP_KMOD="$(SCRIPT_DIR)/strip-kmod.sh" \
     PATCHELF="$(STAGING_DIR_HOST)/bin/patchelf" \
-    $(SCRIPT_DIR)/rstrip.sh
+    $(firstword $(wildcard $(STAGING_DIR_HOST)/bin/rstrip) $(SCRIPT_DIR)/rstrip.sh)
 endif
 
 ifeq ($(CONFIG_IPV6),y)
@@ -349,6 +349,13 @@ ifeq ($(CONFIG_BUILD_LOG),y)
   BUILD_LOG:=1
 endif
 
+# Step trace written by scripts/time.pl, see scripts/build-trace.pl
+ifneq ($(BUILD_TRACE),)
+  override BUILD_TRACE:=$(abspath $(BUILD_TRACE))
+else ifneq ($(BUILD_LOG),)
+  BUILD_TRACE:=$(BUILD_LOG_DIR)/trace.jsonl
+endif
+
 export BISON_PKGDATADIR:=$(STAGING_DIR_HOST)/share/bison
 export M4:=$(STAGING_DIR_HOST)/bin/m4
 
@@ -0,0 +1,200 @@
+#!/usr/bin/env perl
+#
+# Copyright (C) 2020 OpenWrt.org
+#
+# This is free software, licensed under the GNU General Public License v2.
+# See /LICENSE for more information.
+#
+# Converts and summarizes the step trace written by scripts/time.pl when
+# BUILD_TRACE is set (one JSON record per line, from the last build).
+#
+
+use strict;
+use warnings;
+use JSON::PP;
+
+my @steps;
+
+sub load_trace($) {
+	my $file = shift;
+	my $json = JSON::PP->new;
+
+	open TRACE, "<", $file or die "Cannot open '$file': $!\n";
+	while (<TRACE>) {
+		/^\s*\{/ or next;
+		my $rec = eval { $json->decode($_) } or next;
+		defined($rec->{start}) and defined($rec->{end}) or next;
+		$rec->{deps} ||= [];
+		push @steps, $rec;
+	}
+	close TRACE;
+
+	@steps or die "No steps found in '$file'\n";
+	@steps = sort { $a->{start} <=> $b->{start} } @steps;
+}
+
+sub seconds($) {
+	return sprintf "%.2f", $_[0] / 1000000;
+}
+
+sub gen_chrome() {
+	my $t0 = $steps[0]{start};
+	my %slots;
+	my @events;
+
+	foreach my $step (@steps) {
+		my $tid = defined($step->{slot}) ? $step->{slot} + 1 : 0;
+		my $cat = $step->{name};
+		$cat =~ s/^.*\///;
+
+		$slots{$tid} = 1;
+		push @events, {
+			name => $step->{name},
+			cat => $cat,
+			ph => "X",
+			pid => 1,
+			tid => $tid,
+			ts => $step->{start} - $t0,
+			dur => $step->{end} - $step->{start},
+			args => {
+				target => $step->{target},
+				user => $step->{user},
+				sys => $step->{sys},
+				maxrss_kb => $step->{maxrss},
+				exit => $step->{exit},
+			},
+		};
+	}
+
+	foreach my $tid (sort { $a <=> $b } keys %slots) {
+		push @events, {
+			name => "thread_name",
+			ph => "M",
+			pid => 1,
+			tid => $tid,
+			args => { name => $tid ? "slot ".($tid - 1) : "unknown slot" },
+		};
+	}
+
+	print JSON::PP->new->canonical->encode({
+		traceEvents => \@events,
+		displayTimeUnit => "ms",
+	}), "\n";
+}
+
+# The step that held up $step: its dependency that finished last or, if no
+# dependency was traced (e.g. across tools/toolchain/target/package), the
+# step that finished last before it was started.
+sub blocking_step($$) {
+	my $step = shift;
+	my $targets = shift;
+	my $pred;
+
+	foreach my $dep (@{$step->{deps}}) {
+		my $rec = $targets->{$dep} or next;
+		$rec->{end} <= $step->{start} or next;
+		$pred = $rec if !$pred or $rec->{end} > $pred->{end};
+	}
+	$pred and return ($pred, "dep");
+
+	foreach my $rec (@steps) {
+		$rec->{end} <= $step->{start} or next;
+		$pred = $rec if !$pred or $rec->{end} > $pred->{end};
+	}
+	return ($pred, "seq");
+}
+
+sub gen_summary() {
+	my $t0 = $steps[0]{start};
+	my $t1 = 0;
+	my ($busy, $cpu) = (0, 0);
+	my $nslots = 0;
+	my %targets;
+	my @events;
+	my %level;
+
+	foreach my $step (@steps) {
+		my $rec = $targets{$step->{target}};
+		$targets{$step->{target}} = $step if !$rec or $step->{end} > $rec->{end};
+		$t1 = $step->{end} if $step->{end} > $t1;
+		$busy += $step->{end} - $step->{start};
+		$cpu += ($step->{user} || 0) + ($step->{sys} || 0);
+		defined($step->{slot}) and $step->{slot} >= $nslots and $nslots = $step->{slot} + 1;
+		push @events, [ $step->{start}, 1 ], [ $step->{end}, -1 ];
+	}
+
+	my $wall = $t1 - $t0;
+	printf "Steps:              %d\n", scalar(@steps);
+	printf "Wall time:          %s s\n", seconds($wall);
+	printf "Step time:          %s s\n", seconds($busy);
+	printf "CPU time:           %.2f s\n", $cpu;
+	printf "Job slots used:     %d\n", $nslots;
+	printf "Avg. parallelism:   %.2f\n", $wall ? $busy / $wall : 0;
+
+	# time spent with n steps running at the same time
+	my ($running, $last) = (0, $t0);
+	foreach my $ev (sort { $a->[0] <=> $b->[0] or $a->[1] <=> $b->[1] } @events) {
+		$level{$running} += $ev->[0] - $last;
+		$running += $ev->[1];
+		$last = $ev->[0];
+	}
+	print "\nConcurrency:\n";
+	foreach my $n (sort { $a <=> $b } keys %level) {
+		$level{$n} or next;
+		printf "  %3d running: %10s s  %5.1f%%\n", $n, seconds($level{$n}),
+			$wall ? 100 * $level{$n} / $wall : 0;
+	}
+
+	print "\nLongest steps:\n";
+	my @longest = sort { ($b->{end} - $b->{start}) <=> ($a->{end} - $a->{start}) } @steps;
+	foreach my $step (@longest[0 .. ($#longest < 9 ? $#longest : 9)]) {
+		printf "  %10s s  cpu %8.2f s  rss %8s kB  %s\n",
+			seconds($step->{end} - $step->{start}),
+			($step->{user} || 0) + ($step->{sys} || 0),
+			defined($step->{maxrss}) ? $step->{maxrss} : "-",
+			$step->{name};
+	}
+
+	my @path;
+	my $step = (sort { $b->{end} <=> $a->{end} } @steps)[0];
+	while ($step) {
+		my ($pred, $next) = blocking_step($step, \%targets);
+		unshift @path, [ $step, $pred ? $step->{start} - $pred->{end} : $step->{start} - $t0, $next ];
+		$step = $pred;
+	}
+
+	my $path_busy = 0;
+	$path_busy += $_->[0]{end} - $_->[0]{start} foreach @path;
+	printf "\nCritical path (%s s in steps, %s s waiting):\n",
+		seconds($path_busy), seconds($wall - $path_busy);
+	foreach my $entry (@path) {
+		my ($step, $wait, $kind) = @$entry;
+		printf "  +%9s s  %10s s  wait %8s s  %s%s\n",
+			seconds($step->{start} - $t0),
+			seconds($step->{end} - $step->{start}),
+			seconds($wait), $step->{name},
+			$kind eq "seq" && $step != $path[0][0] ? " (no traced dependency)" : "";
+	}
+}
+
+my %commands = (
+	'chrome' => \&gen_chrome,
+	'summary' => \&gen_summary,
+);
+
+my $cmd = shift @ARGV;
+my $file = shift @ARGV;
+
+if (!$cmd or !$file or !$commands{$cmd}) {
+	print STDERR <<EOF
+Available commands:
+	$0 chrome <trace>	Convert the trace to Chrome trace / Perfetto JSON
+	$0 summary <trace>	Print utilization, longest steps and critical path
+
+EOF
+	;
+	exit 1;
+}
+
+load_trace($file);
+$commands{$cmd}->();
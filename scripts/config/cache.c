@@ -0,0 +1,817 @@
+/*
+ * Copyright (C) 2020 OpenWrt.org
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * Binary cache of the parsed configuration tree.
+ *
+ * After a successful parse, the menu/symbol/property/expr graph is written
+ * to $KCONFIG_CACHE. Pointers are stored as offsets into the file plus a
+ * list of the slots holding them. The file also records what the parse
+ * depended on: size and hash of every file read, the matches of every
+ * source pattern, the values of 'option env' variables and the kernel
+ * release used for UNAME_RELEASE.
+ *
+ * When all of these are unchanged, conf_parse() maps the file privately
+ * and relocates it in place instead of reading the input again. Symbol
+ * values are not cached; all symbols are stored without SYMBOL_VALID and
+ * are recalculated on first use. Warnings printed during the parse are
+ * stored as well and printed again. A cache is only accepted by a parser
+ * built from the same sources as the one that wrote it.
+ */
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+
+#include "lkc.h"
+
+#define CACHE_MAGIC	"KCFGTREE"
+#define CACHE_VERSION	2
+
+/* pointers to objects outside of the cache are stored as these values */
+enum {
+	CACHE_EXT_NULL,
+	CACHE_EXT_YES,
+	CACHE_EXT_MOD,
+	CACHE_EXT_NO,
+	CACHE_EXT_EMPTY,
+	CACHE_EXT_ROOTMENU,
+	CACHE_EXT_MAX
+};
+
+static void *const cache_ext[CACHE_EXT_MAX] = {
+	[CACHE_EXT_YES] = &symbol_yes,
+	[CACHE_EXT_MOD] = &symbol_mod,
+	[CACHE_EXT_NO] = &symbol_no,
+	[CACHE_EXT_EMPTY] = &symbol_empty,
+	[CACHE_EXT_ROOTMENU] = &rootmenu,
+};
+
+enum cache_kind {
+	CACHE_STRING,
+	CACHE_FILE,
+	CACHE_SYMBOL,
+	CACHE_PROPERTY,
+	CACHE_EXPR,
+	CACHE_MENU,
+};
+
+static const size_t cache_kind_size[] = {
+	[CACHE_FILE] = sizeof(struct file),
+	[CACHE_SYMBOL] = sizeof(struct symbol),
+	[CACHE_PROPERTY] = sizeof(struct property),
+	[CACHE_EXPR] = sizeof(struct expr),
+	[CACHE_MENU] = sizeof(struct menu),
+};
+
+/* an input of the parse, all offsets point to strings */
+struct cache_dep {
+	uint64_t name;		/* file name, source pattern or variable */
+	uint64_t arg;		/* including file or variable value */
+	uint64_t size;		/* file size or number of matches */
+	uint64_t hash;		/* of the contents or matched names */
+};
+
+struct cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t layout[7];
+	char build[32];
+	uint64_t size;
+	uint64_t main;
+	uint64_t release;
+	uint64_t files, nfiles;
+	uint64_t globs, nglobs;
+	uint64_t envs, nenvs;
+	uint64_t relocs, nrelocs;	/* in units of pointers */
+	uint64_t messages;
+	int modules_val;
+
+	/* everything below is relocated */
+	struct menu rootmenu;
+	struct file *file_list;
+	struct symbol *modules_sym;
+	struct symbol *sym_defconfig_list;
+	struct expr *sym_env_list;
+	struct symbol *symbol_hash[SYMBOL_HASHSIZE];
+};
+
+struct cache_glob {
+	char *pattern;
+	char *curname;
+	size_t count;
+	uint64_t hash;
+};
+
+static struct cache_glob *cache_globs;
+static size_t cache_nglobs;
+static time_t cache_start;
+
+/* diagnostics printed while parsing */
+static char *cache_msgs;
+static size_t cache_msgs_len;
+
+/* output buffer, relocations and the pointer -> offset map while saving */
+static char *cbuf;
+static size_t clen, csize;
+static uint32_t *crelocs;
+static size_t cnrelocs, crelocs_size;
+
+static struct cache_ent {
+	const void *ptr;
+	uint64_t off;
+} *cmap;
+static size_t cmap_size, cmap_cnt;
+
+static struct cache_work {
+	const void *ptr;
+	enum cache_kind kind;
+	uint64_t off;
+} *cwork;
+static size_t cnwork, cwork_size;
+
+static void cache_layout(uint32_t *layout)
+{
+	layout[0] = sizeof(void *);
+	layout[1] = sizeof(struct file);
+	layout[2] = sizeof(struct symbol);
+	layout[3] = sizeof(struct property);
+	layout[4] = sizeof(struct expr);
+	layout[5] = sizeof(struct menu);
+	layout[6] = sizeof(struct cache_header);
+}
+
+/* KCONFIG_CACHE_BUILD is a checksum of the parser sources, see Makefile */
+static const char *cache_build(void)
+{
+#ifdef KCONFIG_CACHE_BUILD
+	return KCONFIG_CACHE_BUILD;
+#else
+	return NULL;
+#endif
+}
+
+static uint64_t cache_hash(const void *data, size_t len, uint64_t h)
+{
+	const unsigned char *p = data;
+	uint64_t w;
+
+	for (; len >= 8; p += 8, len -= 8) {
+		memcpy(&w, p, 8);
+		h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+		h ^= h >> 29;
+	}
+	for (; len; p++, len--) {
+		h = (h ^ *p) * 0x100000001b3ULL;
+		h ^= h >> 29;
+	}
+	return h;
+}
+
+static uint64_t cache_hash_paths(char **paths, size_t count)
+{
+	uint64_t h = count;
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		h = cache_hash(paths[i], strlen(paths[i]) + 1, h);
+	return h;
+}
+
+static int cache_hash_file(const char *name, uint64_t *size, uint64_t *hash,
+			   time_t *mtime)
+{
+	struct stat st;
+	void *data;
+	FILE *f;
+
+	f = zconf_fopen(name);
+	if (!f)
+		return -1;
+
+	if (fstat(fileno(f), &st)) {
+		fclose(f);
+		return -1;
+	}
+
+	*size = st.st_size;
+	*hash = cache_hash(NULL, 0, st.st_size);
+	*mtime = st.st_mtime;
+	if (st.st_size > 0) {
+		data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+			    fileno(f), 0);
+		if (data == MAP_FAILED) {
+			fclose(f);
+			return -1;
+		}
+		*hash = cache_hash(data, st.st_size, *hash);
+		munmap(data, st.st_size);
+	}
+	fclose(f);
+	return 0;
+}
+
+void conf_cache_vprintf(const char *fmt, va_list ap)
+{
+	va_list aq;
+	int len;
+
+	va_copy(aq, ap);
+	len = vsnprintf(NULL, 0, fmt, aq);
+	va_end(aq);
+	if (len < 0)
+		return;
+
+	cache_msgs = xrealloc(cache_msgs, cache_msgs_len + len + 1);
+	vsnprintf(cache_msgs + cache_msgs_len, len + 1, fmt, ap);
+	fputs(cache_msgs + cache_msgs_len, stderr);
+	cache_msgs_len += len;
+}
+
+void conf_cache_printf(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	conf_cache_vprintf(fmt, ap);
+	va_end(ap);
+}
+
+void conf_cache_add_glob(const char *pattern, const char *curname,
+			 char **paths, size_t count)
+{
+	struct cache_glob *g;
+
+	cache_globs = xrealloc(cache_globs,
+			       (cache_nglobs + 1) * sizeof(*cache_globs));
+	g = &cache_globs[cache_nglobs++];
+	g->pattern = strdup(pattern);
+	g->curname = strdup(curname);
+	g->count = count;
+	g->hash = cache_hash_paths(paths, count);
+}
+
+static uint64_t cache_alloc(size_t size)
+{
+	uint64_t off = (clen + 7) & ~(size_t)7;
+
+	if (off + size > csize) {
+		csize = csize ? csize : 1 << 20;
+		while (off + size > csize)
+			csize *= 2;
+		cbuf = xrealloc(cbuf, csize);
+	}
+	memset(cbuf + clen, 0, off + size - clen);
+	clen = off + size;
+	return off;
+}
+
+static uint64_t cache_strdup(const char *s)
+{
+	size_t len = strlen(s) + 1;
+	uint64_t off = cache_alloc(len);
+
+	memcpy(cbuf + off, s, len);
+	return off;
+}
+
+static struct cache_ent *cache_map_find(const void *ptr)
+{
+	size_t mask = cmap_size - 1;
+	size_t i = ((uint64_t)(uintptr_t)ptr * 0x9e3779b97f4a7c15ULL) >> 32;
+
+	for (i &= mask; cmap[i].ptr && cmap[i].ptr != ptr; i = (i + 1) & mask)
+		;
+	return &cmap[i];
+}
+
+static void cache_map_add(const void *ptr, uint64_t off)
+{
+	struct cache_ent *old = cmap;
+	size_t i, old_size = cmap_size;
+	struct cache_ent *ent;
+
+	if (2 * (cmap_cnt + 1) > cmap_size) {
+		cmap_size = cmap_size ? 2 * cmap_size : 1 << 16;
+		cmap = xcalloc(cmap_size, sizeof(*cmap));
+		for (i = 0; i < old_size; i++)
+			if (old[i].ptr)
+				*cache_map_find(old[i].ptr) = old[i];
+		free(old);
+	}
+	ent = cache_map_find(ptr);
+	ent->ptr = ptr;
+	ent->off = off;
+	cmap_cnt++;
+}
+
+/* return the stored value of a pointer, queueing the object if needed */
+static uint64_t cache_ref(const void *ptr, enum cache_kind kind)
+{
+	struct cache_ent *ent;
+	uint64_t off;
+	int i;
+
+	if (!ptr)
+		return 0;
+
+	for (i = 1; i < CACHE_EXT_MAX; i++)
+		if (ptr == cache_ext[i])
+			return i;
+
+	if (cmap_size) {
+		ent = cache_map_find(ptr);
+		if (ent->ptr)
+			return ent->off;
+	}
+
+	if (kind == CACHE_STRING) {
+		off = cache_strdup(ptr);
+	} else {
+		off = cache_alloc(cache_kind_size[kind]);
+		if (cnwork == cwork_size) {
+			cwork_size = cwork_size ? 2 * cwork_size : 1024;
+			cwork = xrealloc(cwork, cwork_size * sizeof(*cwork));
+		}
+		cwork[cnwork].ptr = ptr;
+		cwork[cnwork].kind = kind;
+		cwork[cnwork].off = off;
+		cnwork++;
+	}
+	cache_map_add(ptr, off);
+	return off;
+}
+
+static void cache_put(uint64_t slot, uint64_t val)
+{
+	uintptr_t v = val;
+
+	memcpy(cbuf + slot, &v, sizeof(v));
+	if (!val)
+		return;
+
+	if (cnrelocs == crelocs_size) {
+		crelocs_size = crelocs_size ? 2 * crelocs_size : 1 << 16;
+		crelocs = xrealloc(crelocs, crelocs_size * sizeof(*crelocs));
+	}
+	crelocs[cnrelocs++] = slot / sizeof(void *);
+}
+
+#define cache_field(off, type, field, ptr, kind) \
+	cache_put((off) + offsetof(type, field), cache_ref(ptr, kind))
+
+static void cache_fill_file(uint64_t off, const struct file *file)
+{
+	struct file f;
+
+	memset(&f, 0, sizeof(f));
+	f.lineno = file->lineno;
+	memcpy(cbuf + off, &f, sizeof(f));
+
+	cache_field(off, struct file, next, file->next, CACHE_FILE);
+	cache_field(off, struct file, parent, file->parent, CACHE_FILE);
+	cache_field(off, struct file, name, file->name, CACHE_STRING);
+}
+
+static void cache_fill_symbol(uint64_t off, const struct symbol *sym)
+{
+	struct symbol s;
+
+	/* user values are only set after parsing, curr is recalculated */
+	memset(&s, 0, sizeof(s));
+	s.type = sym->type;
+	s.visible = sym->visible;
+	s.flags = sym->flags & ~SYMBOL_VALID;
+	s.dir_dep.tri = sym->dir_dep.tri;
+	s.rev_dep.tri = sym->rev_dep.tri;
+	memcpy(cbuf + off, &s, sizeof(s));
+
+	cache_field(off, struct symbol, next, sym->next, CACHE_SYMBOL);
+	cache_field(off, struct symbol, name, sym->name, CACHE_STRING);
+	cache_field(off, struct symbol, prop, sym->prop, CACHE_PROPERTY);
+	cache_field(off, struct symbol, dir_dep.expr, sym->dir_dep.expr, CACHE_EXPR);
+	cache_field(off, struct symbol, rev_dep.expr, sym->rev_dep.expr, CACHE_EXPR);
+}
+
+static void cache_fill_property(uint64_t off, const struct property *prop)
+{
+	struct property p;
+
+	memset(&p, 0, sizeof(p));
+	p.type = prop->type;
+	p.visible.tri = prop->visible.tri;
+	p.lineno = prop->lineno;
+	memcpy(cbuf + off, &p, sizeof(p));
+
+	cache_field(off, struct property, next, prop->next, CACHE_PROPERTY);
+	cache_field(off, struct property, sym, prop->sym, CACHE_SYMBOL);
+	cache_field(off, struct property, text, prop->text, CACHE_STRING);
+	cache_field(off, struct property, visible.expr, prop->visible.expr, CACHE_EXPR);
+	cache_field(off, struct property, expr, prop->expr, CACHE_EXPR);
+	cache_field(off, struct property, menu, prop->menu, CACHE_MENU);
+	cache_field(off, struct property, file, prop->file, CACHE_FILE);
+}
+
+static void cache_fill_expr(uint64_t off, const struct expr *e)
+{
+	struct expr x;
+
+	memset(&x, 0, sizeof(x));
+	x.type = e->type;
+	memcpy(cbuf + off, &x, sizeof(x));
+
+	switch (e->type) {
+	case E_SYMBOL:
+		cache_field(off, struct expr, left.sym, e->left.sym, CACHE_SYMBOL);
+		break;
+	case E_NOT:
+		cache_field(off, struct expr, left.expr, e->left.expr, CACHE_EXPR);
+		break;
+	case E_EQUAL:
+	case E_UNEQUAL:
+	case E_LTH:
+	case E_LEQ:
+	case E_GTH:
+	case E_GEQ:
+	case E_RANGE:
+		cache_field(off, struct expr, left.sym, e->left.sym, CACHE_SYMBOL);
+		cache_field(off, struct expr, right.sym, e->right.sym, CACHE_SYMBOL);
+		break;
+	case E_AND:
+	case E_OR:
+		cache_field(off, struct expr, left.expr, e->left.expr, CACHE_EXPR);
+		cache_field(off, struct expr, right.expr, e->right.expr, CACHE_EXPR);
+		break;
+	case E_LIST:
+		cache_field(off, struct expr, left.expr, e->left.expr, CACHE_EXPR);
+		cache_field(off, struct expr, right.sym, e->right.sym, CACHE_SYMBOL);
+		break;
+	case E_NONE:
+		break;
+	}
+}
+
+static void cache_fill_menu(uint64_t off, const struct menu *menu)
+{
+	struct menu m;
+
+	memset(&m, 0, sizeof(m));
+	m.flags = menu->flags;
+	m.lineno = menu->lineno;
+	memcpy(cbuf + off, &m, sizeof(m));
+
+	cache_field(off, struct menu, next, menu->next, CACHE_MENU);
+	cache_field(off, struct menu, parent, menu->parent, CACHE_MENU);
+	cache_field(off, struct menu, list, menu->list, CACHE_MENU);
+	cache_field(off, struct menu, sym, menu->sym, CACHE_SYMBOL);
+	cache_field(off, struct menu, prompt, menu->prompt, CACHE_PROPERTY);
+	cache_field(off, struct menu, visibility, menu->visibility, CACHE_EXPR);
+	cache_field(off, struct menu, dep, menu->dep, CACHE_EXPR);
+	cache_field(off, struct menu, help, menu->help, CACHE_STRING);
+	cache_field(off, struct menu, file, menu->file, CACHE_FILE);
+}
+
+static void cache_fill(const struct cache_work *w)
+{
+	switch (w->kind) {
+	case CACHE_FILE:
+		cache_fill_file(w->off, w->ptr);
+		break;
+	case CACHE_SYMBOL:
+		cache_fill_symbol(w->off, w->ptr);
+		break;
+	case CACHE_PROPERTY:
+		cache_fill_property(w->off, w->ptr);
+		break;
+	case CACHE_EXPR:
+		cache_fill_expr(w->off, w->ptr);
+		break;
+	case CACHE_MENU:
+		cache_fill_menu(w->off, w->ptr);
+		break;
+	case CACHE_STRING:
+		break;
+	}
+}
+
+static int cache_add_deps(void)
+{
+	struct cache_header *h;
+	struct cache_dep *dep;
+	struct file *file;
+	struct symbol *sym, *env_sym;
+	struct expr *e;
+	uint64_t off, name, arg;
+	uint64_t size, hash;
+	time_t mtime;
+	size_t i, n;
+
+	for (n = 0, file = file_list; file; file = file->next)
+		n++;
+	off = cache_alloc(n * sizeof(*dep));
+	h = (struct cache_header *)cbuf;
+	h->files = off;
+	h->nfiles = n;
+	for (i = 0, file = file_list; file; file = file->next, i++) {
+		/* files modified while parsing may have been read either way */
+		if (cache_hash_file(file->name, &size, &hash, &mtime) ||
+		    mtime >= cache_start)
+			return -1;
+		name = cache_strdup(file->name);
+		dep = (struct cache_dep *)(cbuf + off) + i;
+		dep->name = name;
+		dep->size = size;
+		dep->hash = hash;
+	}
+
+	off = cache_alloc(cache_nglobs * sizeof(*dep));
+	h = (struct cache_header *)cbuf;
+	h->globs = off;
+	h->nglobs = cache_nglobs;
+	for (i = 0; i < cache_nglobs; i++) {
+		name = cache_strdup(cache_globs[i].pattern);
+		arg = cache_strdup(cache_globs[i].curname);
+		dep = (struct cache_dep *)(cbuf + off) + i;
+		dep->name = name;
+		dep->arg = arg;
+		dep->size = cache_globs[i].count;
+		dep->hash = cache_globs[i].hash;
+	}
+
+	n = 0;
+	expr_list_for_each_sym(sym_env_list, e, sym)
+		n++;
+	off = cache_alloc(n * sizeof(*dep));
+	h = (struct cache_header *)cbuf;
+	h->envs = off;
+	h->nenvs = n;
+	i = 0;
+	expr_list_for_each_sym(sym_env_list, e, sym) {
+		const char *value;
+
+		env_sym = prop_get_symbol(sym_get_env_prop(sym));
+		value = getenv(env_sym->name);
+		name = cache_strdup(env_sym->name);
+		arg = value ? cache_strdup(value) : 0;
+		dep = (struct cache_dep *)(cbuf + off) + i++;
+		dep->name = name;
+		dep->arg = arg;
+	}
+
+	return 0;
+}
+
+static void cache_reset(void)
+{
+	free(cbuf);
+	free(crelocs);
+	free(cmap);
+	free(cwork);
+	cbuf = NULL;
+	crelocs = NULL;
+	cmap = NULL;
+	cwork = NULL;
+	clen = csize = 0;
+	cnrelocs = crelocs_size = 0;
+	cmap_size = cmap_cnt = 0;
+	cnwork = cwork_size = 0;
+}
+
+void conf_cache_save(const char *name)
+{
+	const char *path = getenv("KCONFIG_CACHE");
+	struct cache_header *h;
+	struct utsname uts;
+	char tmpname[PATH_MAX];
+	uint64_t off, val;
+	size_t i;
+	FILE *out;
+	int ok;
+
+	if (!path || !*path || !cache_build())
+		return;
+
+	cache_alloc(sizeof(*h));
+	cache_fill_menu(offsetof(struct cache_header, rootmenu), &rootmenu);
+	cache_put(offsetof(struct cache_header, file_list),
+		  cache_ref(file_list, CACHE_FILE));
+	cache_put(offsetof(struct cache_header, modules_sym),
+		  cache_ref(modules_sym, CACHE_SYMBOL));
+	cache_put(offsetof(struct cache_header, sym_defconfig_list),
+		  cache_ref(sym_defconfig_list, CACHE_SYMBOL));
+	cache_put(offsetof(struct cache_header, sym_env_list),
+		  cache_ref(sym_env_list, CACHE_EXPR));
+	for (i = 0; i < SYMBOL_HASHSIZE; i++) {
+		val = cache_ref(symbol_hash[i], CACHE_SYMBOL);
+		cache_put(offsetof(struct cache_header, symbol_hash) +
+			  i * sizeof(symbol_hash[i]), val);
+	}
+	for (i = 0; i < cnwork; i++)
+		cache_fill(&cwork[i]);
+
+	if (cache_add_deps())
+		goto out;
+
+	/* relocations are stored as 32-bit slot numbers */
+	if (clen / sizeof(void *) > UINT32_MAX)
+		goto out;
+
+	uname(&uts);
+	val = cache_strdup(uts.release);
+	off = cache_strdup(name);
+	h = (struct cache_header *)cbuf;
+	h->release = val;
+	h->main = off;
+	if (cache_msgs_len) {
+		off = cache_strdup(cache_msgs);
+		h = (struct cache_header *)cbuf;
+		h->messages = off;
+	}
+
+	off = cache_alloc(cnrelocs * sizeof(*crelocs));
+	memcpy(cbuf + off, crelocs, cnrelocs * sizeof(*crelocs));
+	h = (struct cache_header *)cbuf;
+	h->relocs = off;
+	h->nrelocs = cnrelocs;
+
+	/* terminates any string the loader looks at */
+	cache_alloc(1);
+	h = (struct cache_header *)cbuf;
+
+	memcpy(h->magic, CACHE_MAGIC, sizeof(h->magic));
+	h->version = CACHE_VERSION;
+	cache_layout(h->layout);
+	strncpy(h->build, cache_build(), sizeof(h->build) - 1);
+	h->size = clen;
+	h->modules_val = modules_val;
+
+	snprintf(tmpname, sizeof(tmpname), "%s.%d", path, (int)getpid());
+	out = fopen(tmpname, "w");
+	if (!out)
+		goto out;
+	ok = fwrite(cbuf, 1, clen, out) == clen;
+	if (fclose(out) || !ok || rename(tmpname, path))
+		unlink(tmpname);
+
+out:
+	cache_reset();
+}
+
+static bool cache_check_array(uint64_t off, uint64_t n, size_t elem_size,
+			      size_t size)
+{
+	return off % sizeof(uint64_t) == 0 && off <= size &&
+	       n <= (size - off) / elem_size;
+}
+
+static bool cache_check_deps(const char *base, uint64_t off, uint64_t n,
+			     size_t size)
+{
+	const struct cache_dep *dep = (const struct cache_dep *)(base + off);
+	uint64_t i;
+
+	if (!cache_check_array(off, n, sizeof(*dep), size))
+		return false;
+	for (i = 0; i < n; i++)
+		if (dep[i].name >= size || dep[i].arg >= size)
+			return false;
+	return true;
+}
+
+static bool cache_check(const char *base, const struct cache_header *h,
+			size_t size, const char *name)
+{
+	const struct cache_dep *dep;
+	const uint32_t *reloc;
+	struct utsname uts;
+	uintptr_t slot;
+	uint32_t layout[7];
+	uint64_t dsize, hash;
+	const char *value;
+	time_t mtime;
+	glob_t gl;
+	size_t i;
+	int err;
+
+	cache_layout(layout);
+	if (memcmp(h->magic, CACHE_MAGIC, sizeof(h->magic)) ||
+	    h->version != CACHE_VERSION ||
+	    memcmp(h->layout, layout, sizeof(layout)) ||
+	    strncmp(h->build, cache_build(), sizeof(h->build)) ||
+	    h->size != size || base[size - 1])
+		return false;
+
+	/* every offset must stay inside the file, strings end at the last byte */
+	if (!cache_check_deps(base, h->files, h->nfiles, size) ||
+	    !cache_check_deps(base, h->globs, h->nglobs, size) ||
+	    !cache_check_deps(base, h->envs, h->nenvs, size) ||
+	    !cache_check_array(h->relocs, h->nrelocs, sizeof(uint32_t), size) ||
+	    h->main >= size || h->release >= size || h->messages >= size)
+		return false;
+
+	reloc = (const uint32_t *)(base + h->relocs);
+	for (i = 0; i < h->nrelocs; i++) {
+		if (reloc[i] >= size / sizeof(void *))
+			return false;
+		memcpy(&slot, base + reloc[i] * sizeof(void *), sizeof(slot));
+		if (slot >= size)
+			return false;
+	}
+
+	uname(&uts);
+	if (strcmp(base + h->main, name) ||
+	    strcmp(base + h->release, uts.release))
+		return false;
+
+	dep = (const struct cache_dep *)(base + h->envs);
+	for (i = 0; i < h->nenvs; i++, dep++) {
+		value = getenv(base + dep->name);
+		if (!value != !dep->arg ||
+		    (value && strcmp(value, base + dep->arg)))
+			return false;
+	}
+
+	dep = (const struct cache_dep *)(base + h->globs);
+	for (i = 0; i < h->nglobs; i++, dep++) {
+		err = zconf_glob(base + dep->name, base + dep->arg, &gl);
+		if (err)
+			return false;
+		hash = cache_hash_paths(gl.gl_pathv, gl.gl_pathc);
+		dsize = gl.gl_pathc;
+		if (dsize)
+			globfree(&gl);
+		if (dsize != dep->size || hash != dep->hash)
+			return false;
+	}
+
+	dep = (const struct cache_dep *)(base + h->files);
+	for (i = 0; i < h->nfiles; i++, dep++) {
+		if (cache_hash_file(base + dep->name, &dsize, &hash, &mtime) ||
+		    dsize != dep->size || hash != dep->hash)
+			return false;
+	}
+
+	return true;
+}
+
+bool conf_cache_load(const char *name)
+{
+	const char *path = getenv("KCONFIG_CACHE");
+	const uint32_t *reloc;
+	struct cache_header *h;
+	struct stat st;
+	uintptr_t *slot;
+	char *base;
+	size_t i;
+	int fd;
+
+	cache_start = time(NULL);
+	if (!path || !*path || !cache_build())
+		return false;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	if (fstat(fd, &st) || (size_t)st.st_size <= sizeof(*h)) {
+		close(fd);
+		return false;
+	}
+	base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		    fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return false;
+
+	h = (struct cache_header *)base;
+	if (!cache_check(base, h, st.st_size, name)) {
+		munmap(base, st.st_size);
+		return false;
+	}
+
+	reloc = (const uint32_t *)(base + h->relocs);
+	for (i = 0; i < h->nrelocs; i++) {
+		slot = (uintptr_t *)base + reloc[i];
+		if (*slot < CACHE_EXT_MAX)
+			*slot = (uintptr_t)cache_ext[*slot];
+		else
+			*slot += (uintptr_t)base;
+	}
+
+	rootmenu = h->rootmenu;
+	file_list = h->file_list;
+	modules_sym = h->modules_sym;
+	modules_val = h->modules_val;
+	sym_defconfig_list = h->sym_defconfig_list;
+	sym_env_list = h->sym_env_list;
+	memcpy(symbol_hash, h->symbol_hash, sizeof(symbol_hash));
+
+	if (h->messages)
+		fputs(base + h->messages, stderr);
+
+	return true;
+}
@@ -85,6 +85,9 @@ struct symbol {
 	struct property *prop;
 	struct expr_value dir_dep;
 	struct expr_value rev_dep;
+	/* symbols whose value is calculated from this one */
+	struct symbol **rdeps;
+	int rdeps_cnt, rdeps_size;
 };
 
 #define for_all_symbols(i, sym) for (i = 0; i < SYMBOL_HASHSIZE; i++) for (sym = symbol_hash[i]; sym; sym = sym->next) if (sym->type != S_OTHER)
@@ -99,6 +102,7 @@ struct symbol {
 #define SYMBOL_CHANGED    0x0400  /* ? */
 #define SYMBOL_AUTO       0x1000  /* value from environment variable */
 #define SYMBOL_CHECKED    0x2000  /* used during dependency checking */
+#define SYMBOL_QUEUED     0x4000  /* queued for recalculation */
 #define SYMBOL_WARNED     0x8000  /* warning has been issued */
 
 /* Set when symbol.def[] is used */
@@ -6,6 +6,8 @@
 #ifndef LKC_H
 #define LKC_H
 
+#include <stdarg.h>
+
 #include "expr.h"
 
 #ifndef KBUILD_NO_NLS
@@ -85,6 +87,15 @@ void sym_add_change_count(int count);
 bool conf_set_all_new_symbols(enum conf_def_mode mode);
 void set_all_choice_values(struct symbol *csym);
 
+/* cache.c */
+bool conf_cache_load(const char *name);
+void conf_cache_save(const char *name);
+void conf_cache_add_glob(const char *pattern, const char *curname,
+			 char **paths, size_t count);
+void conf_cache_vprintf(const char *fmt, va_list ap);
+void conf_cache_printf(const char *fmt, ...)
+	__attribute__ ((format (printf, 1, 2)));
+
 /* confdata.c and expr.c */
 static inline void xfwrite(const void *str, size_t len, size_t count, FILE *out)
 {
@@ -116,6 +127,7 @@ struct file *file_lookup(const char *name);
 int file_write_dep(const char *name);
 void *xmalloc(size_t size);
 void *xcalloc(size_t nmemb, size_t size);
+void *xrealloc(void *p, size_t size);
 
 struct gstr {
 	size_t len;
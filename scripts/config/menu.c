@@ -22,9 +22,9 @@ void menu_warn(struct menu *menu, const char *fmt, ...)
 {
 	va_list ap;
 	va_start(ap, fmt);
-	fprintf(stderr, "%s:%d:warning: ", menu->file->name, menu->lineno);
-	vfprintf(stderr, fmt, ap);
-	fprintf(stderr, "\n");
+	conf_cache_printf("%s:%d:warning: ", menu->file->name, menu->lineno);
+	conf_cache_vprintf(fmt, ap);
+	conf_cache_printf("\n");
 	va_end(ap);
 }
 
@@ -32,9 +32,9 @@ static void prop_warn(struct property *prop, const char *fmt, ...)
 {
 	va_list ap;
 	va_start(ap, fmt);
-	fprintf(stderr, "%s:%d:warning: ", prop->file->name, prop->lineno);
-	vfprintf(stderr, fmt, ap);
-	fprintf(stderr, "\n");
+	conf_cache_printf("%s:%d:warning: ", prop->file->name, prop->lineno);
+	conf_cache_vprintf(fmt, ap);
+	conf_cache_printf("\n");
 	va_end(ap);
 }
 
@@ -476,6 +476,181 @@ void sym_clear_all_valid(void)
 	sym_calc_value(modules_sym);
 }
 
+/*
+ * Reverse dependencies: for every symbol, the list of symbols that read its
+ * value or visibility while being calculated. Built on first use, after
+ * parsing has finished. KCONFIG_FULL_RECALC=1 disables them and brings back
+ * the full recalculation on every change.
+ */
+static bool sym_rdeps_done, sym_rdeps_off;
+
+static void sym_add_rdep(struct symbol *dep, struct symbol *sym)
+{
+	if (!dep || dep == sym || dep->flags & SYMBOL_CONST)
+		return;
+	if (dep->rdeps_cnt && dep->rdeps[dep->rdeps_cnt - 1] == sym)
+		return;
+	if (dep->rdeps_cnt == dep->rdeps_size) {
+		dep->rdeps_size = dep->rdeps_size ? dep->rdeps_size * 2 : 4;
+		dep->rdeps = xrealloc(dep->rdeps,
+				      dep->rdeps_size * sizeof(*dep->rdeps));
+	}
+	dep->rdeps[dep->rdeps_cnt++] = sym;
+}
+
+static void expr_add_rdeps(struct expr *e, struct symbol *sym)
+{
+	if (!e)
+		return;
+	switch (e->type) {
+	case E_OR:
+	case E_AND:
+		expr_add_rdeps(e->left.expr, sym);
+		expr_add_rdeps(e->right.expr, sym);
+		break;
+	case E_NOT:
+		expr_add_rdeps(e->left.expr, sym);
+		break;
+	case E_EQUAL:
+	case E_GEQ:
+	case E_GTH:
+	case E_LEQ:
+	case E_LTH:
+	case E_UNEQUAL:
+	case E_RANGE:
+		sym_add_rdep(e->left.sym, sym);
+		sym_add_rdep(e->right.sym, sym);
+		break;
+	case E_SYMBOL:
+		sym_add_rdep(e->left.sym, sym);
+		break;
+	case E_LIST:
+		sym_add_rdep(e->right.sym, sym);
+		expr_add_rdeps(e->left.expr, sym);
+		break;
+	default:
+		break;
+	}
+}
+
+static void sym_build_rdeps(void)
+{
+	struct symbol *sym;
+	struct property *prop;
+	int i;
+
+	sym_rdeps_done = true;
+	sym_rdeps_off = !!getenv("KCONFIG_FULL_RECALC");
+	if (sym_rdeps_off)
+		return;
+
+	for_all_symbols(i, sym) {
+		expr_add_rdeps(sym->dir_dep.expr, sym);
+		expr_add_rdeps(sym->rev_dep.expr, sym);
+		for (prop = sym->prop; prop; prop = prop->next) {
+			/* a select only affects the selected symbol */
+			if (prop->type == P_SELECT)
+				continue;
+			expr_add_rdeps(prop->expr, sym);
+			expr_add_rdeps(prop->visible.expr, sym);
+		}
+	}
+}
+
+/*
+ * A choice is calculated together with all of its values and updates their
+ * flags as a side effect, which the per-symbol walk below does not model.
+ */
+static bool sym_is_choice_related(struct symbol *sym)
+{
+	return sym_is_choice(sym) || sym_is_choice_value(sym);
+}
+
+static bool sym_value_changed(struct symbol *sym, struct symbol_value *old,
+			      tristate old_visible)
+{
+	if (sym->visible != old_visible || sym->curr.tri != old->tri)
+		return true;
+	if (sym->curr.val == old->val)
+		return false;
+	switch (sym->type) {
+	case S_INT:
+	case S_HEX:
+	case S_STRING:
+		return !old->val || !sym->curr.val ||
+		       strcmp(old->val, sym->curr.val);
+	default:
+		return true;
+	}
+}
+
+/*
+ * Recalculate the symbols that depend on sym after its user value changed.
+ * Propagation stops at symbols whose value and visibility come out the
+ * same, so a change only costs as much as the part of the tree it affects.
+ * Once a choice or choice value is involved, everything is invalidated.
+ */
+static void sym_update_dependents(struct symbol *sym)
+{
+	static struct symbol **queue;
+	static int queue_size;
+	struct symbol_value oldval;
+	tristate oldvis;
+	struct symbol *s;
+	int i, n = 0;
+
+	if (!sym_rdeps_done)
+		sym_build_rdeps();
+
+	if (sym_rdeps_off || sym == modules_sym || sym_is_choice_related(sym)) {
+		sym_clear_all_valid();
+		return;
+	}
+
+	sym_add_change_count(1);
+	sym_calc_value(modules_sym);
+
+	if (!queue_size) {
+		queue_size = 64;
+		queue = xmalloc(queue_size * sizeof(*queue));
+	}
+	sym->flags |= SYMBOL_QUEUED;
+	queue[n++] = sym;
+
+	while (n) {
+		s = queue[--n];
+		s->flags &= ~SYMBOL_QUEUED;
+
+		oldval = s->curr;
+		oldvis = s->visible;
+		s->flags &= ~SYMBOL_VALID;
+		sym_calc_value(s);
+
+		if (!sym_value_changed(s, &oldval, oldvis))
+			continue;
+
+		for (i = 0; i < s->rdeps_cnt; i++) {
+			struct symbol *d = s->rdeps[i];
+
+			if (sym_is_choice_related(d)) {
+				while (n)
+					queue[--n]->flags &= ~SYMBOL_QUEUED;
+				sym_clear_all_valid();
+				return;
+			}
+			if (d->flags & SYMBOL_QUEUED)
+				continue;
+			if (n == queue_size) {
+				queue_size *= 2;
+				queue = xrealloc(queue,
+						 queue_size * sizeof(*queue));
+			}
+			d->flags |= SYMBOL_QUEUED;
+			queue[n++] = d;
+		}
+	}
+}
+
 bool sym_tristate_within_range(struct symbol *sym, tristate val)
 {
 	int type = sym_get_type(sym);
@@ -526,7 +701,7 @@ bool sym_set_tristate_value(struct symbol *sym, tristate val)
 
 	sym->def[S_DEF_USER].tri = val;
 	if (oldval != val)
-		sym_clear_all_valid();
+		sym_update_dependents(sym);
 
 	return true;
 }
@@ -683,7 +858,7 @@ bool sym_set_string_value(struct symbol *sym, const char *newval)
 
 	strcpy(val, newval);
 	free((void *)oldval);
-	sym_clear_all_valid();
+	sym_update_dependents(sym);
 
 	return true;
 }
@@ -1100,7 +1275,7 @@ static void sym_check_print_recursive(struct symbol *last_sym)
 		if (stack->sym == last_sym)
 			break;
 	if (!stack) {
-		fprintf(stderr, "unexpected recursive dependency error\n");
+		conf_cache_printf("unexpected recursive dependency error\n");
 		return;
 	}
 
@@ -1120,33 +1295,33 @@ static void sym_check_print_recursive(struct symbol *last_sym)
 			}
 		}
 		if (stack->sym == last_sym)
-			fprintf(stderr, "%s:%d:error: recursive dependency detected!\n",
+			conf_cache_printf("%s:%d:error: recursive dependency detected!\n",
 				prop->file->name, prop->lineno);
-			fprintf(stderr, "For a resolution refer to Documentation/kbuild/kconfig-language.txt\n");
-			fprintf(stderr, "subsection \"Kconfig recursive dependency limitations\"\n");
+			conf_cache_printf("For a resolution refer to Documentation/kbuild/kconfig-language.txt\n");
+			conf_cache_printf("subsection \"Kconfig recursive dependency limitations\"\n");
 		if (stack->expr) {
-			fprintf(stderr, "%s:%d:\tsymbol %s %s value contains %s\n",
+			conf_cache_printf("%s:%d:\tsymbol %s %s value contains %s\n",
 				prop->file->name, prop->lineno,
 				sym->name ? sym->name : "<choice>",
 				prop_get_type_name(prop->type),
 				next_sym->name ? next_sym->name : "<choice>");
 		} else if (stack->prop) {
-			fprintf(stderr, "%s:%d:\tsymbol %s depends on %s\n",
+			conf_cache_printf("%s:%d:\tsymbol %s depends on %s\n",
 				prop->file->name, prop->lineno,
 				sym->name ? sym->name : "<choice>",
 				next_sym->name ? next_sym->name : "<choice>");
 		} else if (sym_is_choice(sym)) {
-			fprintf(stderr, "%s:%d:\tchoice %s contains symbol %s\n",
+			conf_cache_printf("%s:%d:\tchoice %s contains symbol %s\n",
 				menu->file->name, menu->lineno,
 				sym->name ? sym->name : "<choice>",
 				next_sym->name ? next_sym->name : "<choice>");
 		} else if (sym_is_choice_value(sym)) {
-			fprintf(stderr, "%s:%d:\tsymbol %s is part of choice %s\n",
+			conf_cache_printf("%s:%d:\tsymbol %s is part of choice %s\n",
 				menu->file->name, menu->lineno,
 				sym->name ? sym->name : "<choice>",
 				next_sym->name ? next_sym->name : "<choice>");
 		} else {
-			fprintf(stderr, "%s:%d:\tsymbol %s is selected by %s\n",
+			conf_cache_printf("%s:%d:\tsymbol %s is selected by %s\n",
 				prop->file->name, prop->lineno,
 				sym->name ? sym->name : "<choice>",
 				next_sym->name ? next_sym->name : "<choice>");
@@ -0,0 +1,416 @@
+/*
+ * Copyright (C) 2020 OpenWrt.org
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * Checks the incremental recalculation done by sym_set_*_value() against
+ * a full one. For every seed a random Kconfig tree is generated and parsed,
+ * then random symbols are changed. After each change, the value, visibility
+ * and write flag of every symbol are compared with the ones calculated
+ * again from scratch after sym_clear_all_valid().
+ *
+ * usage: rdeps [<first seed> [<trees> [<changes per tree>]]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../lkc.h"
+
+#define NSYMS	40
+
+enum kind {
+	K_BOOL,
+	K_TRISTATE,
+	K_INT,
+	K_STRING,
+};
+
+static const char *const kind_name[] = {
+	[K_BOOL] = "bool",
+	[K_TRISTATE] = "tristate",
+	[K_INT] = "int",
+	[K_STRING] = "string",
+};
+
+static enum kind kinds[NSYMS];
+static int choice_len[NSYMS];	/* set on the first value of a choice */
+static bool in_choice[NSYMS];
+
+static int rnd(int n)
+{
+	return rand() % n;
+}
+
+static void gen_atom(FILE *f, int below)
+{
+	int s = rnd(below);
+
+	switch (kinds[s]) {
+	case K_BOOL:
+		fprintf(f, "%sS%d", rnd(4) ? "" : "!", s);
+		break;
+	case K_TRISTATE:
+		if (rnd(3))
+			fprintf(f, "S%d", s);
+		else
+			fprintf(f, "S%d %s %c", s, rnd(2) ? "=" : "!=",
+				"nmy"[rnd(3)]);
+		break;
+	case K_INT:
+		fprintf(f, "S%d %s %d", s, rnd(2) ? "=" : ">", rnd(8));
+		break;
+	case K_STRING:
+		fprintf(f, "S%d %s \"%c\"", s, rnd(2) ? "=" : "!=",
+			"ab"[rnd(2)]);
+		break;
+	}
+}
+
+static void gen_expr(FILE *f, int below, int depth)
+{
+	switch (depth < 2 ? rnd(5) : 0) {
+	case 3:
+	case 4:
+		fputc('(', f);
+		gen_expr(f, below, depth + 1);
+		fputs(rnd(2) ? " && " : " || ", f);
+		gen_expr(f, below, depth + 1);
+		fputc(')', f);
+		break;
+	default:
+		gen_atom(f, below);
+		break;
+	}
+}
+
+/* " if <expr>" for about a third of the properties */
+static void gen_cond(FILE *f, int below)
+{
+	if (below && !rnd(3)) {
+		fputs(" if ", f);
+		gen_expr(f, below, 0);
+	}
+}
+
+static void gen_depends(FILE *f, int below, int chance)
+{
+	if (below && !rnd(chance)) {
+		fputs("\tdepends on ", f);
+		gen_expr(f, below, 0);
+		fputc('\n', f);
+	}
+}
+
+static void gen_default(FILE *f, int i)
+{
+	switch (kinds[i]) {
+	case K_BOOL:
+	case K_TRISTATE:
+		if (i && rnd(2)) {
+			fputs("\tdefault ", f);
+			gen_expr(f, i, 1);
+		} else {
+			fprintf(f, "\tdefault %c", "nmy"[rnd(3)]);
+		}
+		break;
+	case K_INT:
+		fprintf(f, "\tdefault %d", rnd(8));
+		break;
+	case K_STRING:
+		fprintf(f, "\tdefault \"%c\"", "ab"[rnd(2)]);
+		break;
+	}
+	gen_cond(f, i);
+	fputc('\n', f);
+}
+
+static void gen_config(FILE *f, int i)
+{
+	int j, t;
+
+	fprintf(f, "config S%d\n\t%s", i, kind_name[kinds[i]]);
+	if (rnd(5)) {
+		fprintf(f, " \"s%d\"", i);
+		gen_cond(f, i);
+	}
+	fputc('\n', f);
+	gen_depends(f, i, 3);
+	for (j = rnd(3); j > 0; j--)
+		gen_default(f, i);
+	if (kinds[i] == K_INT && !rnd(3))
+		fprintf(f, "\trange %d %d\n", rnd(3), 3 + rnd(5));
+
+	/* selects only point forward, so the tree stays free of loops */
+	if (kinds[i] <= K_TRISTATE && i + 1 < NSYMS && !rnd(4)) {
+		t = i + 1 + rnd(NSYMS - i - 1);
+		if (!in_choice[t] && kinds[t] <= K_TRISTATE) {
+			fprintf(f, "\tselect S%d", t);
+			gen_cond(f, i);
+			fputc('\n', f);
+		}
+	}
+	fputc('\n', f);
+}
+
+static void gen_choice(FILE *f, int i)
+{
+	int n = choice_len[i], j;
+
+	fprintf(f, "choice\n\tprompt \"c%d\"", i);
+	gen_cond(f, i);
+	fprintf(f, "\n\t%s\n", kind_name[kinds[i]]);
+	if (rnd(2))
+		fputs("\toptional\n", f);
+	gen_depends(f, i, 3);
+	if (rnd(2)) {
+		fprintf(f, "\tdefault S%d", i + rnd(n));
+		gen_cond(f, i);
+		fputc('\n', f);
+	}
+	fputc('\n', f);
+
+	for (j = i; j < i + n; j++) {
+		fprintf(f, "config S%d\n\t%s \"s%d\"\n", j,
+			kind_name[kinds[j]], j);
+		gen_depends(f, i, 2);
+		fputc('\n', f);
+	}
+	fputs("endchoice\n\n", f);
+}
+
+static void gen_tree(FILE *f)
+{
+	int i, j, n, block = 0;
+
+	memset(choice_len, 0, sizeof(choice_len));
+	memset(in_choice, 0, sizeof(in_choice));
+	for (i = 0; i < NSYMS; i += n) {
+		n = 1;
+		if (i && !rnd(5)) {
+			n = 2 + rnd(3);
+			if (i + n > NSYMS)
+				n = NSYMS - i;
+		}
+		if (n > 1) {
+			choice_len[i] = n;
+			kinds[i] = rnd(2) ? K_BOOL : K_TRISTATE;
+			for (j = i; j < i + n; j++) {
+				kinds[j] = kinds[i];
+				in_choice[j] = true;
+			}
+		} else {
+			kinds[i] = rnd(4);
+		}
+	}
+
+	fputs("config MODULES\n\tbool \"modules\"\n\toption modules\n"
+	      "\tdefault y\n\n", f);
+
+	for (i = 0; i < NSYMS; i += choice_len[i] ? choice_len[i] : 1) {
+		if (!block && i && !rnd(6)) {
+			block = 1 + rnd(3);
+			if (rnd(2)) {
+				fputs("if ", f);
+				gen_expr(f, i, 0);
+				fputs("\n\n", f);
+				block = -block;
+			} else {
+				fprintf(f, "menu \"m%d\"\n", i);
+				if (rnd(2)) {
+					fputs("\tvisible if ", f);
+					gen_expr(f, i, 0);
+					fputc('\n', f);
+				}
+				gen_depends(f, i, 2);
+				fputc('\n', f);
+			}
+		}
+
+		if (choice_len[i])
+			gen_choice(f, i);
+		else
+			gen_config(f, i);
+
+		if (block < 0 && !++block)
+			fputs("endif\n\n", f);
+		else if (block > 0 && !--block)
+			fputs("endmenu\n\n", f);
+	}
+	if (block < 0)
+		fputs("endif\n", f);
+	else if (block > 0)
+		fputs("endmenu\n", f);
+}
+
+static struct symbol *syms[NSYMS + 1];
+
+static void dump_state(FILE *f, const char *change)
+{
+	struct symbol *sym;
+	int i;
+
+	fprintf(f, "after %s:\n", change);
+	for (i = 0; i <= NSYMS; i++) {
+		sym = syms[i];
+		sym_calc_value(sym);
+		fprintf(f, "\t%s=%s visible=%d write=%d\n", sym->name,
+			sym_get_string_value(sym), sym->visible,
+			!!(sym->flags & SYMBOL_WRITE));
+	}
+}
+
+static void change_symbol(char *desc, size_t len)
+{
+	static const char *const strs[] = { "a", "b", "" };
+	struct symbol *sym, *csym;
+	const char *str;
+	char buf[16];
+	tristate val;
+
+	/* a choice through one of its values, or the value itself */
+	sym = syms[rnd(NSYMS + 1)];
+	if (sym_is_choice_value(sym) && rnd(2)) {
+		csym = prop_get_symbol(sym_get_choice_prop(sym));
+		if (sym_get_type(csym) == S_TRISTATE || sym_is_optional(csym))
+			sym = csym;
+	}
+
+	switch (sym_get_type(sym)) {
+	case S_BOOLEAN:
+	case S_TRISTATE:
+		val = rnd(3);
+		snprintf(desc, len, "%s=%c", sym->name ? sym->name : "<choice>",
+			 "nmy"[val]);
+		sym_set_tristate_value(sym, val);
+		break;
+	case S_INT:
+		snprintf(buf, sizeof(buf), "%d", rnd(8));
+		snprintf(desc, len, "%s=%s", sym->name, buf);
+		sym_set_string_value(sym, buf);
+		break;
+	default:
+		str = strs[rnd(3)];
+		snprintf(desc, len, "%s=\"%s\"", sym->name, str);
+		sym_set_string_value(sym, str);
+		break;
+	}
+}
+
+/* writes the state after every change to out */
+static void run_tree(unsigned int seed, int changes, FILE *out)
+{
+	char name[] = "/tmp/rdeps-XXXXXX";
+	char desc[64], buf[16];
+	FILE *f;
+	int fd, i;
+
+	srand(seed);
+	fd = mkstemp(name);
+	if (fd < 0 || !(f = fdopen(fd, "w"))) {
+		perror("mkstemp");
+		exit(1);
+	}
+	gen_tree(f);
+	fclose(f);
+
+	/* parse warnings are expected, the trees are random */
+	unsetenv("KCONFIG_CACHE");
+	fd = dup(2);
+	if (!freopen("/dev/null", "w", stderr))
+		exit(1);
+	conf_parse(name);
+	unlink(name);
+	dup2(fd, 2);
+	close(fd);
+
+	syms[0] = sym_find("MODULES");
+	for (i = 0; i < NSYMS; i++) {
+		snprintf(buf, sizeof(buf), "S%d", i);
+		syms[i + 1] = sym_find(buf);
+	}
+
+	conf_set_all_new_symbols(def_random);
+	dump_state(out, "randconfig");
+	for (i = 0; i < changes; i++) {
+		change_symbol(desc, sizeof(desc));
+		dump_state(out, desc);
+	}
+}
+
+/* the parser keeps global state, so each run gets its own process */
+static FILE *run(unsigned int seed, int changes, bool full)
+{
+	FILE *out = tmpfile();
+	int status;
+	pid_t pid;
+
+	if (!out)
+		return NULL;
+
+	pid = fork();
+	if (!pid) {
+		if (full)
+			setenv("KCONFIG_FULL_RECALC", "1", 1);
+		if (!freopen("/dev/null", "w", stdout))
+			exit(1);
+		run_tree(seed, changes, out);
+		exit(fflush(out) != 0);
+	}
+	if (pid < 0 || waitpid(pid, &status, 0) < 0 ||
+	    !WIFEXITED(status) || WEXITSTATUS(status)) {
+		fclose(out);
+		return NULL;
+	}
+	rewind(out);
+	return out;
+}
+
+static int compare(unsigned int seed, FILE *a, FILE *b)
+{
+	char la[256], lb[256], change[256] = "";
+
+	while (fgets(la, sizeof(la), a)) {
+		if (!fgets(lb, sizeof(lb), b))
+			strcpy(lb, "<end>\n");
+		if (strncmp(la, "after ", 6) == 0)
+			strcpy(change, la);
+		if (!strcmp(la, lb))
+			continue;
+
+		fprintf(stderr, "seed %u, %s", seed, change);
+		fprintf(stderr, "\tincremental:%s\tfull:       %s", la + 1,
+			lb + 1);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int seed = argc > 1 ? atoi(argv[1]) : 1;
+	int trees = argc > 2 ? atoi(argv[2]) : 200;
+	int changes = argc > 3 ? atoi(argv[3]) : 100;
+	int i, failed = 0;
+	FILE *inc, *full;
+
+	for (i = 0; i < trees; i++) {
+		inc = run(seed + i, changes, false);
+		full = run(seed + i, changes, true);
+		if (!inc || !full) {
+			fprintf(stderr, "seed %u: run failed\n", seed + i);
+			failed++;
+		} else if (compare(seed + i, inc, full)) {
+			failed++;
+		}
+		if (inc)
+			fclose(inc);
+		if (full)
+			fclose(full);
+	}
+
+	printf("%d of %d trees differ\n", failed, trees);
+	return !!failed;
+}
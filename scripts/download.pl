@@ -10,8 +10,12 @@
 use strict;
 use warnings;
 use File::Basename;
-use File::Copy;
+use POSIX ();
+use Digest::MD5 qw(md5_hex);
+use Digest::SHA;
+use Storable qw(retrieve store);
 use Text::ParseWords;
+use Time::HiRes;
 
 @ARGV > 2 or die "Syntax: $0 <target dir> <filename> <hash> <url filename> [<mirror> ...]\n";
 
@@ -61,24 +65,27 @@ sub which($) {
 	return $res;
 }
 
-sub hash_cmd() {
+sub hash_new() {
 	my $len = length($file_hash);
-	my $cmd;
 
-	$len == 64 and return "mkhash sha256";
-	$len == 32 and return "mkhash md5";
+	$len == 64 and return Digest::SHA->new(256);
+	$len == 32 and return Digest::MD5->new;
 	return undef;
 }
 
+my $have_curl;
+
 sub download_cmd($) {
 	my $url = shift;
-	my $have_curl = 0;
 
-	if (open CURL, '-|', 'curl', '--version') {
-		if (defined(my $line = readline CURL)) {
-			$have_curl = 1 if $line =~ /^curl /;
+	if (!defined($have_curl)) {
+		$have_curl = 0;
+		if (open CURL, '-|', 'curl', '--version') {
+			if (defined(my $line = readline CURL)) {
+				$have_curl = 1 if $line =~ /^curl /;
+			}
+			close CURL;
 		}
-		close CURL;
 	}
 
 	return $have_curl
@@ -87,8 +94,150 @@ sub download_cmd($) {
 	;
 }
 
-my $hash_cmd = hash_cmd();
-$hash_cmd or ($file_hash eq "skip") or die "Cannot find appropriate hash command, ensure the provided hash is either a MD5 or SHA256 checksum.\n";
+hash_new() or ($file_hash eq "skip") or die "Cannot find appropriate hash command, ensure the provided hash is either a MD5 or SHA256 checksum.\n";
+
+# Local mirrors are indexed once and the index is kept in
+# $TMP_DIR/.mirror-index. It stays valid as long as the modification time
+# of every directory in the mirror is unchanged, which only costs one stat
+# per directory instead of a full find for every single download.
+# A directory modified in the same second the scan started may have changed
+# after it was read without its timestamp showing it, so an index holding
+# such a directory is not reused and the next download scans again.
+sub mirror_scan($) {
+	my $mirror = shift;
+	my %index = (dirs => {}, files => {}, time => Time::HiRes::time());
+
+	require File::Find;
+	File::Find::find({
+		follow_fast => 1,
+		follow_skip => 2,
+		wanted => sub {
+			my @st = Time::HiRes::stat($_) or return;
+			if (-d _) {
+				$index{dirs}{$File::Find::name} = $st[9];
+			} else {
+				push @{$index{files}{$_}}, $File::Find::name;
+			}
+		},
+	}, $mirror);
+
+	return \%index;
+}
+
+sub mirror_valid($) {
+	my $index = shift;
+
+	ref($index) eq 'HASH' and ref($index->{dirs}) eq 'HASH' or return 0;
+	%{$index->{dirs}} and defined($index->{time}) or return 0;
+	foreach my $dir (keys %{$index->{dirs}}) {
+		my @st = Time::HiRes::stat($dir) or return 0;
+		$st[9] == $index->{dirs}{$dir} or return 0;
+		$st[9] < int($index->{time}) or return 0;
+	}
+	return 1;
+}
+
+sub mirror_index($$) {
+	my $mirror = shift;
+	my $rescan = shift;
+	my $dir = $ENV{TMP_DIR} ? "$ENV{TMP_DIR}/.mirror-index" : undef;
+	my $file = $dir ? "$dir/".md5_hex($mirror) : undef;
+	my $index;
+
+	if ($file and !$rescan) {
+		$index = eval { retrieve($file) };
+		$index and $index->{mirror} eq $mirror and mirror_valid($index) and return $index;
+	}
+
+	$index = mirror_scan($mirror);
+	$index->{mirror} = $mirror;
+	if ($file) {
+		my $tmp = "$file.$$";
+		require File::Path;
+		File::Path::mkpath($dir);
+		if (!eval { store($index, $tmp) } or !rename($tmp, $file)) {
+			unlink $tmp;
+		}
+	}
+	return $index;
+}
+
+sub mirror_find($) {
+	my $mirror = shift;
+	my $links;
+
+	foreach my $rescan (0, 1) {
+		$links = mirror_index($mirror, $rescan)->{files}{$filename} || [];
+		last unless grep { ! -f $_ } @$links;
+	}
+
+	return @$links;
+}
+
+# Copy the stream from $in to $out and hash it on the fly.
+# Returns the hex digest, "" if no hash is needed or undef on error.
+sub hash_copy($$) {
+	my $in = shift;
+	my $out = shift;
+	my $hash = hash_new();
+	my $buffer;
+	my $len;
+
+	while ($len = sysread $in, $buffer, 1048576) {
+		$hash and $hash->add($buffer);
+		print $out $buffer or return undef;
+	}
+	defined($len) or return undef;
+
+	return $hash ? $hash->hexdigest : "";
+}
+
+sub hash_check($) {
+	my $sum = shift;
+
+	defined($sum) or return 0;
+	if ($sum ne "" and $sum ne $file_hash) {
+		print STDERR "Hash of the downloaded file does not match (file: $sum, requested: $file_hash) - deleting download.\n";
+		return 0;
+	}
+	return 1;
+}
+
+sub fetch($$) {
+	my $url = shift;
+	my $dl = shift;
+	my @cmd = download_cmd($url);
+	my $sum;
+
+	print STDERR "+ ".join(" ",@cmd)."\n";
+	open(FETCH_FD, '-|', @cmd) or die "Cannot launch curl or wget.\n";
+	open OUTPUT, "> $dl" or die "Cannot create file $dl: $!\n";
+	$sum = hash_copy(\*FETCH_FD, \*OUTPUT);
+	close FETCH_FD;
+	my $status = $?;
+	close OUTPUT or undef $sum;
+
+	if ($status >> 8 or !defined($sum)) {
+		print STDERR "Download failed.\n";
+		unlink $dl;
+		return 0;
+	}
+
+	hash_check($sum) or do {
+		unlink $dl;
+		return 0;
+	};
+
+	return 1;
+}
+
+sub finish($) {
+	my $dl = shift;
+
+	unlink "$target/$filename";
+	rename($dl, "$target/$filename") or system("mv", $dl, "$target/$filename");
+	cleanup();
+}
 
 sub download
 {
@@ -107,22 +256,14 @@ sub download
 			system("mkdir", "-p", "$target/");
 		}
 
-		if (! open TMPDLS, "find $mirror -follow -name $filename 2>/dev/null |") {
-			print("Failed to search for $filename in $mirror\n");
-			return;
-		}
-
-		my $link;
+		my @links = mirror_find($mirror);
 
-		while (defined(my $line = readline TMPDLS)) {
-			chomp ($link = $line);
-			if ($. > 1) {
-				print("$. or more instances of $filename in $mirror found . Only one instance allowed.\n");
-				return;
-			}
+		if (@links > 1) {
+			print(scalar(@links)." or more instances of $filename in $mirror found . Only one instance allowed.\n");
+			return;
 		}
 
-		close TMPDLS;
+		my $link = $links[0];
 
 		if (! $link) {
 			print("No instances of $filename found in $mirror.\n");
@@ -130,53 +271,87 @@ sub download
 		}
 
 		print("Copying $filename from $link\n");
-		copy($link, "$target/$filename.dl");
-
-		$hash_cmd and do {
-			if (system("cat '$target/$filename.dl' | $hash_cmd > '$target/$filename.hash'")) {
-				print("Failed to generate hash for $filename\n");
-				return;
-			}
-		};
-	} else {
-		my @cmd = download_cmd("$mirror/$url_filename");
-		print STDERR "+ ".join(" ",@cmd)."\n";
-		open(FETCH_FD, '-|', @cmd) or die "Cannot launch curl or wget.\n";
-		$hash_cmd and do {
-			open MD5SUM, "| $hash_cmd > '$target/$filename.hash'" or die "Cannot launch $hash_cmd.\n";
+		open INPUT, "<", $link or do {
+			print("Failed to open $link: $!\n");
+			return;
 		};
 		open OUTPUT, "> $target/$filename.dl" or die "Cannot create file $target/$filename.dl: $!\n";
-		my $buffer;
-		while (read FETCH_FD, $buffer, 1048576) {
-			$hash_cmd and print MD5SUM $buffer;
-			print OUTPUT $buffer;
-		}
-		$hash_cmd and close MD5SUM;
-		close FETCH_FD;
-		close OUTPUT;
+		my $sum = hash_copy(\*INPUT, \*OUTPUT);
+		close INPUT;
+		close OUTPUT or undef $sum;
 
-		if ($? >> 8) {
-			print STDERR "Download failed.\n";
+		defined($sum) or print("Failed to generate hash for $filename\n");
+		hash_check($sum) or do {
 			cleanup();
 			return;
-		}
+		};
+	} else {
+		fetch("$mirror/$url_filename", "$target/$filename.dl") or return;
 	}
 
-	$hash_cmd and do {
-		my $sum = `cat "$target/$filename.hash"`;
-		$sum =~ /^(\w+)\s*/ or die "Could not generate file hash\n";
-		$sum = $1;
+	finish("$target/$filename.dl");
+}
 
-		if ($sum ne $file_hash) {
-			print STDERR "Hash of the downloaded file does not match (file: $sum, requested: $file_hash) - deleting download.\n";
-			cleanup();
-			return;
+# Fetch from several mirrors at once. Every mirror gets its own child in a
+# separate process group, so that the losers can be killed together with
+# their curl or wget as soon as the first verified download is complete.
+# The same happens when the race itself is interrupted: no child is left
+# running in the background and no partial .dl.<n> file is left behind.
+sub download_race
+{
+	my %child;
+	my $winner;
+	my $stop = sub {
+		foreach my $pid (keys %child) {
+			kill('TERM', -$pid);
+			kill('TERM', $pid);
 		}
+		foreach my $pid (keys %child) {
+			waitpid($pid, 0);
+			unlink $child{$pid};
+		}
+		%child = ();
 	};
+	my $signals = POSIX::SigSet->new(POSIX::SIGINT(), POSIX::SIGTERM());
+
+	local $SIG{INT} = sub { $stop->(); exit(1); };
+	local $SIG{TERM} = $SIG{INT};
+
+	for my $n (0 .. $#_) {
+		my $mirror = $_[$n];
+		my $dl = "$target/$filename.dl.$n";
+
+		$mirror =~ s!/$!!;
+
+		# a signal must not arrive before the child is in %child
+		POSIX::sigprocmask(POSIX::SIG_BLOCK(), $signals);
+		my $pid = fork();
+		if (defined($pid) and !$pid) {
+			$SIG{INT} = 'DEFAULT';
+			$SIG{TERM} = 'DEFAULT';
+			setpgrp(0, 0);
+			POSIX::sigprocmask(POSIX::SIG_UNBLOCK(), $signals);
+			exit(fetch("$mirror/$url_filename", $dl) ? 0 : 1);
+		}
+		defined($pid) and $child{$pid} = $dl;
+		POSIX::sigprocmask(POSIX::SIG_UNBLOCK(), $signals);
+		defined($pid) or last;
+	}
 
-	unlink "$target/$filename";
-	system("mv", "$target/$filename.dl", "$target/$filename");
-	cleanup();
+	while (%child) {
+		my $pid = waitpid(-1, 0);
+		$pid > 0 or last;
+		my $dl = delete $child{$pid} or next;
+
+		if (!$? and -f $dl) {
+			$winner = $dl;
+			last;
+		}
+		unlink $dl;
+	}
+
+	$stop->();
+	$winner and finish($winner);
 }
 
 sub cleanup
@@ -262,11 +437,37 @@ push @mirrors, 'https://sources.lede-project.org';
 push @mirrors, 'https://mirror2.openwrt.org/sources';
 push @mirrors, 'https://downloads.openwrt.org/sources';
 
+# DOWNLOAD_RACE=<n> fetches from the next <n> distinct remote mirrors at
+# the same time and keeps the first download with a matching hash. The
+# build sets it from CONFIG_DOWNLOAD_RACE unless it is already set.
+my $race = $ENV{'DOWNLOAD_RACE'} || 1;
+$race =~ /^\d+$/ or $race = 1;
+
 while (!-f "$target/$filename") {
 	my $mirror = shift @mirrors;
 	$mirror or die "No more mirrors to try - giving up.\n";
 
-	download($mirror);
+	if ($race < 2 or $mirror =~ m!^file://!) {
+		download($mirror);
+		next;
+	}
+
+	my @race = ($mirror);
+	my %seen = ($mirror => 1);
+	my @rest;
+	foreach my $next (@mirrors) {
+		if (@race < $race and $next !~ m!^file://! and !$seen{$next}++) {
+			push @race, $next;
+		} else {
+			push @rest, $next;
+		}
+	}
+	@mirrors = @rest;
+
+	if (! -d "$target") {
+		system("mkdir", "-p", "$target/");
+	}
+	download_race(@race);
 }
 
 $SIG{INT} = \&cleanup;
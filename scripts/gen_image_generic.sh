@@ -19,17 +19,16 @@ head=16
 sect=63
 cyl=$(( ($KERNELSIZE + $ROOTFSSIZE) * 1024 * 1024 / ($head * $sect * 512)))
 
-# create partition table
-set `ptgen -o "$OUTPUT" -h $head -s $sect -p ${KERNELSIZE}m -p ${ROOTFSSIZE}m ${ALIGN:+-l $ALIGN} ${SIGNATURE:+-S 0x$SIGNATURE}`
+ptgen_args="-h $head -s $sect ${ALIGN:+-l $ALIGN} ${SIGNATURE:+-S 0x$SIGNATURE}"
 
-KERNELOFFSET="$(($1 / 512))"
-KERNELSIZE="$2"
-ROOTFSOFFSET="$(($3 / 512))"
-ROOTFSSIZE="$(($4 / 512))"
+# compute the partition layout
+set `ptgen -o "$OUTPUT" $ptgen_args -p ${KERNELSIZE}m -p ${ROOTFSSIZE}m`
 
-[ -n "$PADDING" ] && dd if=/dev/zero of="$OUTPUT" bs=512 seek="$ROOTFSOFFSET" conv=notrunc count="$ROOTFSSIZE"
-dd if="$ROOTFSIMAGE" of="$OUTPUT" bs=512 seek="$ROOTFSOFFSET" conv=notrunc
+make_ext4fs -J -l "$2" "$OUTPUT.kernel" "$KERNELDIR"
 
-make_ext4fs -J -l "$KERNELSIZE" "$OUTPUT.kernel" "$KERNELDIR"
-dd if="$OUTPUT.kernel" of="$OUTPUT" bs=512 seek="$KERNELOFFSET" conv=notrunc
+# write the partition table and both partitions in one pass, unused space
+# (and the padding, if requested) is left as holes
+ptgen -o "$OUTPUT" $ptgen_args ${PADDING:+-z} \
+    -p ${KERNELSIZE}m -i "$OUTPUT.kernel" \
+    -p ${ROOTFSSIZE}m -i "$ROOTFSIMAGE" > /dev/null
 rm -f "$OUTPUT.kernel"
@@ -0,0 +1,64 @@
+#!/bin/sh
+#
+# Content addressed cache for image build steps
+#
+# get <file> <recipe>: looks up the result of running <recipe> on the current
+#   contents of <file>. On a hit <file> is replaced with the cached result,
+#   on a miss the lookup key is remembered for the following put.
+# put <file>: stores <file> as the result of the last missed lookup.
+# stats [reset]: prints (or resets) the hit and miss counters.
+
+cache_dir="${IMAGE_CACHE_DIR:?IMAGE_CACHE_DIR is not set}"
+stats="$cache_dir/.stats"
+
+mkdir -p "$cache_dir" || exit 1
+
+case "$1" in
+get)
+	file="$2"
+	recipe="$3"
+
+	[ -f "$file" ] || exit 1
+
+	key="$( {
+		mkhash sha256 < "$file"
+		echo "$recipe"
+		echo "$SOURCE_DATE_EPOCH"
+	} | mkhash sha256 )"
+
+	if [ -f "$cache_dir/$key" ] && cp "$cache_dir/$key" "$file.cache" &&
+	   mv "$file.cache" "$file"; then
+		rm -f "$file.cachekey"
+		echo hit >> "$stats"
+		exit 0
+	fi
+
+	echo "$key" > "$file.cachekey"
+	echo miss >> "$stats"
+	exit 1
+	;;
+put)
+	file="$2"
+
+	[ -f "$file.cachekey" ] || exit 0
+	key="$(cat "$file.cachekey")"
+	rm -f "$file.cachekey"
+
+	cp "$file" "$cache_dir/$key.$$" && mv "$cache_dir/$key.$$" "$cache_dir/$key"
+	;;
+stats)
+	if [ "$2" = "reset" ]; then
+		rm -f "$stats"
+		exit 0
+	fi
+
+	[ -f "$stats" ] || exit 0
+	hits=$(grep -c '^hit$' "$stats")
+	misses=$(grep -c '^miss$' "$stats")
+	echo "Image step cache: $hits hits, $misses misses"
+	;;
+*)
+	echo "Usage: $0 get <file> <recipe> | put <file> | stats [reset]" >&2
+	exit 1
+	;;
+esac
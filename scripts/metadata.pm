@@ -2,6 +2,8 @@ package metadata;
 use base 'Exporter';
 use strict;
 use warnings;
+use Digest::MD5;
+use Storable qw(retrieve store);
 our @EXPORT = qw(%package %vpackage %srcpackage %category %overrides clear_packages parse_package_metadata parse_target_metadata get_multiline @ignore %usernames %groupnames);
 
 our %package;
@@ -16,6 +18,57 @@ our %groupnames;
 our %userids;
 our %groupids;
 
+# Parsed metadata is cached in <file>.cache, so that the metadata scripts
+# called over and over during a build only parse tmp/.packageinfo once.
+# Warnings printed while parsing are stored along with it and printed
+# again whenever the cache is used.
+my $cache_version = 1;
+
+sub cache_stamp($) {
+	my $file = shift;
+	my $md5 = Digest::MD5->new;
+
+	open my $fh, "<", $file or return undef;
+	$md5->addfile($fh);
+	close $fh;
+
+	open $fh, "<", __FILE__ or return undef;
+	$md5->addfile($fh);
+	close $fh;
+
+	return join(" ", $cache_version, $md5->hexdigest, @ignore);
+}
+
+sub cache_load($) {
+	my $file = shift;
+	my $stamp = cache_stamp($file) or return undef;
+	my $data = eval { retrieve("$file.cache") } or return undef;
+
+	return undef unless ref($data) eq 'HASH' and $data->{stamp} and $data->{stamp} eq $stamp;
+	warn $_ foreach @{$data->{warnings} || []};
+	return $data;
+}
+
+sub cache_warnings($) {
+	my $warnings = shift;
+
+	return sub {
+		push @$warnings, $_[0];
+		warn $_[0];
+	};
+}
+
+sub cache_save($$) {
+	my $file = shift;
+	my $data = shift;
+	my $tmp = "$file.cache.$$";
+
+	$data->{stamp} = cache_stamp($file) or return;
+	if (!eval { store($data, $tmp) } or !rename($tmp, "$file.cache")) {
+		unlink $tmp;
+	}
+}
+
 sub get_multiline {
 	my $fh = shift;
 	my $prefix = shift;
@@ -91,6 +144,11 @@ sub parse_target_metadata($) {
 	my ($target, @target, $profile);
 	my %target;
 	my $makefile;
+	my @warnings;
+	my $cache = cache_load($file);
+
+	$cache and $cache->{target} and return @{$cache->{target}};
+	local $SIG{__WARN__} = cache_warnings(\@warnings);
 
 	open FILE, "<$file" or do {
 		warn "Can't open file '$file': $!\n";
@@ -177,6 +235,7 @@ sub parse_target_metadata($) {
 			$a->{name} cmp $b->{name};
 		} @{$target->{profiles}};
 	}
+	cache_save($file, { target => \@target, warnings => \@warnings });
 	return @target;
 }
 
@@ -196,6 +255,25 @@ sub parse_package_metadata($) {
 	my $src;
 	my $override;
 	my %ignore = map { $_ => 1 } @ignore;
+	my $cached = !%package && !%srcpackage;
+
+	if ($cached and my $cache = cache_load($file)) {
+		if ($cache->{package}) {
+			%package = %{$cache->{package}};
+			%vpackage = %{$cache->{vpackage}};
+			%srcpackage = %{$cache->{srcpackage}};
+			%category = %{$cache->{category}};
+			%overrides = %{$cache->{overrides}};
+			%usernames = %{$cache->{usernames}};
+			%groupnames = %{$cache->{groupnames}};
+			%userids = %{$cache->{userids}};
+			%groupids = %{$cache->{groupids}};
+			return 1;
+		}
+	}
+
+	my @warnings;
+	local $SIG{__WARN__} = cache_warnings(\@warnings) if $cached;
 
 	open FILE, "<$file" or do {
 		warn "Cannot open '$file': $!\n";
@@ -300,6 +378,19 @@ sub parse_package_metadata($) {
 		};
 	}
 	close FILE;
+
+	$cached and cache_save($file, {
+		package => \%package,
+		vpackage => \%vpackage,
+		srcpackage => \%srcpackage,
+		category => \%category,
+		overrides => \%overrides,
+		usernames => \%usernames,
+		groupnames => \%groupnames,
+		userids => \%userids,
+		groupids => \%groupids,
+		warnings => \@warnings,
+	});
 	return 1;
 }
 
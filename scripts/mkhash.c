@@ -680,7 +680,7 @@ static char *hash_string(unsigned char *buf, int len)
 	static char str[SHA256_DIGEST_LENGTH * 2 + 1];
 	int i;
 
-	if (len * 2 + 1 > sizeof(str))
+	if (len * 2 + 1 > (int) sizeof(str))
 		return NULL;
 
 	for (i = 0; i < len; i++)
@@ -732,6 +732,7 @@ struct hash_type types[] = {
 };
 
 
+#ifndef MKHASH_LIB
 static int usage(const char *progname)
 {
 	int i;
@@ -825,3 +826,4 @@ int main(int argc, char **argv)
 
 	return 0;
 }
+#endif
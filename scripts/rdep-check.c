@@ -0,0 +1,623 @@
+/*
+ * Copyright (C) 2020 OpenWrt.org
+ *
+ * This is free software, licensed under the GNU General Public License v2.
+ * See /LICENSE for more information.
+ *
+ * Native replacement for the find + timestamp.pl pipeline used by the rdep
+ * macro in include/depends.mk. Walks all given paths in one process (one
+ * thread per path) and exits with 0 if the stamp file given with -n is at
+ * least as new as every file below them, i.e. when nothing needs to be
+ * rebuilt. The decision is the same as for
+ *
+ *	timestamp.pl <options> -n <stamp> <stamp> <paths...>
+ *
+ * With -l <file>, the MD5 of the file listing that
+ *
+ *	find <paths> -type f -and -not -path <pattern>... | mkhash md5
+ *
+ * would produce is written to <file>. If <file> existed and had different
+ * contents, the check fails as well.
+ *
+ * With -C <dir>, the directory listings seen during the walk are kept in a
+ * cache file below <dir>. Directories whose mtime did not change since are
+ * not read again. Files are always stat()ed, as modifying a file does not
+ * touch the mtime of its directory.
+ */
+
+#define _GNU_SOURCE
+#define MKHASH_LIB
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "mkhash.c"
+
+#ifdef __APPLE__
+#define st_mtim st_mtimespec
+#endif
+
+struct buf {
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+struct root {
+	const char *path;
+	bool list;		/* part of the -l file listing */
+	bool listing_only;	/* not looked at by timestamp.pl */
+	time_t newest;		/* newest file considered for the timestamp */
+	struct buf files;	/* listed files, one per line */
+	struct buf cache;	/* directory records for the new cache */
+	char name[PATH_MAX];
+	pthread_t thread;
+	bool threaded;
+};
+
+struct cache_entry {
+	const char *path;	/* record in the cache file buffer */
+	size_t path_len;
+	long long sec;
+	long nsec;
+	const char *entries;
+	bool used;
+};
+
+static const char *builtin_patterns[] = { "*/.svn*", "*CVS*" };
+static const char **patterns;
+static int n_patterns;
+static bool follow;
+
+static time_t stamp_time;
+static time_t start_time;
+static bool want_list;
+static volatile bool newer_found;
+
+static char *cache_data;
+static struct cache_entry *cache;
+static size_t cache_mask;
+static volatile bool cache_missed;
+
+static void buf_add(struct buf *b, const char *data, size_t len)
+{
+	if (b->len + len > b->size) {
+		b->size = (b->len + len) * 2 + 4096;
+		b->data = realloc(b->data, b->size);
+		if (!b->data) {
+			perror("realloc");
+			exit(2);
+		}
+	}
+
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+}
+
+static bool match_any(const char **list, int n, const char *path)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (!fnmatch(list[i], path, 0))
+			return true;
+
+	return false;
+}
+
+static uint64_t hash_path(const char *path, size_t len)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (len--) {
+		h ^= (unsigned char) *path++;
+		h *= 0x100000001b3ULL;
+	}
+
+	return h;
+}
+
+static struct cache_entry *cache_lookup(const char *path, size_t len)
+{
+	size_t i;
+
+	if (!cache)
+		return NULL;
+
+	for (i = hash_path(path, len) & cache_mask; cache[i].path;
+	     i = (i + 1) & cache_mask) {
+		if (cache[i].path_len == len &&
+		    !memcmp(cache[i].path, path, len))
+			return &cache[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Cache records look like
+ *	<dir>\t<mtime sec>.<mtime nsec>\n
+ *	<type><name>\n...
+ *	\n
+ * with type 'f' for regular files, 'd' for directories, 'l' for symlinks
+ * and 'o' for anything else.
+ */
+static void cache_load(const char *file)
+{
+	struct stat st;
+	size_t n = 0, size, i;
+	char *p, *end;
+	int fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0)
+		return;
+
+	if (fstat(fd, &st) || !st.st_size) {
+		close(fd);
+		return;
+	}
+
+	cache_data = malloc(st.st_size + 1);
+	if (!cache_data || read(fd, cache_data, st.st_size) != st.st_size) {
+		close(fd);
+		free(cache_data);
+		cache_data = NULL;
+		return;
+	}
+	close(fd);
+
+	end = cache_data + st.st_size;
+	*end = 0;
+
+	for (p = cache_data; p < end; p++)
+		if (*p == '\n' && (p == cache_data || p[-1] == '\n'))
+			n++;
+
+	for (size = 64; size < n * 2; size <<= 1)
+		;
+
+	cache = calloc(size, sizeof(*cache));
+	if (!cache)
+		return;
+	cache_mask = size - 1;
+
+	for (p = cache_data; p < end; ) {
+		struct cache_entry e = {};
+		char *tab, *nl, *dot, *num_end, *q;
+
+		tab = strchr(p, '\t');
+		nl = strchr(p, '\n');
+		if (!tab || !nl || tab > nl || tab == p)
+			goto corrupt;
+
+		e.path = p;
+		e.path_len = tab - p;
+		e.sec = strtoll(tab + 1, &dot, 10);
+		if (dot == tab + 1 || *dot != '.')
+			goto corrupt;
+		e.nsec = strtol(dot + 1, &num_end, 10);
+		if (num_end == dot + 1 || num_end != nl)
+			goto corrupt;
+		e.entries = nl + 1;
+
+		/* check the entries up to the empty line ending the record */
+		for (p = nl + 1; p < end && *p != '\n'; p = q + 1) {
+			q = strchr(p, '\n');
+			if (!q || q - p < 2 || !strchr("fdlo", *p))
+				goto corrupt;
+		}
+		if (p >= end)
+			goto corrupt;
+		p++;
+
+		for (i = hash_path(e.path, e.path_len) & cache_mask;
+		     cache[i].path; i = (i + 1) & cache_mask)
+			;
+		cache[i] = e;
+	}
+
+	return;
+
+corrupt:
+	/* start over with an empty cache rather than trust any of it */
+	free(cache);
+	cache = NULL;
+	cache_mask = 0;
+	free(cache_data);
+	cache_data = NULL;
+}
+
+static void cache_save(const char *file, struct root *roots, int n_roots)
+{
+	char *tmp;
+	size_t i;
+	int fd, r;
+	bool ok = true;
+
+	if (!cache_missed && cache) {
+		for (i = 0; i <= cache_mask; i++)
+			if (cache[i].path && !cache[i].used)
+				break;
+
+		/* every record was still valid and nothing was added */
+		if (i > cache_mask)
+			return;
+	}
+
+	if (asprintf(&tmp, "%s.%d", file, (int) getpid()) < 0)
+		return;
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		free(tmp);
+		return;
+	}
+
+	for (r = 0; r < n_roots && ok; r++)
+		ok = write(fd, roots[r].cache.data, roots[r].cache.len) ==
+		     (ssize_t) roots[r].cache.len;
+
+	if (close(fd) || !ok || rename(tmp, file))
+		unlink(tmp);
+	free(tmp);
+}
+
+static char entry_type(const char *path, struct dirent *d)
+{
+	struct stat st;
+
+	switch (d->d_type) {
+	case DT_REG:
+		return 'f';
+	case DT_DIR:
+		return 'd';
+	case DT_LNK:
+		return 'l';
+	case DT_UNKNOWN:
+		break;
+	default:
+		return 'o';
+	}
+
+	if (lstat(path, &st))
+		return 'o';
+	if (S_ISREG(st.st_mode))
+		return 'f';
+	if (S_ISDIR(st.st_mode))
+		return 'd';
+	if (S_ISLNK(st.st_mode))
+		return 'l';
+
+	return 'o';
+}
+
+static void check_file(struct root *r, size_t len, bool list)
+{
+	struct stat st;
+
+	if (match_any(patterns, n_patterns, r->name))
+		return;
+
+	if (list) {
+		r->name[len] = '\n';
+		buf_add(&r->files, r->name, len + 1);
+		r->name[len] = 0;
+	}
+
+	if (r->listing_only ||
+	    match_any(builtin_patterns, ARRAY_SIZE(builtin_patterns), r->name))
+		return;
+
+	if (lstat(r->name, &st) || !S_ISREG(st.st_mode))
+		return;
+
+	if (st.st_mtime > r->newest)
+		r->newest = st.st_mtime;
+
+	if (st.st_mtime > stamp_time)
+		newer_found = true;
+}
+
+struct dir_id {
+	dev_t dev;
+	ino_t ino;
+	struct dir_id *parent;
+};
+
+static void walk_dir(struct root *r, size_t len, const struct stat *st,
+		     bool list, struct dir_id *parent);
+
+static void walk_entry(struct root *r, size_t len, char type, bool list,
+		       struct dir_id *parent)
+{
+	struct stat st;
+
+	if (newer_found && !want_list)
+		return;
+
+	switch (type) {
+	case 'f':
+		check_file(r, len, list);
+		break;
+	case 'd':
+		if (!lstat(r->name, &st) && S_ISDIR(st.st_mode))
+			walk_dir(r, len, &st, list, parent);
+		break;
+	case 'l':
+		/* symlinked directories are only followed with -f and are
+		 * never part of the listing, symlinked files never count */
+		if (follow && !stat(r->name, &st) && S_ISDIR(st.st_mode))
+			walk_dir(r, len, &st, false, parent);
+		break;
+	}
+}
+
+static void walk_dir(struct root *r, size_t len, const struct stat *st,
+		     bool list, struct dir_id *parent)
+{
+	struct dir_id id = { st->st_dev, st->st_ino, parent };
+	struct cache_entry *c;
+	struct buf fresh = {};
+	const char *entries, *p;
+	struct dirent *d;
+	bool record;
+	size_t base = len;
+	DIR *dir;
+
+	for (; parent; parent = parent->parent)
+		if (parent->dev == id.dev && parent->ino == id.ino)
+			return;
+
+	if (len + 2 >= sizeof(r->name))
+		return;
+
+	if (r->name[len - 1] != '/')
+		base++;
+
+	c = cache_lookup(r->name, len);
+	if (c && c->sec == st->st_mtim.tv_sec && c->nsec == st->st_mtim.tv_nsec) {
+		c->used = true;
+		entries = c->entries;
+		record = true;
+	} else {
+		/* directories modified just now may still change unnoticed */
+		record = st->st_mtime < start_time - 1;
+		cache_missed = true;
+
+		dir = opendir(r->name);
+		if (!dir)
+			return;
+
+		r->name[base - 1] = '/';
+		while ((d = readdir(dir)) != NULL) {
+			size_t n = strlen(d->d_name);
+			char type;
+
+			if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, ".."))
+				continue;
+
+			if (base + n >= sizeof(r->name) ||
+			    strpbrk(d->d_name, "\t\n")) {
+				record = false;
+				continue;
+			}
+
+			memcpy(r->name + base, d->d_name, n + 1);
+			type = entry_type(r->name, d);
+
+			buf_add(&fresh, &type, 1);
+			buf_add(&fresh, d->d_name, n);
+			buf_add(&fresh, "\n", 1);
+		}
+		closedir(dir);
+		r->name[len] = 0;
+
+		buf_add(&fresh, "\n", 2);
+		entries = fresh.data;
+	}
+
+	if (record) {
+		char hdr[64];
+
+		for (p = entries; *p && *p != '\n'; p = strchr(p, '\n') + 1)
+			;
+
+		snprintf(hdr, sizeof(hdr), "\t%lld.%09ld\n",
+			 (long long) st->st_mtim.tv_sec, (long) st->st_mtim.tv_nsec);
+		buf_add(&r->cache, r->name, len);
+		buf_add(&r->cache, hdr, strlen(hdr));
+		buf_add(&r->cache, entries, p - entries + 1);
+	}
+
+	for (p = entries; *p && *p != '\n'; ) {
+		const char *nl = strchr(p, '\n');
+		size_t n = nl - p - 1;
+
+		if (base + n < sizeof(r->name)) {
+			r->name[base - 1] = '/';
+			memcpy(r->name + base, p + 1, n);
+			r->name[base + n] = 0;
+			walk_entry(r, base + n, *p, list, &id);
+		}
+
+		p = nl + 1;
+	}
+
+	r->name[len] = 0;
+	free(fresh.data);
+}
+
+static void *walk_root(void *arg)
+{
+	struct root *r = arg;
+	struct stat lst, st;
+	size_t len = strlen(r->path);
+
+	if (len >= sizeof(r->name))
+		return NULL;
+
+	memcpy(r->name, r->path, len + 1);
+
+	if (lstat(r->path, &lst))
+		return NULL;
+
+	if (S_ISLNK(lst.st_mode)) {
+		/* timestamp.pl appends a slash to directories, so find follows
+		 * a symlinked root there, but not in the listing */
+		if (stat(r->path, &st) || !S_ISDIR(st.st_mode))
+			return NULL;
+		walk_dir(r, len, &st, false, NULL);
+	} else if (S_ISDIR(lst.st_mode)) {
+		walk_dir(r, len, &lst, r->list, NULL);
+	} else if (S_ISREG(lst.st_mode)) {
+		check_file(r, len, r->list);
+	}
+
+	return NULL;
+}
+
+static int check_list(const char *file, struct root *roots, int n_roots)
+{
+	unsigned char val[MD5_DIGEST_LENGTH];
+	char old[MD5_DIGEST_LENGTH * 2 + 2] = "";
+	const char *str;
+	MD5_CTX ctx;
+	FILE *f;
+	int i, ret = 0;
+
+	MD5_begin(&ctx);
+	for (i = 0; i < n_roots; i++)
+		if (roots[i].files.len)
+			MD5_hash(roots[i].files.data, roots[i].files.len, &ctx);
+	MD5_end(val, &ctx);
+	str = hash_string(val, MD5_DIGEST_LENGTH);
+
+	f = fopen(file, "r");
+	if (f) {
+		if (!fgets(old, sizeof(old), f) || strlen(old) != strlen(str) + 1 ||
+		    strncmp(old, str, strlen(str)))
+			ret = 1;
+		fclose(f);
+	}
+
+	f = fopen(file, "w");
+	if (!f || fprintf(f, "%s\n", str) < 0 || fclose(f)) {
+		perror(file);
+		return 1;
+	}
+
+	return ret;
+}
+
+static int usage(const char *progname)
+{
+	fprintf(stderr, "Usage: %s [-x <pattern>]... [-f] [-l <file>] [-C <dir>] -n <stamp> <path>...\n",
+		progname);
+	return 2;
+}
+
+int main(int argc, char **argv)
+{
+	const char *stamp = NULL, *list_file = NULL, *cache_dir = NULL;
+	char cache_file[PATH_MAX];
+	struct root *roots, stamp_root = {};
+	int n_roots = 0, n_listed = 0;
+	int i, ret;
+
+	patterns = calloc(argc, sizeof(*patterns));
+	roots = calloc(argc + 1, sizeof(*roots));
+	if (!patterns || !roots)
+		return 2;
+
+	for (i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+
+		if (!strcmp(arg, "-x") && i + 1 < argc)
+			patterns[n_patterns++] = argv[++i];
+		else if (!strcmp(arg, "-f"))
+			follow = true;
+		else if (!strcmp(arg, "-n") && i + 1 < argc)
+			stamp = argv[++i];
+		else if (!strcmp(arg, "-l") && i + 1 < argc)
+			list_file = argv[++i];
+		else if (!strcmp(arg, "-C") && i + 1 < argc)
+			cache_dir = argv[++i];
+		else if (arg[0] == '-')
+			return usage(argv[0]);
+		else
+			roots[n_roots++].path = arg;
+	}
+
+	if (!stamp)
+		return usage(argv[0]);
+
+	want_list = !!list_file;
+	start_time = time(NULL);
+
+	/* the stamp itself is the first path timestamp.pl looks at */
+	stamp_root.path = stamp;
+	stamp_time = LONG_MAX;
+	walk_root(&stamp_root);
+	stamp_time = stamp_root.newest;
+	newer_found = false;
+
+	for (i = 0; i < n_roots; i++) {
+		if (want_list && !access(roots[i].path, F_OK)) {
+			roots[i].list = true;
+			n_listed++;
+		}
+	}
+
+	/* find without any existing path lists the current directory */
+	if (want_list && !n_listed) {
+		roots[n_roots].path = ".";
+		roots[n_roots].list = true;
+		roots[n_roots].listing_only = true;
+		n_roots++;
+	}
+
+	/* a cache path that does not fit just disables the cache */
+	if (cache_dir &&
+	    snprintf(cache_file, sizeof(cache_file), "%s/%016llx", cache_dir,
+		     (unsigned long long) hash_path(stamp, strlen(stamp))) >=
+	    (int) sizeof(cache_file))
+		cache_dir = NULL;
+
+	if (cache_dir) {
+		mkdir(cache_dir, 0755);
+		cache_load(cache_file);
+	}
+
+	for (i = 0; i < n_roots; i++) {
+		if (n_roots > 1 &&
+		    !pthread_create(&roots[i].thread, NULL, walk_root, &roots[i]))
+			roots[i].threaded = true;
+		else
+			walk_root(&roots[i]);
+	}
+
+	for (i = 0; i < n_roots; i++)
+		if (roots[i].threaded)
+			pthread_join(roots[i].thread, NULL);
+
+	ret = !stamp_time || newer_found;
+	for (i = 0; i < n_roots && !ret; i++)
+		if (roots[i].newest > stamp_time)
+			ret = 1;
+
+	if (list_file && check_list(list_file, roots, n_roots))
+		ret = 1;
+
+	if (cache_dir && !(newer_found && !want_list))
+		cache_save(cache_file, roots, n_roots);
+
+	return ret;
+}
@@ -0,0 +1,92 @@
+#!/usr/bin/env bash
+#
+# Collects the DUMP=1 metadata of a single package or target directory for
+# include/scan.mk.
+#
+# usage: scan-package.sh <output> <dir> <feed> <override> [<extra deps>...]
+#
+# The output is memoised in $SCAN_CACHE, keyed by the contents of the
+# makefiles the last dump of <dir> actually read plus the extra dependencies,
+# so touching include/*.mk or switching branches back and forth does not
+# cause a rescan. Scan times of cache misses are appended to $SCAN_TIMES.
+
+out="$1"
+dir="$2"
+feed="$3"
+override="$4"
+shift 4
+
+deps="$out.deps"
+
+progress() {
+	[ "$IS_TTY" = 1 ] || return 0
+	if [ "$NO_COLOR" = 1 ]; then
+		printf "\r%s" "$1" >&2
+	else
+		printf "\033[M\r%s" "$1" >&2
+	fi
+}
+
+now_ms() {
+	local t="$(date +%s%3N)"
+
+	case "$t" in
+		*[!0-9]*) echo "$(( $(date +%s) * 1000 ))";;
+		*) echo "$t";;
+	esac
+}
+
+# Hashes the recorded makefiles, skipping generated files like .config
+cache_key() {
+	local files
+
+	files="$(grep -v -e "^$TOPDIR/\.config$" -e "^$TOPDIR/tmp/" "$deps")" || return 1
+	{
+		echo "$dir $feed $override $SCAN_MAKEOPTS"
+		mkhash md5 "$dir/Makefile" $files "$@"
+	} | mkhash md5
+}
+
+count() {
+	echo "$1" >> "$SCAN_TIMES.count"
+	echo "$(wc -l < "$SCAN_TIMES.count")"
+}
+
+if [ -s "$deps" ] && key="$(cache_key "$@" 2>/dev/null)" &&
+   [ -f "$SCAN_CACHE/$key" ]; then
+	cp "$SCAN_CACHE/$key" "$out.tmp" && mv "$out.tmp" "$out" && exit 0
+fi
+
+progress "Collecting $SCAN_NAME info: [$(count "$dir")] $dir"
+
+dump() {
+	$NO_TRACE_MAKE --no-print-dir -r DUMP=1 FEED="$feed" -C "$dir" \
+		-f Makefile -f "$TOPDIR/include/scan-record.mk" \
+		SCAN_RECORD="$deps.tmp" $SCAN_MAKEOPTS
+}
+
+start="$(now_ms)"
+ok=1
+{
+	echo "Source-Makefile: $dir/Makefile"
+	[ -n "$override" ] && echo "Override: $override"
+	dump 2>/dev/null || {
+		mkdir -p "$TOPDIR/logs/$dir"
+		dump > "$TOPDIR/logs/$dir/dump.txt" 2>&1
+		progress "ERROR: please fix $dir/Makefile - see logs/$dir/dump.txt for details"$'\n'
+		ok=
+	}
+	echo
+} > "$out.tmp"
+mv "$out.tmp" "$out"
+
+echo "$(( $(now_ms) - start )) $dir" >> "$SCAN_TIMES"
+
+if [ -n "$ok" ] && mv "$deps.tmp" "$deps" && key="$(cache_key "$@")"; then
+	mkdir -p "$SCAN_CACHE"
+	cp "$out" "$SCAN_CACHE/$key.$$" && mv "$SCAN_CACHE/$key.$$" "$SCAN_CACHE/$key"
+else
+	rm -f "$deps" "$deps.tmp"
+fi
+
+exit 0
@@ -0,0 +1,374 @@
+/*
+ * Copyright (C) 2020 OpenWrt.org
+ *
+ * This is free software, licensed under the GNU General Public License v2.
+ * See /LICENSE for more information.
+ *
+ * Native replacement for scripts/sysupgrade-tar.sh. Writes the
+ * sysupgrade-<board>/{CONTROL,kernel,root} archive directly from the source
+ * files instead of copying them into a temporary directory first. The data
+ * is copied with copy_file_range() where available, which lets filesystems
+ * supporting it share extents instead of copying them.
+ *
+ * The output is the same as that of
+ *
+ *	tar --sort=name --owner=0 --group=0 --numeric-owner -cf <out> \
+ *		sysupgrade-<board> [--mtime=@$SOURCE_DATE_EPOCH]
+ *
+ * run on the temporary directory the shell script used to create, i.e. a
+ * GNU format archive padded to the default 10 KiB record size.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#define TAR_BLOCK	512
+#define TAR_RECORD	(20 * TAR_BLOCK)
+
+struct tar_header {
+	char name[100];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];
+	char mtime[12];
+	char chksum[8];
+	char typeflag;
+	char linkname[100];
+	char magic[8];
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char pad[167];
+};
+
+struct member {
+	const char *name;	/* relative to the board directory */
+	const char *src;	/* source file, NULL for CONTROL */
+	int fd;
+	struct stat st;
+};
+
+static const char *outfile;
+static int out_fd = -1;
+static char *tmp_name;
+static uint64_t out_pos;
+
+static int
+usage(const char *prog)
+{
+	fprintf(stderr, "syntax: %s [--board boardname] [--kernel kernelimage] [--rootfs rootfs] out\n", prog);
+	return 1;
+}
+
+static int
+write_all(const void *buf, size_t len)
+{
+	const char *p = buf;
+
+	while (len) {
+		ssize_t r = write(out_fd, p, len);
+
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += r;
+		len -= r;
+		out_pos += r;
+	}
+
+	return 0;
+}
+
+static int
+write_zero(size_t len)
+{
+	static const char zero[TAR_BLOCK];
+
+	while (len) {
+		size_t cur = len < sizeof(zero) ? len : sizeof(zero);
+
+		if (write_all(zero, cur))
+			return -1;
+		len -= cur;
+	}
+
+	return 0;
+}
+
+static int
+pad_block(void)
+{
+	return write_zero((TAR_BLOCK - out_pos % TAR_BLOCK) % TAR_BLOCK);
+}
+
+static void
+set_octal(char *field, size_t len, uint64_t val)
+{
+	snprintf(field, len, "%0*llo", (int) len - 1, (unsigned long long) val);
+}
+
+static int
+write_header(const char *name, char type, mode_t mode, uint64_t size, time_t mtime)
+{
+	struct tar_header h;
+	const uint8_t *p = (const uint8_t *) &h;
+	unsigned int sum = 0;
+	size_t len = strlen(name);
+	size_t i;
+
+	/* GNU long name extension, like GNU tar */
+	if (len >= sizeof(h.name)) {
+		if (write_header("././@LongLink", 'L', 0644, len + 1, 0) ||
+		    write_all(name, len + 1) || pad_block())
+			return -1;
+	}
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.name, name, len < sizeof(h.name) ? len : sizeof(h.name));
+	set_octal(h.mode, sizeof(h.mode), mode & 07777);
+	set_octal(h.uid, sizeof(h.uid), 0);
+	set_octal(h.gid, sizeof(h.gid), 0);
+	set_octal(h.size, sizeof(h.size), size);
+	set_octal(h.mtime, sizeof(h.mtime), mtime);
+	h.typeflag = type;
+	memcpy(h.magic, "ustar  ", 8);
+
+	memset(h.chksum, ' ', sizeof(h.chksum));
+	for (i = 0; i < sizeof(h); i++)
+		sum += p[i];
+	snprintf(h.chksum, sizeof(h.chksum), "%06o", sum);
+	h.chksum[7] = ' ';
+
+	return write_all(&h, sizeof(h));
+}
+
+static int
+copy_rw(int fd, uint64_t size)
+{
+	char buf[64 * 1024];
+
+	while (size) {
+		size_t len = size < sizeof(buf) ? size : sizeof(buf);
+		ssize_t r = read(fd, buf, len);
+
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return -1;
+		if (write_all(buf, r))
+			return -1;
+		size -= r;
+	}
+
+	return 0;
+}
+
+static int
+copy_data(int fd, uint64_t size)
+{
+#if defined(__linux__) && defined(SYS_copy_file_range)
+	while (size) {
+		loff_t off_out = out_pos;
+		ssize_t r;
+
+		r = syscall(SYS_copy_file_range, fd, NULL, out_fd, &off_out,
+			    size > (1 << 30) ? (1 << 30) : size, 0);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			break;
+
+		size -= r;
+		out_pos += r;
+	}
+
+	if (!size)
+		return lseek(out_fd, out_pos, SEEK_SET) < 0 ? -1 : 0;
+
+	/* not supported for this pair of files, copy the rest by hand */
+	if (lseek(out_fd, out_pos, SEEK_SET) < 0)
+		return -1;
+#endif
+
+	return copy_rw(fd, size);
+}
+
+static void
+cleanup(void)
+{
+	if (out_fd >= 0)
+		close(out_fd);
+	if (tmp_name) {
+		unlink(tmp_name);
+		free(tmp_name);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option options[] = {
+		{ "board", required_argument, NULL, 'b' },
+		{ "kernel", required_argument, NULL, 'k' },
+		{ "rootfs", required_argument, NULL, 'r' },
+		{ NULL }
+	};
+	struct member members[3] = {
+		/* sorted by name, like tar --sort=name */
+		{ .name = "CONTROL", .fd = -1 },
+		{ .name = "kernel", .fd = -1 },
+		{ .name = "root", .fd = -1 },
+	};
+	const char *board = NULL, *kernel = NULL, *rootfs = NULL;
+	const char *epoch = getenv("SOURCE_DATE_EPOCH");
+	char *control = NULL, *name = NULL;
+	time_t now = time(NULL);
+	mode_t mask;
+	size_t i;
+	int ch, ret = 1;
+
+	while ((ch = getopt_long(argc, argv, "", options, NULL)) != -1) {
+		switch (ch) {
+		case 'b':
+			board = optarg;
+			break;
+		case 'k':
+			kernel = optarg;
+			break;
+		case 'r':
+			rootfs = optarg;
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	if (optind < argc)
+		outfile = argv[optind];
+
+	members[1].src = kernel && *kernel ? kernel : NULL;
+	members[2].src = rootfs && *rootfs ? rootfs : NULL;
+
+	/* without kernel and rootfs, the archive only holds CONTROL */
+	if (!board || !*board || !outfile ||
+	    ((members[1].src || members[2].src) &&
+	     (!kernel || access(kernel, R_OK)) && (!rootfs || access(rootfs, R_OK))))
+		return usage(argv[0]);
+
+	mask = umask(0);
+	umask(mask);
+
+	if (asprintf(&control, "BOARD=%s\n", board) < 0 ||
+	    asprintf(&tmp_name, "%s.XXXXXX", outfile) < 0)
+		goto out;
+
+	/* open all inputs first, the output may replace one of them */
+	for (i = 1; i < 3; i++) {
+		struct member *m = &members[i];
+
+		if (!m->src)
+			continue;
+
+		m->fd = open(m->src, O_RDONLY);
+		if (m->fd < 0 || fstat(m->fd, &m->st) || !S_ISREG(m->st.st_mode)) {
+			fprintf(stderr, "cannot read %s: %s\n", m->src,
+				m->fd < 0 ? strerror(errno) : "not a regular file");
+			if (m->fd >= 0)
+				close(m->fd);
+			m->fd = -1;
+		}
+	}
+
+	out_fd = mkstemp(tmp_name);
+	if (out_fd < 0) {
+		fprintf(stderr, "cannot create %s: %s\n", tmp_name, strerror(errno));
+		free(tmp_name);
+		tmp_name = NULL;
+		goto out;
+	}
+
+	if (epoch)
+		now = strtoll(epoch, NULL, 10);
+
+	if (asprintf(&name, "sysupgrade-%s/", board) < 0 ||
+	    write_header(name, '5', 0777 & ~mask, 0, now))
+		goto write_error;
+	printf("%s\n", name);
+
+	for (i = 0; i < 3; i++) {
+		struct member *m = &members[i];
+		char *path;
+		int err;
+
+		if (i && m->fd < 0)
+			continue;
+
+		if (asprintf(&path, "%s%s", name, m->name) < 0)
+			goto write_error;
+
+		if (!i)
+			err = write_header(path, '0', 0666 & ~mask, strlen(control), now) ||
+			      write_all(control, strlen(control));
+		else
+			err = write_header(path, '0', m->st.st_mode & ~mask & 0777,
+					   m->st.st_size, epoch ? now : m->st.st_mtime) ||
+			      copy_data(m->fd, m->st.st_size);
+
+		if (!err)
+			printf("%s\n", path);
+		free(path);
+
+		if (err || pad_block())
+			goto write_error;
+	}
+
+	/* end of archive marker, padded to a full record */
+	if (write_zero(2 * TAR_BLOCK) ||
+	    write_zero((TAR_RECORD - out_pos % TAR_RECORD) % TAR_RECORD))
+		goto write_error;
+
+	if (fchmod(out_fd, 0666 & ~mask) || close(out_fd)) {
+		out_fd = -1;
+		goto write_error;
+	}
+	out_fd = -1;
+
+	if (rename(tmp_name, outfile)) {
+		fprintf(stderr, "cannot rename %s to %s: %s\n", tmp_name, outfile, strerror(errno));
+		goto out;
+	}
+	free(tmp_name);
+	tmp_name = NULL;
+	ret = 0;
+	goto out;
+
+write_error:
+	fprintf(stderr, "cannot write %s: %s\n", outfile, strerror(errno));
+out:
+	for (i = 1; i < 3; i++)
+		if (members[i].fd >= 0)
+			close(members[i].fd);
+	free(control);
+	free(name);
+	cleanup();
+	return ret;
+}
@@ -1,5 +1,9 @@
 #!/bin/sh
 
+# prefer the native version, which writes the archive without temporary copies
+native="${STAGING_DIR_HOST:-$(dirname "$0")/../staging_dir/host}/bin/sysupgrade-tar"
+[ -x "$native" ] && exec "$native" "$@"
+
 board=""
 kernel=""
 rootfs=""
@@ -36,7 +40,8 @@ while [ "$1" ]; do
 	esac
 done
 
-if [ ! -n "$board" -o ! -r "$kernel" -a  ! -r "$rootfs" -o ! "$outfile" ]; then
+if [ ! -n "$board" -o ! "$outfile" ] ||
+   [ -n "$kernel$rootfs" -a ! -r "$kernel" -a ! -r "$rootfs" ]; then
 	echo "syntax: $0 [--board boardname] [--kernel kernelimage] [--rootfs rootfs] out"
 	exit 1
 fi
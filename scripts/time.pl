@@ -3,6 +3,7 @@
 use strict;
 use warnings;
 use Config;
+use Fcntl qw(:flock);
 
 if (@ARGV < 2) {
 	die "Usage: $0 <prefix> <command...>\n";
@@ -31,7 +32,76 @@ sub gettime {
 	return ($sec, $usec);
 }
 
+# Peak RSS in kB of all waited-for children, only available on Linux
+sub getmaxrss {
+	my $maxrss;
+
+	$^O eq 'linux' or return undef;
+	eval {
+		require 'syscall.ph';
+		my $ru = pack 'l!18', (0) x 18;
+		syscall(SYS_getrusage(), -1, $ru) == 0 or die;
+		$maxrss = (unpack 'l!18', $ru)[4];
+	};
+
+	return $maxrss;
+}
+
+# With BUILD_TRACE set, every step claims the lowest free job slot by
+# locking one of the files in $BUILD_TRACE.slots. The lock is released
+# when this process exits.
+sub getslot {
+	my $trace = shift;
+	my $dir = "$trace.slots";
+	my $slot = 0;
+
+	require File::Path;
+	File::Path::mkpath($dir);
+	while ($slot < 1024) {
+		open my $fh, '>>', "$dir/$slot" or return (undef, undef);
+		flock($fh, LOCK_EX | LOCK_NB) and return ($slot, $fh);
+		close $fh;
+		$slot++;
+	}
+
+	return (undef, undef);
+}
+
+# Append one JSON record per step to $BUILD_TRACE, it is converted and
+# summarized by scripts/build-trace.pl. The file only holds one build:
+# the first step that finishes with a new BUILD_TRACE_ID (set once per
+# top-level make, see include/toplevel.mk) truncates it.
+sub trace {
+	my ($trace, %rec) = @_;
+	my $id = $ENV{'BUILD_TRACE_ID'};
+
+	eval {
+		require JSON::PP;
+		my $line = JSON::PP->new->canonical->encode(\%rec);
+		my $lock;
+
+		if ($id) {
+			open $lock, '+>>', "$trace.slots/build" or die;
+			flock($lock, LOCK_EX) or die;
+			seek($lock, 0, 0);
+			my $last = <$lock>;
+			if (!defined($last) or $last ne $id) {
+				truncate($trace, 0);
+				truncate($lock, 0);
+				syswrite $lock, $id;
+			}
+		}
+
+		open my $fh, '>>', $trace or die;
+		syswrite $fh, "$line\n";
+		close $fh;
+		$lock and close $lock;
+	};
+}
+
 my ($prefix, @cmd) = @ARGV;
+my $trace = $ENV{'BUILD_TRACE'};
+my ($slot, $slot_fh) = $trace ? getslot($trace) : ();
 my ($sec, $usec) = gettime();
 my $pid = fork();
 
@@ -58,6 +128,24 @@ else {
 		$prefix, $cuser, $csystem,
 		($sec2 - $sec) + ($usec2 - $usec) / 1000000;
 
+	if ($trace) {
+		my $name = $prefix;
+		$name =~ s/^time: //;
+
+		trace($trace,
+			name => $name,
+			target => $ENV{'BUILD_TRACE_TARGET'} || $name,
+			deps => [ split /\s+/, $ENV{'BUILD_TRACE_DEPS'} || '' ],
+			start => $sec * 1000000 + $usec,
+			end => $sec2 * 1000000 + $usec2,
+			user => $cuser + 0,
+			sys => $csystem + 0,
+			maxrss => getmaxrss(),
+			slot => $slot,
+			exit => $exitcode,
+		);
+	}
+
 	$SIG{'INT'} = 'DEFAULT';
 	$SIG{'QUIT'} = 'DEFAULT';
 
@@ -1025,10 +1025,9 @@ $(eval $(call SingleProfile,ZyXELNAND,128k,NBG6716,nbg6716,NBG6716,ttyS0,115200,
 endif # ifeq ($(SUBTARGET),nand)
 
 define Image/Build/squashfs
-	cp $(KDIR)/root.squashfs $(KDIR)/root.squashfs-raw
-	cp $(KDIR)/root.squashfs $(KDIR)/root.squashfs-64k
-	$(STAGING_DIR_HOST)/bin/padjffs2 $(KDIR)/root.squashfs-64k 64
-	$(call prepare_generic_squashfs,$(KDIR)/root.squashfs)
+	mv $(KDIR)/root.squashfs $(KDIR)/root.squashfs-raw
+	$(STAGING_DIR_HOST)/bin/padjffs2 $(KDIR)/root.squashfs-raw -o $(KDIR)/root.squashfs-64k 64
+	$(call prepare_generic_squashfs,$(KDIR)/root.squashfs,$(KDIR)/root.squashfs-raw)
 	dd if=$(KDIR)/root.$(1) of=$(BIN_DIR)/$(IMG_PREFIX)-root.$(1) bs=128k conv=sync
 endef
 
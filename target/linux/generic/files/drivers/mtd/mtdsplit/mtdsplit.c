@@ -16,6 +16,13 @@
 #include <linux/init.h>
 #include <linux/kernel.h>
 #include <linux/magic.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/sizes.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/partitions.h>
 #include <linux/byteorder/generic.h>
@@ -23,6 +30,264 @@
 #include "mtdsplit.h"
 
 #define UBI_EC_MAGIC			0x55424923	/* UBI# */
+#define JFFS2_MAGIC			0x19852003
+#define UIMAGE_MAGIC			0x27051956
+#define TRX_MAGIC			0x30524448	/* HDR0 */
+#define FIT_MAGIC			0xd00dfeed
+#define SEAMA_MAGIC			0x5ea3a417
+#define WRGG03_MAGIC			0x20080321
+#define WRG_MAGIC			0x20040220
+#define WRGG_MAGIC_OFFSET		32
+
+/*
+ * The parsers probe the same erase block boundaries over and over (once per
+ * parser and once more for the rootfs lookup), which is slow on SPI flash.
+ * The first read of a block fetches a header window that is big enough for
+ * every known header and remembers which magics it contains; later reads of
+ * that window are served from memory. The cache only lives during boot, as
+ * the flash contents may change once userspace is running.
+ */
+#define MTDSPLIT_SCAN_WINDOW		160	/* WRGG03 header */
+
+#define MTDSPLIT_ROOTFS_MIN_STRIDE	SZ_64K
+#define MTDSPLIT_ROOTFS_MAX_STRIDE	SZ_1M
+
+struct mtdsplit_scan_block {
+	u8 *window;
+	u16 len;
+	u16 magic;
+};
+
+struct mtdsplit_scan {
+	struct list_head list;
+	struct mtd_info *mtd;
+	uint64_t size;
+	uint32_t erasesize;
+	unsigned int nr_blocks;
+	unsigned int reads;
+	unsigned int hits;
+	struct mtdsplit_scan_block *blocks;
+};
+
+static LIST_HEAD(mtdsplit_scans);
+static DEFINE_MUTEX(mtdsplit_scan_lock);
+static bool mtdsplit_scan_enabled = true;
+
+static unsigned int mtdsplit_classify(const u8 *buf, size_t len)
+{
+	unsigned int magic = 0;
+	u32 word;
+
+	if (len < sizeof(word))
+		return 0;
+
+	memcpy(&word, buf, sizeof(word));
+
+	if (le32_to_cpu(word) == SQUASHFS_MAGIC)
+		magic |= MTDSPLIT_MAGIC_SQUASHFS;
+	if (word == JFFS2_MAGIC)
+		magic |= MTDSPLIT_MAGIC_JFFS2;
+	if (be32_to_cpu(word) == UBI_EC_MAGIC)
+		magic |= MTDSPLIT_MAGIC_UBI;
+	if (be32_to_cpu(word) == UIMAGE_MAGIC)
+		magic |= MTDSPLIT_MAGIC_UIMAGE;
+	if (le32_to_cpu(word) == TRX_MAGIC)
+		magic |= MTDSPLIT_MAGIC_TRX;
+	if (be32_to_cpu(word) == FIT_MAGIC)
+		magic |= MTDSPLIT_MAGIC_FIT;
+	if (be32_to_cpu(word) == SEAMA_MAGIC)
+		magic |= MTDSPLIT_MAGIC_SEAMA;
+
+	if (len >= WRGG_MAGIC_OFFSET + sizeof(word)) {
+		memcpy(&word, buf + WRGG_MAGIC_OFFSET, sizeof(word));
+		if (le32_to_cpu(word) == WRGG03_MAGIC ||
+		    le32_to_cpu(word) == WRG_MAGIC)
+			magic |= MTDSPLIT_MAGIC_WRGG;
+	}
+
+	return magic;
+}
+
+static int mtdsplit_read(struct mtd_info *mtd, size_t offset, void *buf,
+			 size_t len)
+{
+	size_t retlen;
+	int ret;
+
+	ret = mtd_read(mtd, offset, len, &retlen, buf);
+	if (ret)
+		return ret;
+
+	if (retlen != len)
+		return -EIO;
+
+	return 0;
+}
+
+static struct mtdsplit_scan *mtdsplit_scan_get(struct mtd_info *mtd)
+{
+	struct mtdsplit_scan *scan;
+
+	if (!mtdsplit_scan_enabled)
+		return NULL;
+
+	list_for_each_entry(scan, &mtdsplit_scans, list) {
+		if (scan->mtd == mtd && scan->size == mtd->size &&
+		    scan->erasesize == mtd->erasesize)
+			return scan;
+	}
+
+	scan = kzalloc(sizeof(*scan), GFP_KERNEL);
+	if (!scan)
+		return NULL;
+
+	scan->mtd = mtd;
+	scan->size = mtd->size;
+	scan->erasesize = mtd->erasesize;
+	scan->nr_blocks = mtd_div_by_eb(mtd->size, mtd);
+	scan->blocks = vzalloc(scan->nr_blocks * sizeof(*scan->blocks));
+	if (!scan->blocks) {
+		kfree(scan);
+		return NULL;
+	}
+
+	list_add_tail(&scan->list, &mtdsplit_scans);
+
+	return scan;
+}
+
+/*
+ * Returns the cached header window of the erase block starting at @offset,
+ * reading it from flash on first use. NULL means that the cache can not be
+ * used for this block and the caller has to read the flash directly.
+ */
+static struct mtdsplit_scan_block *
+mtdsplit_scan_block(struct mtd_info *mtd, size_t offset)
+{
+	struct mtdsplit_scan_block *blk;
+	struct mtdsplit_scan *scan;
+	unsigned int index;
+	size_t len;
+	int ret;
+
+	if (!mtd->erasesize || mtd_mod_by_eb(offset, mtd))
+		return NULL;
+
+	scan = mtdsplit_scan_get(mtd);
+	if (!scan)
+		return NULL;
+
+	index = mtd_div_by_eb(offset, mtd);
+	if (index >= scan->nr_blocks)
+		return NULL;
+
+	blk = &scan->blocks[index];
+	scan->reads++;
+	if (blk->window) {
+		scan->hits++;
+		return blk;
+	}
+
+	len = min_t(uint64_t, MTDSPLIT_SCAN_WINDOW, mtd->size - offset);
+	blk->window = kmalloc(MTDSPLIT_SCAN_WINDOW, GFP_KERNEL);
+	if (!blk->window)
+		return NULL;
+
+	ret = mtdsplit_read(mtd, offset, blk->window, len);
+	if (ret) {
+		kfree(blk->window);
+		blk->window = NULL;
+		return ERR_PTR(ret);
+	}
+
+	blk->len = len;
+	blk->magic = mtdsplit_classify(blk->window, len);
+
+	return blk;
+}
+
+int mtdsplit_scan_read(struct mtd_info *mtd, size_t offset, void *buf,
+		       size_t len)
+{
+	struct mtdsplit_scan_block *blk;
+	int ret = 0;
+
+	if (len > MTDSPLIT_SCAN_WINDOW)
+		return mtdsplit_read(mtd, offset, buf, len);
+
+	mutex_lock(&mtdsplit_scan_lock);
+	blk = mtdsplit_scan_block(mtd, offset);
+	if (IS_ERR(blk))
+		ret = PTR_ERR(blk);
+	else if (blk && len > blk->len)
+		ret = -EIO;
+	else if (blk)
+		memcpy(buf, blk->window, len);
+	mutex_unlock(&mtdsplit_scan_lock);
+
+	if (!blk)
+		return mtdsplit_read(mtd, offset, buf, len);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(mtdsplit_scan_read);
+
+int mtdsplit_scan_magic(struct mtd_info *mtd, size_t offset,
+			unsigned int *magic)
+{
+	struct mtdsplit_scan_block *blk;
+	u32 word;
+	int ret = 0;
+
+	mutex_lock(&mtdsplit_scan_lock);
+	blk = mtdsplit_scan_block(mtd, offset);
+	if (IS_ERR(blk))
+		ret = PTR_ERR(blk);
+	else if (blk)
+		*magic = blk->magic;
+	mutex_unlock(&mtdsplit_scan_lock);
+
+	if (blk)
+		return ret;
+
+	if (offset + sizeof(word) > mtd->size)
+		return -EINVAL;
+
+	/* uncached, only the leading magic is needed to tell the rootfs type */
+	ret = mtdsplit_read(mtd, offset, &word, sizeof(word));
+	if (ret)
+		return ret;
+
+	*magic = mtdsplit_classify((u8 *) &word, sizeof(word));
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(mtdsplit_scan_magic);
+
+static int __init mtdsplit_scan_release(void)
+{
+	struct mtdsplit_scan *scan, *tmp;
+	unsigned int i;
+
+	mutex_lock(&mtdsplit_scan_lock);
+	mtdsplit_scan_enabled = false;
+
+	list_for_each_entry_safe(scan, tmp, &mtdsplit_scans, list) {
+		pr_debug("\"%s\": %u header reads, %u served from cache\n",
+			 scan->mtd->name, scan->reads, scan->hits);
+
+		for (i = 0; i < scan->nr_blocks; i++)
+			kfree(scan->blocks[i].window);
+
+		list_del(&scan->list);
+		vfree(scan->blocks);
+		kfree(scan);
+	}
+	mutex_unlock(&mtdsplit_scan_lock);
+
+	return 0;
+}
+late_initcall_sync(mtdsplit_scan_release);
 
 struct squashfs_super_block {
 	__le32 s_magic;
@@ -38,8 +303,8 @@ int mtd_get_squashfs_len(struct mtd_info *master,
 	size_t retlen;
 	int err;
 
-	err = mtd_read(master, offset, sizeof(sb), &retlen, (void *)&sb);
-	if (err || (retlen != sizeof(sb))) {
+	err = mtdsplit_scan_read(master, offset, &sb, sizeof(sb));
+	if (err) {
 		pr_alert("error occured while reading from \"%s\"\n",
 			 master->name);
 		return -EIO;
@@ -75,27 +340,22 @@ static ssize_t mtd_next_eb(struct mtd_info *mtd, size_t offset)
 int mtd_check_rootfs_magic(struct mtd_info *mtd, size_t offset,
 			   enum mtdsplit_part_type *type)
 {
-	u32 magic;
-	size_t retlen;
+	unsigned int magic;
 	int ret;
 
-	ret = mtd_read(mtd, offset, sizeof(magic), &retlen,
-		       (unsigned char *) &magic);
+	ret = mtdsplit_scan_magic(mtd, offset, &magic);
 	if (ret)
 		return ret;
 
-	if (retlen != sizeof(magic))
-		return -EIO;
-
-	if (le32_to_cpu(magic) == SQUASHFS_MAGIC) {
+	if (magic & MTDSPLIT_MAGIC_SQUASHFS) {
 		if (type)
 			*type = MTDSPLIT_PART_TYPE_SQUASHFS;
 		return 0;
-	} else if (magic == 0x19852003) {
+	} else if (magic & MTDSPLIT_MAGIC_JFFS2) {
 		if (type)
 			*type = MTDSPLIT_PART_TYPE_JFFS2;
 		return 0;
-	} else if (be32_to_cpu(magic) == UBI_EC_MAGIC) {
+	} else if (magic & MTDSPLIT_MAGIC_UBI) {
 		if (type)
 			*type = MTDSPLIT_PART_TYPE_UBI;
 		return 0;
@@ -128,3 +388,154 @@ int mtd_find_rootfs_from(struct mtd_info *mtd,
 }
 EXPORT_SYMBOL_GPL(mtd_find_rootfs_from);
 
+struct mtd_rootfs_probes {
+	size_t from;
+	size_t limit;
+	size_t next;		/* linear scan offsets before it have no rootfs */
+	size_t missed;		/* last offset probed without a rootfs */
+	unsigned int count;
+};
+
+static bool mtd_rootfs_probe(struct mtd_info *mtd, struct mtd_rootfs_probes *p,
+			     size_t offset, enum mtdsplit_part_type *type)
+{
+	/* only probe offsets the linear scan would look at as well */
+	if (offset < p->from || offset >= p->limit)
+		return false;
+
+	if (offset != p->from && mtd_mod_by_eb(offset, mtd))
+		return false;
+
+	p->count++;
+
+	if (!mtd_check_rootfs_magic(mtd, offset, type))
+		return true;
+
+	p->missed = offset;
+	if (offset == p->next)
+		p->next = mtd_next_eb(mtd, offset);
+
+	return false;
+}
+
+static int mtd_find_rootfs_hint(struct mtd_info *mtd,
+				struct mtd_rootfs_probes *p, size_t hint,
+				size_t *ret_offset,
+				enum mtdsplit_part_type *type)
+{
+	size_t stride;
+
+	if (mtd_rootfs_probe(mtd, p, hint, type))
+		goto found;
+
+	hint = mtd_roundup_to_eb(hint, mtd);
+	if (mtd_rootfs_probe(mtd, p, hint, type))
+		goto found;
+
+	/*
+	 * Images are usually padded to a power of two block size that is
+	 * larger than the erase size of 4KiB sector flashes. On flashes with
+	 * larger erase blocks the linear scan gets there just as fast.
+	 */
+	if (mtd->erasesize >= MTDSPLIT_ROOTFS_MIN_STRIDE)
+		return -ENODEV;
+
+	for (stride = MTDSPLIT_ROOTFS_MIN_STRIDE;
+	     stride <= MTDSPLIT_ROOTFS_MAX_STRIDE; stride <<= 1) {
+		/* offsets aligned to it have been probed before */
+		if (IS_ALIGNED(hint, stride))
+			continue;
+
+		hint = ALIGN(hint, stride);
+		if (mtd_rootfs_probe(mtd, p, hint, type))
+			goto found;
+	}
+
+	return -ENODEV;
+
+found:
+	*ret_offset = hint;
+	return 0;
+}
+
+/*
+ * A hinted hit is only taken where the linear scan could not have found an
+ * earlier rootfs. JFFS2 and UBI carry their magic on every erase block, so
+ * a stride may land inside of them; they are only taken at the hint itself
+ * or the erase block following it. A squashfs carries its magic only at its
+ * start, so it is enough that the block the linear scan would probe before
+ * it does not belong to a rootfs.
+ */
+static bool mtd_rootfs_hint_ok(struct mtd_info *mtd,
+			       struct mtd_rootfs_probes *p, size_t hint,
+			       size_t hit, enum mtdsplit_part_type type)
+{
+	size_t prev;
+
+	if (hit == p->next)
+		return true;
+
+	if (type != MTDSPLIT_PART_TYPE_SQUASHFS &&
+	    hit > mtd_roundup_to_eb(hint, mtd))
+		return false;
+
+	prev = max_t(size_t, mtd_rounddown_to_eb(hit - 1, mtd), p->from);
+	if (prev < p->next || prev == p->missed)
+		return true;
+
+	return !mtd_rootfs_probe(mtd, p, prev, NULL);
+}
+
+/*
+ * Like mtd_find_rootfs_from(), but first tries the offsets a rootfs usually
+ * starts at if the kernel ends at @hint, which should come from the kernel
+ * image header. The linear scan is only done if none of them has a rootfs,
+ * and it skips the offsets that have been probed already.
+ */
+int mtd_find_rootfs_hinted(struct mtd_info *mtd,
+			   size_t from,
+			   size_t limit,
+			   size_t hint,
+			   size_t *ret_offset,
+			   enum mtdsplit_part_type *type)
+{
+	enum mtdsplit_part_type hit_type = MTDSPLIT_PART_TYPE_UNK;
+	struct mtd_rootfs_probes p = {
+		.from = from,
+		.limit = limit,
+		.next = from,
+		.missed = limit,
+	};
+	unsigned int linear;
+	ktime_t start;
+	s64 elapsed;
+	size_t offset;
+	int err;
+
+	start = ktime_get();
+
+	hint = max(hint, from);
+	err = mtd_find_rootfs_hint(mtd, &p, hint, &offset, &hit_type);
+	if (err || !mtd_rootfs_hint_ok(mtd, &p, hint, offset, hit_type)) {
+		pr_debug("no rootfs at the hinted offsets in \"%s\", scanning from 0x%zx\n",
+			 mtd->name, p.next);
+		return mtd_find_rootfs_from(mtd, p.next, limit, ret_offset,
+					    type);
+	}
+
+	elapsed = ktime_us_delta(ktime_get(), start);
+	linear = mtd_div_by_eb(offset, mtd) - mtd_div_by_eb(from, mtd) + 1;
+	if (p.count < linear)
+		pr_debug("rootfs found in \"%s\" at 0x%zx after %u probes instead of %u, about %lld us saved\n",
+			 mtd->name, offset, p.count, linear,
+			 div_s64(elapsed * (linear - p.count), p.count));
+	else
+		pr_debug("rootfs found in \"%s\" at 0x%zx after %u probes\n",
+			 mtd->name, offset, p.count);
+
+	if (type)
+		*type = hit_type;
+	*ret_offset = offset;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(mtd_find_rootfs_hinted);
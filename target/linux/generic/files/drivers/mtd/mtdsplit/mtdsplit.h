@@ -26,7 +26,22 @@ enum mtdsplit_part_type {
 	MTDSPLIT_PART_TYPE_UBI,
 };
 
+#define MTDSPLIT_MAGIC_SQUASHFS	BIT(0)
+#define MTDSPLIT_MAGIC_JFFS2	BIT(1)
+#define MTDSPLIT_MAGIC_UBI	BIT(2)
+#define MTDSPLIT_MAGIC_UIMAGE	BIT(3)
+#define MTDSPLIT_MAGIC_TRX	BIT(4)
+#define MTDSPLIT_MAGIC_FIT	BIT(5)
+#define MTDSPLIT_MAGIC_SEAMA	BIT(6)
+#define MTDSPLIT_MAGIC_WRGG	BIT(7)
+
 #ifdef CONFIG_MTD_SPLIT
+int mtdsplit_scan_read(struct mtd_info *mtd, size_t offset, void *buf,
+		       size_t len);
+
+int mtdsplit_scan_magic(struct mtd_info *mtd, size_t offset,
+			unsigned int *magic);
+
 int mtd_get_squashfs_len(struct mtd_info *master,
 			 size_t offset,
 			 size_t *squashfs_len);
@@ -40,7 +55,26 @@ int mtd_find_rootfs_from(struct mtd_info *mtd,
 			 size_t *ret_offset,
 			 enum mtdsplit_part_type *type);
 
+int mtd_find_rootfs_hinted(struct mtd_info *mtd,
+			   size_t from,
+			   size_t limit,
+			   size_t hint,
+			   size_t *ret_offset,
+			   enum mtdsplit_part_type *type);
+
 #else
+static inline int mtdsplit_scan_read(struct mtd_info *mtd, size_t offset,
+				     void *buf, size_t len)
+{
+	return -ENODEV;
+}
+
+static inline int mtdsplit_scan_magic(struct mtd_info *mtd, size_t offset,
+				      unsigned int *magic)
+{
+	return -ENODEV;
+}
+
 static inline int mtd_get_squashfs_len(struct mtd_info *master,
 				       size_t offset,
 				       size_t *squashfs_len)
@@ -62,6 +96,16 @@ static inline int mtd_find_rootfs_from(struct mtd_info *mtd,
 {
 	return -ENODEV;
 }
+
+static inline int mtd_find_rootfs_hinted(struct mtd_info *mtd,
+					 size_t from,
+					 size_t limit,
+					 size_t hint,
+					 size_t *ret_offset,
+					 enum mtdsplit_part_type *type)
+{
+	return -ENODEV;
+}
 #endif /* CONFIG_MTD_SPLIT */
 
 #endif /* _MTDSPLIT_H */
@@ -50,7 +50,7 @@ mtdsplit_fit_parse(struct mtd_info *mtd,
 	           struct mtd_part_parser_data *data)
 {
 	struct fdt_header hdr;
-	size_t hdr_len, retlen;
+	size_t hdr_len;
 	size_t offset;
 	size_t fit_offset, fit_size;
 	size_t rootfs_offset, rootfs_size;
@@ -61,18 +61,13 @@ mtdsplit_fit_parse(struct mtd_info *mtd,
 
 	/* Parse the MTD device & search for the FIT image location */
 	for(offset = 0; offset < mtd->size; offset += mtd->erasesize) {
-		ret = mtd_read(mtd, 0, hdr_len, &retlen, (void*) &hdr);
+		ret = mtdsplit_scan_read(mtd, 0, &hdr, hdr_len);
 		if (ret) {
 			pr_err("read error in \"%s\" at offset 0x%llx\n",
 			       mtd->name, (unsigned long long) offset);
 			return ret;
 		}
 
-		if (retlen != hdr_len) {
-			pr_err("short read in \"%s\"\n", mtd->name);
-			return -EIO;
-		}
-
 		/* Check the magic - see if this is a FIT image */
 		if (be32_to_cpu(hdr.magic) != OF_DT_HEADER) {
 			pr_debug("no valid FIT image found in \"%s\" at offset %llx\n",
@@ -93,9 +88,9 @@ mtdsplit_fit_parse(struct mtd_info *mtd,
 		return -ENODEV;
 	}
 
-	/* Search for the rootfs partition after the FIT image */
-	ret = mtd_find_rootfs_from(mtd, fit_offset + fit_size, mtd->size,
-				   &rootfs_offset, NULL);
+	/* Search for the rootfs partition after the FIT image (totalsize) */
+	ret = mtd_find_rootfs_hinted(mtd, fit_offset + fit_size, mtd->size,
+				     fit_offset + fit_size, &rootfs_offset, NULL);
 	if (ret) {
 		pr_info("no rootfs found after FIT image in \"%s\"\n",
 			mtd->name);
@@ -156,9 +156,11 @@ static int __mtdsplit_parse_jimage(struct mtd_info *master,
 		jimage_part = 0;
 		rf_part = 1;
 
-		/* find the roots after the jImage */
-		ret = mtd_find_rootfs_from(master, jimage_offset + jimage_size,
-					   master->size, &rootfs_offset, &type);
+		/* find the roots after the jImage, its header gives the size */
+		ret = mtd_find_rootfs_hinted(master, jimage_offset + jimage_size,
+					     master->size,
+					     jimage_offset + jimage_size,
+					     &rootfs_offset, &type);
 		if (ret) {
 			pr_debug("no rootfs after jImage in \"%s\"\n",
 				 master->name);
@@ -34,20 +34,17 @@ static int mtdsplit_parse_seama(struct mtd_info *master,
 				struct mtd_part_parser_data *data)
 {
 	struct seama_header hdr;
-	size_t hdr_len, retlen, kernel_ent_size;
+	size_t hdr_len, kernel_ent_size;
 	size_t rootfs_offset;
 	struct mtd_partition *parts;
 	enum mtdsplit_part_type type;
 	int err;
 
 	hdr_len = sizeof(hdr);
-	err = mtd_read(master, 0, hdr_len, &retlen, (void *) &hdr);
+	err = mtdsplit_scan_read(master, 0, &hdr, hdr_len);
 	if (err)
 		return err;
 
-	if (retlen != hdr_len)
-		return -EIO;
-
 	/* sanity checks */
 	if (be32_to_cpu(hdr.magic) != SEAMA_MAGIC)
 		return -EINVAL;
@@ -58,20 +58,14 @@ static int
 read_uimage_header(struct mtd_info *mtd, size_t offset, u_char *buf,
 		   size_t header_len)
 {
-	size_t retlen;
 	int ret;
 
-	ret = mtd_read(mtd, offset, header_len, &retlen, buf);
+	ret = mtdsplit_scan_read(mtd, offset, buf, header_len);
 	if (ret) {
 		pr_debug("read error in \"%s\"\n", mtd->name);
 		return ret;
 	}
 
-	if (retlen != header_len) {
-		pr_debug("short read in \"%s\"\n", mtd->name);
-		return -EIO;
-	}
-
 	return 0;
 }
 
@@ -148,9 +142,11 @@ static int __mtdsplit_parse_uimage(struct mtd_info *master,
 		uimage_part = 0;
 		rf_part = 1;
 
-		/* find the roots after the uImage */
-		ret = mtd_find_rootfs_from(master, uimage_offset + uimage_size,
-					   master->size, &rootfs_offset, &type);
+		/* find the roots after the uImage, ih_size tells where to look */
+		ret = mtd_find_rootfs_hinted(master, uimage_offset + uimage_size,
+					     master->size,
+					     uimage_offset + uimage_size,
+					     &rootfs_offset, &type);
 		if (ret) {
 			pr_debug("no rootfs after uImage in \"%s\"\n",
 				 master->name);
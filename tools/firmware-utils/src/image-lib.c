@@ -0,0 +1,411 @@
+/*
+ * Helpers for writing firmware images
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
+
+#include "image-lib.h"
+
+#define IMAGE_CHUNK_LEN	(1024 * 1024)
+#define IMAGE_PAD_LEN	(64 * 1024)
+
+static int write_raw(int fd, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+
+	while (len) {
+		ssize_t n = write(fd, p, len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static void hash_update(struct image_out *out, const void *buf, size_t len)
+{
+	int i;
+
+	for (i = 0; i < out->nr_hashes; i++)
+		out->hashes[i].update(out->hashes[i].ctx, buf, len);
+}
+
+int image_open(struct image_out *out, const char *name)
+{
+	memset(out, 0, sizeof(*out));
+
+	out->name = name;
+	out->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (out->fd < 0)
+		return -1;
+
+	return 0;
+}
+
+int image_close(struct image_out *out)
+{
+	int ret;
+
+	ret = close(out->fd);
+	out->fd = -1;
+
+	return ret;
+}
+
+/* Closes and removes an incomplete output file */
+void image_abort(struct image_out *out)
+{
+	int save = errno;
+
+	if (out->fd >= 0)
+		close(out->fd);
+	out->fd = -1;
+	unlink(out->name);
+
+	errno = save;
+}
+
+int image_hash_add(struct image_out *out, image_hash_fn update, void *ctx)
+{
+	if (out->nr_hashes >= IMAGE_MAX_HASHES) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	out->hashes[out->nr_hashes].update = update;
+	out->hashes[out->nr_hashes].ctx = ctx;
+	out->nr_hashes++;
+
+	return 0;
+}
+
+void image_hash_remove(struct image_out *out, void *ctx)
+{
+	int i;
+
+	for (i = 0; i < out->nr_hashes; i++) {
+		if (out->hashes[i].ctx != ctx)
+			continue;
+
+		out->nr_hashes--;
+		memmove(&out->hashes[i], &out->hashes[i + 1],
+			(out->nr_hashes - i) * sizeof(out->hashes[0]));
+		return;
+	}
+}
+
+int image_write(struct image_out *out, const void *buf, size_t len)
+{
+	hash_update(out, buf, len);
+
+	if (write_raw(out->fd, buf, len))
+		return -1;
+
+	out->pos += len;
+
+	return 0;
+}
+
+int image_pad(struct image_out *out, uint8_t c, size_t len)
+{
+	static uint8_t buf[IMAGE_PAD_LEN];
+	static int fill = -1;
+
+	if (fill != c) {
+		memset(buf, c, sizeof(buf));
+		fill = c;
+	}
+
+	while (len) {
+		size_t n = len < sizeof(buf) ? len : sizeof(buf);
+
+		if (image_write(out, buf, n))
+			return -1;
+
+		len -= n;
+	}
+
+	return 0;
+}
+
+int image_pad_to(struct image_out *out, uint8_t c, uint64_t offset)
+{
+	if (offset < out->pos) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return image_pad(out, c, offset - out->pos);
+}
+
+/* Moves the output offset forward without writing, leaving a hole */
+int image_skip_to(struct image_out *out, uint64_t offset)
+{
+	if (offset < out->pos || out->nr_hashes) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (offset == out->pos)
+		return 0;
+
+	if (ftruncate(out->fd, offset) || lseek(out->fd, offset, SEEK_SET) < 0)
+		return -1;
+
+	out->pos = offset;
+
+	return 0;
+}
+
+static bool is_zero(const uint8_t *buf, size_t len)
+{
+	return !len || (!buf[0] && !memcmp(buf, buf + 1, len - 1));
+}
+
+/*
+ * Copies len bytes from fd starting at in_off without looking at them, in
+ * the kernel if possible. With sparse set, all-zero chunks of the fallback
+ * copy are skipped instead of written.
+ */
+static int copy_plain(struct image_out *out, int fd, off_t in_off, size_t len,
+		      bool sparse)
+{
+	static uint8_t buf[IMAGE_CHUNK_LEN];
+	ssize_t n;
+
+#if defined(__linux__) && defined(SYS_copy_file_range)
+	while (len) {
+		n = syscall(SYS_copy_file_range, fd, &in_off, out->fd, NULL,
+			    len, 0);
+		if (n <= 0)
+			break;
+
+		out->pos += n;
+		len -= n;
+	}
+#endif
+
+#ifdef __linux__
+	while (len) {
+		n = sendfile(out->fd, fd, &in_off, len);
+		if (n <= 0)
+			break;
+
+		out->pos += n;
+		len -= n;
+	}
+#endif
+
+	while (len) {
+		n = pread(fd, buf, len < sizeof(buf) ? len : sizeof(buf),
+			  in_off);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			if (!n)
+				errno = EIO;
+			return -1;
+		}
+
+		if (sparse && is_zero(buf, n)) {
+			if (image_skip_to(out, out->pos + n))
+				return -1;
+		} else {
+			if (write_raw(out->fd, buf, n))
+				return -1;
+			out->pos += n;
+		}
+
+		in_off += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* Copies len bytes from fd, keeping the holes of the input file as holes */
+static int copy_sparse(struct image_out *out, int fd, size_t len)
+{
+	uint64_t base = out->pos;
+	off_t start = 0, data, hole;
+
+	while ((size_t) start < len) {
+		data = start;
+		hole = len;
+
+#ifdef SEEK_HOLE
+		data = lseek(fd, start, SEEK_DATA);
+		if (data < 0 && errno == ENXIO) {
+			/* nothing but a hole left */
+			data = len;
+		} else if (data < 0) {
+			/* not supported, copy everything */
+			data = start;
+		} else {
+			hole = lseek(fd, data, SEEK_HOLE);
+			if (hole < 0 || (size_t) hole > len)
+				hole = len;
+		}
+#endif
+
+		if ((size_t) data > len)
+			data = len;
+
+		if (image_skip_to(out, base + data))
+			return -1;
+
+		if (data < hole && copy_plain(out, fd, data, hole - data, true))
+			return -1;
+
+		start = hole;
+	}
+
+	return image_skip_to(out, base + len);
+}
+
+/* Copies len bytes from fd, feeding them to the registered checksums */
+static int copy_hashed(struct image_out *out, int fd, size_t len)
+{
+	static uint8_t buf[IMAGE_CHUNK_LEN];
+	const uint8_t *map;
+	size_t done;
+	ssize_t n;
+
+	map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map != MAP_FAILED) {
+		int ret = 0;
+
+		for (done = 0; done < len && !ret; done += n) {
+			n = len - done;
+			if (n > IMAGE_CHUNK_LEN)
+				n = IMAGE_CHUNK_LEN;
+
+			ret = image_write(out, map + done, n);
+		}
+
+		munmap((void *) map, len);
+
+		return ret;
+	}
+
+	for (done = 0; done < len; done += n) {
+		n = read(fd, buf, len - done < sizeof(buf) ? len - done : sizeof(buf));
+		if (n < 0 && errno == EINTR) {
+			n = 0;
+			continue;
+		}
+		if (n <= 0) {
+			if (!n)
+				errno = EIO;
+			return -1;
+		}
+
+		if (image_write(out, buf, n))
+			return -1;
+	}
+
+	return 0;
+}
+
+static ssize_t append_file(struct image_out *out, const char *name,
+			   bool sparse)
+{
+	struct stat st;
+	int fd, ret;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+
+	if (!st.st_size)
+		ret = 0;
+	else if (out->nr_hashes)
+		ret = copy_hashed(out, fd, st.st_size);
+	else if (sparse)
+		ret = copy_sparse(out, fd, st.st_size);
+	else
+		ret = copy_plain(out, fd, 0, st.st_size, false);
+
+	if (ret) {
+		int save = errno;
+
+		close(fd);
+		errno = save;
+		return -1;
+	}
+
+	close(fd);
+
+	return st.st_size;
+}
+
+/* Appends the contents of a file, returns the number of bytes copied */
+ssize_t image_append_file(struct image_out *out, const char *name)
+{
+	return append_file(out, name, false);
+}
+
+/*
+ * Like image_append_file(), but leaves holes in the output where the input
+ * has holes or all-zero chunks. Only valid on a freshly created output file.
+ */
+ssize_t image_append_sparse(struct image_out *out, const char *name)
+{
+	return append_file(out, name, true);
+}
+
+/* Overwrites already written data, e.g. to fill in a checksum in the header */
+int image_pwrite(struct image_out *out, const void *buf, size_t len,
+		 uint64_t offset)
+{
+	ssize_t n;
+
+	if (offset + len > out->pos) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	n = pwrite(out->fd, buf, len, offset);
+	if (n < 0)
+		return -1;
+
+	if ((size_t) n != len) {
+		errno = EIO;
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,61 @@
+/*
+ * Helpers for writing firmware images
+ *
+ * Most image formats are a header followed by one or more payloads that are
+ * aligned or padded in some way, with a checksum over parts of the image
+ * stored in the header. These helpers write such images front to back,
+ * feeding every byte to the registered checksum functions as it is written,
+ * so the output never has to be read back. Payloads are copied with
+ * copy_file_range()/sendfile() when nothing needs to see their contents.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ *
+ */
+
+#ifndef image_lib_h
+#define image_lib_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define IMAGE_MAX_HASHES	4
+
+typedef void (*image_hash_fn)(void *ctx, const void *buf, size_t len);
+
+struct image_hash {
+	image_hash_fn	update;
+	void		*ctx;
+};
+
+struct image_out {
+	int		fd;
+	const char	*name;
+	uint64_t	pos;		/* current output offset */
+	int		nr_hashes;
+	struct image_hash hashes[IMAGE_MAX_HASHES];
+};
+
+/*
+ * All functions return 0 (or the number of bytes copied) on success and -1
+ * with errno set on failure.
+ */
+int image_open(struct image_out *out, const char *name);
+int image_close(struct image_out *out);
+void image_abort(struct image_out *out);
+
+int image_hash_add(struct image_out *out, image_hash_fn update, void *ctx);
+void image_hash_remove(struct image_out *out, void *ctx);
+
+int image_write(struct image_out *out, const void *buf, size_t len);
+int image_pad(struct image_out *out, uint8_t c, size_t len);
+int image_pad_to(struct image_out *out, uint8_t c, uint64_t offset);
+int image_skip_to(struct image_out *out, uint64_t offset);
+ssize_t image_append_file(struct image_out *out, const char *name);
+ssize_t image_append_sparse(struct image_out *out, const char *name);
+int image_pwrite(struct image_out *out, const void *buf, size_t len,
+		 uint64_t offset);
+
+#endif /* image_lib_h */
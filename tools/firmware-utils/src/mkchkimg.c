@@ -27,7 +27,7 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 
-#define BUF_LEN (2048)
+#include "image-lib.h"
 
 #define MAX_BOARD_ID_LEN (64)
 
@@ -124,6 +124,12 @@ netgear_checksum_fini (struct ngr_checksum * c)
 	return checksum;
 }
 
+static void
+netgear_checksum_update (void * ctx, const void * buf, size_t len)
+{
+	netgear_checksum_add (ctx, (unsigned char *)buf, len);
+}
+
 static void
 print_help (void)
 {
@@ -135,13 +141,12 @@ main (int argc, char * argv[])
 {
 	int opt;
 	char * ptr;
-	size_t len;
+	ssize_t len;
 	size_t header_len;
 	struct chk_header * hdr;
 	struct ngr_checksum chk_part, chk_whole;
-	char buf[BUF_LEN];
+	struct image_out out;
 	char * output_file, * kern_file, * fs_file;
-	FILE * out_fp, * kern_fp, * fs_fp;
 	char * board_id;
 	unsigned long region;
 
@@ -151,7 +156,6 @@ main (int argc, char * argv[])
 	output_file = NULL;
 	kern_file = NULL;
 	fs_file = NULL;
-	fs_fp = NULL;
 
 	while ((opt = getopt (argc, argv, ":b:r:k:f:o:h")) != -1) {
 		switch (opt) {
@@ -221,36 +225,30 @@ main (int argc, char * argv[])
 	}
 	message ("Netgear CHK writer - v0.1");
 
-	/* Open the input file */
-	kern_fp = fopen (kern_file, "r");
-	if (!kern_fp) {
+	/* Check the input files before creating the output */
+	if (access (kern_file, R_OK)) {
 		fatal_error (errno, "Cannot open %s", kern_file);
 	}
-
-	/* Open the fs file, if specified */
-	if (fs_file) {
-		fs_fp = fopen (fs_file, "r");
-		if (!fs_fp) {
-			fatal_error (errno, "Cannot open %s", fs_file);
-		}
+	if (fs_file && access (fs_file, R_OK)) {
+		fatal_error (errno, "Cannot open %s", fs_file);
 	}
 
 	/* Open the output file */
-	out_fp = fopen (output_file, "w+");
-	if (!out_fp) {
+	if (image_open (&out, output_file)) {
 		fatal_error (errno, "Cannot open %s", output_file);
 	}
 
 	/* Write zeros when the chk header will be */
-	buf[0] = '\0';
 	header_len = sizeof (struct chk_header) + strlen (board_id);
-	if (fwrite (buf, 1, header_len, out_fp) != header_len) {
+	if (image_pad (&out, 0, header_len)) {
+		image_abort (&out);
 		fatal_error (errno, "Cannot write header");
 	}
 
 	/* Allocate storage for header, we fill in as we go */
 	hdr = malloc (sizeof (struct chk_header));
 	if (!hdr) {
+		image_abort (&out);
 		fatal_error (0, "malloc failed");
 	}
 	bzero (hdr, sizeof (struct chk_header));
@@ -273,40 +271,33 @@ main (int argc, char * argv[])
 	/* Copy the trx file, calculating the checksum as we go */
 	netgear_checksum_init (&chk_part);
 	netgear_checksum_init (&chk_whole);
-	while (!feof (kern_fp)) {
-		len = fread (buf, 1, BUF_LEN, kern_fp);
-		if (len < 1) {
-			break;
-		}
-		if (fwrite (buf, len, 1, out_fp) != 1) {
-			fatal_error (errno, "Write error");
-		}
-		hdr->kernel_len += len;
-		netgear_checksum_add (&chk_part, (unsigned char *)buf, len);
-		netgear_checksum_add (&chk_whole, (unsigned char *)buf, len);
+	image_hash_add (&out, netgear_checksum_update, &chk_part);
+	image_hash_add (&out, netgear_checksum_update, &chk_whole);
+	len = image_append_file (&out, kern_file);
+	if (len < 0) {
+		image_abort (&out);
+		fatal_error (errno, "Write error");
 	}
+	hdr->kernel_len = len;
 	hdr->kernel_chksum = netgear_checksum_fini (&chk_part);
+	image_hash_remove (&out, &chk_part);
 	message ("     Kernel Len: %u", hdr->kernel_len);
 	message ("Kernel Checksum: 0x%08x", hdr->kernel_chksum);
 	hdr->kernel_len = htonl (hdr->kernel_len);
 	hdr->kernel_chksum = htonl (hdr->kernel_chksum);
 
 	/* Now copy the root fs, calculating the checksum as we go */
-	if (fs_fp) {
+	if (fs_file) {
 		netgear_checksum_init (&chk_part);
-		while (!feof (fs_fp)) {
-			len = fread (buf, 1, BUF_LEN, fs_fp);
-			if (len < 1) {
-				break;
-			}
-			if (fwrite (buf, len, 1, out_fp) != 1) {
-				fatal_error (errno, "Write error");
-			}
-			hdr->rootfs_len += len;
-			netgear_checksum_add (&chk_part, (unsigned char *)buf, len);
-			netgear_checksum_add (&chk_whole, (unsigned char *)buf, len);
+		image_hash_add (&out, netgear_checksum_update, &chk_part);
+		len = image_append_file (&out, fs_file);
+		if (len < 0) {
+			image_abort (&out);
+			fatal_error (errno, "Write error");
 		}
+		hdr->rootfs_len = len;
 		hdr->rootfs_chksum = (netgear_checksum_fini (&chk_part));
+		image_hash_remove (&out, &chk_part);
 		message ("     Rootfs Len: %u", hdr->rootfs_len);
 		message ("Rootfs Checksum: 0x%08x", hdr->rootfs_chksum);
 		hdr->rootfs_len = htonl (hdr->rootfs_len);
@@ -326,14 +317,20 @@ main (int argc, char * argv[])
 				strlen (board_id));
 	hdr->header_chksum = htonl (netgear_checksum_fini (&chk_part));
 
-	/* Finally rewind the output and write headers */
-	rewind (out_fp);
-	if (fwrite (hdr, sizeof (struct chk_header), 1, out_fp) != 1) {
+	/* Finally write the headers in front of the data */
+	if (image_pwrite (&out, hdr, sizeof (struct chk_header), 0)) {
+		image_abort (&out);
 		fatal_error (errno, "Cannot write header");
 	}
-	if (fwrite (board_id, strlen (board_id), 1, out_fp) != 1) {
+	if (image_pwrite (&out, board_id, strlen (board_id),
+			  sizeof (struct chk_header))) {
+		image_abort (&out);
 		fatal_error (errno, "Cannot write board id");
 	}
+	if (image_close (&out)) {
+		image_abort (&out);
+		fatal_error (errno, "Cannot write %s", output_file);
+	}
 
 	/* Success */
 	return EXIT_SUCCESS;
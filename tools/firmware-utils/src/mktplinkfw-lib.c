@@ -15,7 +15,6 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
-#include <unistd.h>     /* for unlink() */
 #include <libgen.h>
 #include <getopt.h>     /* for getopt() */
 #include <stdarg.h>
@@ -28,6 +27,7 @@
 #include <netinet/in.h>
 
 #include "mktplinkfw-lib.h"
+#include "image-lib.h"
 #include "md5.h"
 
 extern char *ofname;
@@ -44,7 +44,7 @@ extern int add_jffs2_eof;
 
 static unsigned char jffs2_eof_mark[4] = {0xde, 0xad, 0xc0, 0xde};
 
-void fill_header(char *buf, int len);
+uint8_t *fill_header(char *buf);
 
 struct flash_layout *find_layout(struct flash_layout *layouts, const char *id)
 {
@@ -115,12 +115,12 @@ out:
 	return ret;
 }
 
-static int pad_jffs2(char *buf, int currlen, int maxlen)
+static int pad_jffs2(struct image_out *out, int maxlen)
 {
 	int len;
 	uint32_t pad_mask;
 
-	len = currlen;
+	len = out->pos;
 	pad_mask = (4 * 1024) | (64 * 1024);	/* EOF at 4KB and at 64KB */
 	while ((len < maxlen) && (pad_mask != 0)) {
 		uint32_t mask;
@@ -140,45 +140,14 @@ static int pad_jffs2(char *buf, int currlen, int maxlen)
 				pad_mask &= ~mask;
 		}
 
-		for (i = 0; i < sizeof(jffs2_eof_mark); i++)
-			buf[len + i] = jffs2_eof_mark[i];
+		if (image_pad_to(out, 0xff, len) ||
+		    image_write(out, jffs2_eof_mark, sizeof(jffs2_eof_mark)))
+			return -1;
 
 		len += sizeof(jffs2_eof_mark);
 	}
 
-	return len;
-}
-
-int write_fw(const char *ofname, const char *data, int len)
-{
-	FILE *f;
-	int ret = EXIT_FAILURE;
-
-	f = fopen(ofname, "w");
-	if (f == NULL) {
-		ERRS("could not open \"%s\" for writing", ofname);
-		goto out;
-	}
-
-	errno = 0;
-	fwrite(data, len, 1, f);
-	if (errno) {
-		ERRS("unable to write output file");
-		goto out_flush;
-	}
-
-	DBG("firmware file \"%s\" completed", ofname);
-
-	ret = EXIT_SUCCESS;
-
-out_flush:
-	fflush(f);
-	fclose(f);
-	if (ret != EXIT_SUCCESS) {
-		unlink(ofname);
-	}
-out:
-	return ret;
+	return 0;
 }
 
 /* Helper functions to inspect_fw() representing different output formats */
@@ -207,57 +176,99 @@ inline void inspect_fw_pmd5sum(const char *label, const uint8_t *val, const char
 	printf(" %s\n", text);
 }
 
+static void md5_update(void *ctx, const void *buf, size_t len)
+{
+	MD5_Update(ctx, buf, len);
+}
+
+static int append_file(struct image_out *out, const struct file_info *fdata)
+{
+	if (image_append_file(out, fdata->file_name) < 0) {
+		ERRS("unable to copy \"%s\" to the output file", fdata->file_name);
+		return -1;
+	}
+
+	return 0;
+}
+
 // header_size = sizeof(struct fw_header)
 int build_fw(size_t header_size)
 {
-	int buflen;
+	struct image_out out;
+	MD5_CTX ctx;
+	uint8_t *md5;
 	char *buf;
-	char *p;
 	int ret = EXIT_FAILURE;
-	int writelen = 0;
-
-	writelen = header_size + kernel_len;
 
-	if (combined)
-		buflen = writelen;
-	else
-		buflen = layout->fw_max_len;
-
-	buf = malloc(buflen);
+	buf = malloc(header_size);
 	if (!buf) {
 		ERR("no memory for buffer\n");
 		goto out;
 	}
 
-	memset(buf, 0xff, buflen);
-	p = buf + header_size;
-	ret = read_to_buf(&kernel_info, p);
-	if (ret)
+	memset(buf, 0xff, header_size);
+	md5 = fill_header(buf);
+
+	if (image_open(&out, ofname)) {
+		ERRS("could not open \"%s\" for writing", ofname);
 		goto out_free_buf;
+	}
+
+	/* the checksum covers the whole image, with the salt in place of the sum */
+	if (md5) {
+		MD5_Init(&ctx);
+		image_hash_add(&out, md5_update, &ctx);
+	}
+
+	if (image_write(&out, buf, header_size)) {
+		ERRS("unable to write output file");
+		goto out_abort;
+	}
+
+	if (append_file(&out, &kernel_info))
+		goto out_abort;
 
 	if (!combined) {
-		p = buf + rootfs_ofs;
+		if (image_pad_to(&out, 0xff, rootfs_ofs)) {
+			ERRS("unable to pad output file to the rootfs offset");
+			goto out_abort;
+		}
 
-		ret = read_to_buf(&rootfs_info, p);
-		if (ret)
-			goto out_free_buf;
+		if (append_file(&out, &rootfs_info))
+			goto out_abort;
 
-		writelen = rootfs_ofs + rootfs_info.file_size;
+		if (add_jffs2_eof && pad_jffs2(&out, layout->fw_max_len)) {
+			ERRS("unable to write output file");
+			goto out_abort;
+		}
 
-		if (add_jffs2_eof)
-			writelen = pad_jffs2(buf, writelen, layout->fw_max_len);
+		if (!strip_padding &&
+		    image_pad_to(&out, 0xff, layout->fw_max_len)) {
+			ERRS("unable to write output file");
+			goto out_abort;
+		}
 	}
 
-	if (!strip_padding)
-		writelen = buflen;
+	if (md5) {
+		MD5_Final(md5, &ctx);
+		if (image_pwrite(&out, buf, header_size, 0)) {
+			ERRS("unable to write output file");
+			goto out_abort;
+		}
+	}
 
-	fill_header(buf, writelen);
-	ret = write_fw(ofname, buf, writelen);
-	if (ret)
-		goto out_free_buf;
+	if (image_close(&out)) {
+		ERRS("unable to write output file");
+		goto out_abort;
+	}
+
+	DBG("firmware file \"%s\" completed", ofname);
 
 	ret = EXIT_SUCCESS;
+	goto out_free_buf;
 
+out_abort:
+	image_abort(&out);
 out_free_buf:
 	free(buf);
 out:
@@ -58,7 +58,6 @@ struct flash_layout *find_layout(struct flash_layout *layouts, const char *id);
 void get_md5(const char *data, int size, uint8_t *md5);
 int get_file_stat(struct file_info *fdata);
 int read_to_buf(const struct file_info *fdata, char *buf);
-int write_fw(const char *ofname, const char *data, int len);
 inline void inspect_fw_pstr(const char *label, const char *str);
 inline void inspect_fw_phex(const char *label, uint32_t val);
 inline void inspect_fw_phexdec(const char *label, uint32_t val);
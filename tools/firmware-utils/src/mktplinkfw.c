@@ -358,7 +358,7 @@ static int check_options(void)
 	return 0;
 }
 
-void fill_header(char *buf, int len)
+uint8_t *fill_header(char *buf)
 {
 	struct fw_header *hdr = (struct fw_header *)buf;
 
@@ -412,7 +412,9 @@ void fill_header(char *buf, int len)
 	}
 
 	if (!combined)
-		get_md5(buf, len, hdr->md5sum1);
+		return hdr->md5sum1;
+
+	return NULL;
 }
 
 static int inspect_fw(void)
@@ -336,7 +336,7 @@ static int check_options(void)
 	return 0;
 }
 
-void fill_header(char *buf, int len)
+uint8_t *fill_header(char *buf)
 {
 	struct fw_header *hdr = (struct fw_header *)buf;
 	unsigned ver_len;
@@ -395,7 +395,7 @@ void fill_header(char *buf, int len)
 		hdr->kernel_ep = bswap_32(hdr->kernel_ep);
 	}
 
-	get_md5(buf, len, hdr->md5sum1);
+	return hdr->md5sum1;
 }
 
 static int inspect_fw(void)
@@ -26,16 +26,24 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <pthread.h>
 
 #define DEF_NAND_PAGE_SIZE   2048
 #define DEF_NAND_OOB_SIZE     64
 #define DEF_NAND_ECC_OFFSET   0x28
 
+#define MAX_THREADS           16
+#define BATCH_SIZE            (8 * 1024 * 1024)
+#define MIN_THREAD_PAGES      64
+
 static int page_size = DEF_NAND_PAGE_SIZE;
 static int oob_size = DEF_NAND_OOB_SIZE;
 static int ecc_offset = DEF_NAND_ECC_OFFSET;
+static int threads;
 
 /*
  * Pre-calculated 256-way 1 byte column parity
@@ -67,25 +75,39 @@ static const uint8_t nand_ecc_precalc_table[] = {
 int nand_calculate_ecc(const uint8_t *dat,
 		       uint8_t *ecc_code)
 {
-	uint8_t idx, reg1, reg2, reg3, tmp1, tmp2;
-	int i;
-
-	/* Initialize variables */
-	reg1 = reg2 = reg3 = 0;
-
-	/* Build up column parity */
-	for(i = 0; i < 256; i++) {
-		/* Get CP0 - CP5 from table */
-		idx = nand_ecc_precalc_table[*dat++];
-		reg1 ^= (idx & 0x3f);
-
-		/* All bit XOR = 1 ? */
-		if (idx & 0x40) {
-			reg3 ^= (uint8_t) i;
-			reg2 ^= ~((uint8_t) i);
-		}
+	uint8_t reg1, reg2, reg3, tmp1, tmp2, x, b[8];
+	uint64_t w, all = 0, lp[5] = { 0 };
+	int i, k;
+
+	/*
+	 * Bit k of the line parity is the parity of all bytes whose index
+	 * has bit k set. Bits 3-7 of the index select a 64 bit word, so
+	 * XOR the words into one accumulator per bit. Bits 0-2 select the
+	 * byte within the word and are taken from the XOR of all words.
+	 */
+	for (i = 0; i < 32; i++) {
+		memcpy(&w, dat + 8 * i, sizeof(w));
+		all ^= w;
+		for (k = 0; k < 5; k++)
+			if (i & (1 << k))
+				lp[k] ^= w;
 	}
 
+	memcpy(b, &all, sizeof(b));
+	x = b[0] ^ b[1] ^ b[2] ^ b[3] ^ b[4] ^ b[5] ^ b[6] ^ b[7];
+
+	/* column parity is linear, so it is that of the XOR of all bytes */
+	reg1 = nand_ecc_precalc_table[x] & 0x3f;
+
+	reg3  = !!(nand_ecc_precalc_table[b[1] ^ b[3] ^ b[5] ^ b[7]] & 0x40) << 0;
+	reg3 |= !!(nand_ecc_precalc_table[b[2] ^ b[3] ^ b[6] ^ b[7]] & 0x40) << 1;
+	reg3 |= !!(nand_ecc_precalc_table[b[4] ^ b[5] ^ b[6] ^ b[7]] & 0x40) << 2;
+	for (k = 0; k < 5; k++)
+		reg3 |= __builtin_parityll(lp[k]) << (k + 3);
+
+	/* reg2 collects the inverted indexes of the same bytes */
+	reg2 = (nand_ecc_precalc_table[x] & 0x40) ? ~reg3 : reg3;
+
 	/* Create non-inverted ECC code from line parity */
 	tmp1  = (reg3 & 0x80) >> 0; /* B7 -> B7 */
 	tmp1 |= (reg2 & 0x80) >> 1; /* B7 -> B6 */
@@ -118,6 +140,107 @@ int nand_calculate_ecc(const uint8_t *dat,
 	return 0;
 }
 
+struct ecc_job {
+	const uint8_t *in;
+	uint8_t *out;
+	size_t pages;
+};
+
+/* copy pages into place and fill in their ECC, OOB is zero otherwise */
+static void *ecc_worker(void *arg)
+{
+	struct ecc_job *job = arg;
+	const uint8_t *in = job->in;
+	uint8_t *out = job->out;
+	size_t i;
+	int j;
+
+	for (i = 0; i < job->pages; i++) {
+		uint8_t *ecc_data = out + page_size + ecc_offset;
+
+		memcpy(out, in, page_size);
+		memset(out + page_size, 0, oob_size);
+		for (j = 0; j < page_size / 256; j++) {
+			nand_calculate_ecc(in + j * 256, ecc_data);
+			ecc_data += 3;
+		}
+
+		in += page_size;
+		out += page_size + oob_size;
+	}
+
+	return NULL;
+}
+
+/* spread the pages of one batch across the worker threads */
+static void ecc_batch(const uint8_t *in, uint8_t *out, size_t pages)
+{
+	struct ecc_job jobs[MAX_THREADS];
+	pthread_t tids[MAX_THREADS];
+	int started[MAX_THREADS];
+	size_t per_thread;
+	int i, n = threads;
+
+	if ((size_t) n > pages / MIN_THREAD_PAGES)
+		n = pages / MIN_THREAD_PAGES;
+	if (n < 1)
+		n = 1;
+
+	per_thread = (pages + n - 1) / n;
+	for (i = 0; i < n; i++) {
+		size_t first = i * per_thread;
+
+		jobs[i].in = in + first * page_size;
+		jobs[i].out = out + first * (page_size + oob_size);
+		jobs[i].pages = first + per_thread > pages ? pages - first : per_thread;
+
+		/* the last share is done by the calling thread */
+		started[i] = i < n - 1 &&
+			     !pthread_create(&tids[i], NULL, ecc_worker, &jobs[i]);
+		if (!started[i])
+			ecc_worker(&jobs[i]);
+	}
+
+	for (i = 0; i < n; i++)
+		if (started[i])
+			pthread_join(tids[i], NULL);
+}
+
+static ssize_t read_full(int fd, uint8_t *buf, size_t len)
+{
+	size_t done = 0;
+
+	while (done < len) {
+		ssize_t r = read(fd, buf + done, len - done);
+
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0)
+			return -1;
+		if (!r)
+			break;
+		done += r;
+	}
+
+	return done;
+}
+
+static int write_full(int fd, const uint8_t *buf, size_t len)
+{
+	while (len) {
+		ssize_t r = write(fd, buf, len);
+
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0)
+			return -1;
+		buf += r;
+		len -= r;
+	}
+
+	return 0;
+}
+
 /*
  *  usage: bb-nandflash-ecc    start_address  size
  */
@@ -128,6 +251,7 @@ void usage(const char *prog)
 		"    -p <pagesize>      NAND page size (default: %d)\n"
 		"    -o <oobsize>       NAND OOB size (default: %d)\n"
 		"    -e <offset>        NAND ECC offset (default: %d)\n"
+		"    -j <threads>       number of threads (default: online CPUs)\n"
 		"\n", prog, DEF_NAND_PAGE_SIZE, DEF_NAND_OOB_SIZE,
 		DEF_NAND_ECC_OFFSET);
 	exit(1);
@@ -137,14 +261,14 @@ void usage(const char *prog)
   */
 int main(int argc, char **argv)
 {
-	uint8_t *page_data = NULL;
-	uint8_t *ecc_data;
+	uint8_t *in_data = NULL, *out_data = NULL;
+	size_t batch_pages;
 	int infd = -1, outfd = -1;
 	int ret = 1;
 	ssize_t bytes;
 	int ch;
 
-	while ((ch = getopt(argc, argv, "e:o:p:")) != -1) {
+	while ((ch = getopt(argc, argv, "e:j:o:p:")) != -1) {
 		switch(ch) {
 		case 'p':
 			page_size = strtoul(optarg, NULL, 0);
@@ -155,6 +279,9 @@ int main(int argc, char **argv)
 		case 'e':
 			ecc_offset = strtoul(optarg, NULL, 0);
 			break;
+		case 'j':
+			threads = strtoul(optarg, NULL, 0);
+			break;
 		default:
 			usage(argv[0]);
 		}
@@ -165,6 +292,17 @@ int main(int argc, char **argv)
 
 	argv += optind;
 
+	if (page_size <= 0 || oob_size < 0 || ecc_offset < 0 ||
+	    ecc_offset + page_size / 256 * 3 > oob_size) {
+		fprintf(stderr, "ECC does not fit into the OOB area\n");
+		goto out;
+	}
+
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > MAX_THREADS)
+		threads = MAX_THREADS;
+
 	infd = open(argv[0], O_RDONLY, 0);
 	if (infd < 0) {
 		perror("open input file");
@@ -177,18 +315,34 @@ int main(int argc, char **argv)
 		goto out;
 	}
 
-	page_data = malloc(page_size + oob_size);
+	batch_pages = BATCH_SIZE / page_size;
+	if (!batch_pages)
+		batch_pages = 1;
 
-	while ((bytes = read(infd, page_data, page_size)) == page_size) {
-		int j;
+	in_data = malloc(batch_pages * page_size);
+	out_data = malloc(batch_pages * (page_size + oob_size));
+	if (!in_data || !out_data) {
+		perror("malloc");
+		goto out;
+	}
 
-		ecc_data = page_data + page_size + ecc_offset;
-		for (j = 0; j < page_size / 256; j++)
-		{
-			nand_calculate_ecc(page_data + j * 256, ecc_data);
-			ecc_data += 3;
+	/* a trailing partial page is dropped */
+	while ((bytes = read_full(infd, in_data, batch_pages * page_size)) >= page_size) {
+		size_t pages = bytes / page_size;
+
+		ecc_batch(in_data, out_data, pages);
+		if (write_full(outfd, out_data, pages * (page_size + oob_size))) {
+			perror("write output file");
+			goto out;
 		}
-		write(outfd, page_data, page_size + oob_size);
+
+		if (pages < batch_pages)
+			break;
+	}
+
+	if (bytes < 0) {
+		perror("read input file");
+		goto out;
 	}
 
 	ret = 0;
@@ -197,8 +351,7 @@ out:
 		close(infd);
 	if (outfd >= 0)
 		close(outfd);
-	if (page_data)
-		free(page_data);
+	free(in_data);
+	free(out_data);
 	return ret;
 }
-
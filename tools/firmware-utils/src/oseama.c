@@ -40,6 +40,8 @@
 
 #define SEAMA_MAGIC			0x5ea3a417
 
+#define OSEAMA_BUF_SIZE			(64 * 1024)
+
 struct seama_seal_header {
 	uint32_t magic;
 	uint16_t reserved;
@@ -58,6 +60,7 @@ struct seama_entity_header {
 char *seama_path;
 int entity_idx = -1;
 char *out_path;
+uint8_t buf[OSEAMA_BUF_SIZE];
 
 static inline size_t oseama_min(size_t x, size_t y) {
 	return x < y ? x : y;
@@ -221,11 +224,24 @@ out:
  * Create
  **************************************************/
 
+/* MD5 of the image data, calculated while writing it */
+static MD5_CTX image_md5;
+
+static int oseama_entity_write(FILE *seama, uint8_t *data, size_t length) {
+	if (fwrite(data, 1, length, seama) != length) {
+		fprintf(stderr, "Couldn't write %zu B to %s\n", length, seama_path);
+		return -EIO;
+	}
+
+	MD5_Update(&image_md5, data, length);
+
+	return 0;
+}
+
 static ssize_t oseama_entity_append_file(FILE *seama, const char *in_path) {
 	FILE *in;
 	size_t bytes;
 	ssize_t length = 0;
-	uint8_t buf[128];
 
 	in = fopen(in_path, "r");
 	if (!in) {
@@ -234,8 +250,7 @@ static ssize_t oseama_entity_append_file(FILE *seama, const char *in_path) {
 	}
 
 	while ((bytes = fread(buf, 1, sizeof(buf), in)) > 0) {
-		if (fwrite(buf, 1, bytes, seama) != bytes) {
-			fprintf(stderr, "Couldn't write %zu B to %s\n", bytes, seama_path);
+		if (oseama_entity_write(seama, buf, bytes)) {
 			length = -EIO;
 			break;
 		}
@@ -247,17 +262,20 @@ static ssize_t oseama_entity_append_file(FILE *seama, const char *in_path) {
 	return length;
 }
 
-static ssize_t oseama_entity_append_zeros(FILE *seama, size_t length) {
-	uint8_t *buf;
+static ssize_t oseama_entity_append_zeros(FILE *seama, size_t length, int hash) {
+	size_t left = length;
 
-	buf = malloc(length);
-	if (!buf)
-		return -ENOMEM;
-	memset(buf, 0, length);
+	memset(buf, 0, oseama_min(sizeof(buf), length));
+	while (left) {
+		size_t bytes = oseama_min(sizeof(buf), left);
 
-	if (fwrite(buf, 1, length, seama) != length) {
-		fprintf(stderr, "Couldn't write %zu B to %s\n", length, seama_path);
-		return -EIO;
+		if (fwrite(buf, 1, bytes, seama) != bytes) {
+			fprintf(stderr, "Couldn't write %zu B to %s\n", length, seama_path);
+			return -EIO;
+		}
+		if (hash)
+			MD5_Update(&image_md5, buf, bytes);
+		left -= bytes;
 	}
 
 	return length;
@@ -267,7 +285,7 @@ static ssize_t oseama_entity_align(FILE *seama, size_t curr_offset, size_t align
 	if (curr_offset & (alignment - 1)) {
 		size_t length = alignment - (curr_offset % alignment);
 
-		return oseama_entity_append_zeros(seama, length);
+		return oseama_entity_append_zeros(seama, length, 0);
 	}
 
 	return 0;
@@ -275,18 +293,9 @@ static ssize_t oseama_entity_align(FILE *seama, size_t curr_offset, size_t align
 
 static int oseama_entity_write_hdr(FILE *seama, size_t metasize, size_t imagesize) {
 	struct seama_entity_header hdr = {};
-	uint8_t buf[128];
-	size_t length = imagesize;
 	size_t bytes;
-	MD5_CTX ctx;
 
-	fseek(seama, sizeof(hdr) + metasize, SEEK_SET);
-	MD5_Init(&ctx);
-	while ((bytes = fread(buf, 1, oseama_min(sizeof(buf), length), seama)) > 0) {
-		MD5_Update(&ctx, buf, bytes);
-		length -= bytes;
-	}
-	MD5_Final(hdr.md5, &ctx);
+	MD5_Final(hdr.md5, &image_md5);
 
 	hdr.magic = cpu_to_be32(SEAMA_MAGIC);
 	hdr.metasize = cpu_to_be16(metasize);
@@ -317,13 +326,14 @@ static int oseama_entity(int argc, char **argv) {
 	}
 	seama_path = argv[2];
 
-	seama = fopen(seama_path, "w+");
+	seama = fopen(seama_path, "w");
 	if (!seama) {
 		fprintf(stderr, "Couldn't open %s\n", seama_path);
 		err = -EACCES;
 		goto out;
 	}
 	fseek(seama, curr_offset, SEEK_SET);
+	MD5_Init(&image_md5);
 
 	optind = 3;
 	while ((c = getopt(argc, argv, "m:f:b:")) != -1) {
@@ -371,7 +381,7 @@ static int oseama_entity(int argc, char **argv) {
 			if (sbytes < 0) {
 				fprintf(stderr, "Current Seama entity length is 0x%zx, can't pad it with zeros to 0x%lx\n", curr_offset, strtol(optarg, NULL, 0));
 			} else {
-				sbytes = oseama_entity_append_zeros(seama, sbytes);
+				sbytes = oseama_entity_append_zeros(seama, sbytes, 1);
 				if (sbytes < 0) {
 					fprintf(stderr, "Failed to append zeros\n");
 				} else {
@@ -385,7 +395,7 @@ static int oseama_entity(int argc, char **argv) {
 			break;
 	}
 
-	oseama_entity_write_hdr(seama, metasize, imagesize);
+	err = oseama_entity_write_hdr(seama, metasize, imagesize);
 
 	fclose(seama);
 out:
@@ -414,7 +424,6 @@ static void oseama_extract_parse_options(int argc, char **argv) {
 static int oseama_extract_entity(FILE *seama, FILE *out) {
 	struct seama_entity_header hdr;
 	size_t bytes, metasize, imagesize, length;
-	uint8_t buf[1024];
 	int i = 0;
 	int err = 0;
 
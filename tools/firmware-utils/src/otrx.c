@@ -36,6 +36,8 @@
 #define TRX_FLAGS_OFFSET		12
 #define TRX_MAX_PARTS			3
 
+#define OTRX_BUF_SIZE			(64 * 1024)
+
 struct trx_header {
 	uint32_t magic;
 	uint32_t length;
@@ -48,6 +50,7 @@ struct trx_header {
 char *trx_path;
 size_t trx_offset = 0;
 char *partition[TRX_MAX_PARTS] = {};
+uint8_t buf[OTRX_BUF_SIZE];
 
 static inline size_t otrx_min(size_t x, size_t y) {
 	return x < y ? x : y;
@@ -134,6 +137,64 @@ uint32_t otrx_crc32(uint32_t crc, uint8_t *buf, size_t len) {
 	return crc;
 }
 
+static uint32_t otrx_gf2_matrix_times(const uint32_t *mat, uint32_t vec) {
+	uint32_t sum = 0;
+
+	for (; vec; vec >>= 1, mat++)
+		if (vec & 1)
+			sum ^= *mat;
+
+	return sum;
+}
+
+static void otrx_gf2_matrix_square(uint32_t *square, const uint32_t *mat) {
+	int n;
+
+	for (n = 0; n < 32; n++)
+		square[n] = otrx_gf2_matrix_times(mat, mat[n]);
+}
+
+/*
+ * Returns the CRC register after feeding len zero bytes to it, in O(log len)
+ * steps (the operator used by zlib's crc32_combine()). As the CRC is linear,
+ *	crc(init, A | B) == otrx_crc32_zeros(crc(init, A), len(B)) ^ crc(0, B)
+ * which lets create checksum the payload while writing it, before the header
+ * it is preceded by is known.
+ */
+static uint32_t otrx_crc32_zeros(uint32_t crc, size_t len) {
+	uint32_t even[32], odd[32];
+	uint32_t row = 1;
+	int n;
+
+	/* operator for one zero bit */
+	odd[0] = 0xedb88320;
+	for (n = 1; n < 32; n++) {
+		odd[n] = row;
+		row <<= 1;
+	}
+
+	/* two and four zero bits */
+	otrx_gf2_matrix_square(even, odd);
+	otrx_gf2_matrix_square(odd, even);
+
+	/* apply len zero bytes, squaring the operator for each bit of len */
+	while (len) {
+		otrx_gf2_matrix_square(even, odd);
+		if (len & 1)
+			crc = otrx_gf2_matrix_times(even, crc);
+		len >>= 1;
+		if (!len)
+			break;
+
+		otrx_gf2_matrix_square(odd, even);
+		if (len & 1)
+			crc = otrx_gf2_matrix_times(odd, crc);
+		len >>= 1;
+	}
+
+	return crc;
+}
+
 /**************************************************
  * Check
  **************************************************/
@@ -154,7 +215,6 @@ static int otrx_check(int argc, char **argv) {
 	FILE *trx;
 	struct trx_header hdr;
 	size_t bytes, length;
-	uint8_t buf[1024];
 	uint32_t crc32;
 	int err = 0;
 
@@ -228,11 +288,24 @@ out:
  * Create
  **************************************************/
 
+/* CRC32 (starting from 0) of the data written after the header */
+static uint32_t payload_crc32;
+
+static int otrx_create_write(FILE *trx, uint8_t *data, size_t length) {
+	if (fwrite(data, 1, length, trx) != length) {
+		fprintf(stderr, "Couldn't write %zu B to %s\n", length, trx_path);
+		return -EIO;
+	}
+
+	payload_crc32 = otrx_crc32(payload_crc32, data, length);
+
+	return 0;
+}
+
 static ssize_t otrx_create_append_file(FILE *trx, const char *in_path) {
 	FILE *in;
 	size_t bytes;
 	ssize_t length = 0;
-	uint8_t buf[1024];
 
 	in = fopen(in_path, "r");
 	if (!in) {
@@ -241,8 +314,7 @@ static ssize_t otrx_create_append_file(FILE *trx, const char *in_path) {
 	}
 
 	while ((bytes = fread(buf, 1, sizeof(buf), in)) > 0) {
-		if (fwrite(buf, 1, bytes, trx) != bytes) {
-			fprintf(stderr, "Couldn't write %zu B to %s\n", bytes, trx_path);
+		if (otrx_create_write(trx, buf, bytes)) {
 			length = -EIO;
 			break;
 		}
@@ -255,20 +327,21 @@ static ssize_t otrx_create_append_file(FILE *trx, const char *in_path) {
 }
 
 static ssize_t otrx_create_append_zeros(FILE *trx, size_t length) {
-	uint8_t *buf;
+	size_t left = length;
 
-	buf = malloc(length);
-	if (!buf)
-		return -ENOMEM;
-	memset(buf, 0, length);
+	memset(buf, 0, otrx_min(sizeof(buf), length));
+	while (left) {
+		size_t bytes = otrx_min(sizeof(buf), left);
 
-	if (fwrite(buf, 1, length, trx) != length) {
-		fprintf(stderr, "Couldn't write %zu B to %s\n", length, trx_path);
-		free(buf);
-		return -EIO;
+		if (fwrite(buf, 1, bytes, trx) != bytes) {
+			fprintf(stderr, "Couldn't write %zu B to %s\n", length, trx_path);
+			return -EIO;
+		}
+		left -= bytes;
 	}
 
-	free(buf);
+	/* zeros just shift the CRC register */
+	payload_crc32 = otrx_crc32_zeros(payload_crc32, length);
 
 	return length;
 }
@@ -284,28 +357,18 @@ static ssize_t otrx_create_align(FILE *trx, size_t curr_offset, size_t alignment
 
 static int otrx_create_write_hdr(FILE *trx, struct trx_header *hdr) {
 	size_t bytes, length;
-	uint8_t buf[1024];
 	uint32_t crc32;
 
 	hdr->magic = cpu_to_le32(TRX_MAGIC);
 	hdr->version = 1;
 
-	fseek(trx, 0, SEEK_SET);
-	bytes = fwrite(hdr, 1, sizeof(struct trx_header), trx);
-	if (bytes != sizeof(struct trx_header)) {
-		fprintf(stderr, "Couldn't write TRX header to %s\n", trx_path);
-		return -EIO;
-	}
-
-	length = le32_to_cpu(hdr->length);
-
-	crc32 = 0xffffffff;
-	fseek(trx, TRX_FLAGS_OFFSET, SEEK_SET);
-	length -= TRX_FLAGS_OFFSET;
-	while ((bytes = fread(buf, 1, otrx_min(sizeof(buf), length), trx)) > 0) {
-		crc32 = otrx_crc32(crc32, buf, bytes);
-		length -= bytes;
-	}
+	/*
+	 * The CRC covers the header from the flags on and the whole payload,
+	 * whose CRC was calculated while writing it
+	 */
+	length = le32_to_cpu(hdr->length) - sizeof(*hdr);
+	crc32 = otrx_crc32(0xffffffff, (uint8_t *)hdr + TRX_FLAGS_OFFSET, sizeof(*hdr) - TRX_FLAGS_OFFSET);
+	crc32 = otrx_crc32_zeros(crc32, length) ^ payload_crc32;
 	hdr->crc32 = cpu_to_le32(crc32);
 
 	fseek(trx, 0, SEEK_SET);
@@ -334,13 +397,14 @@ static int otrx_create(int argc, char **argv) {
 	}
 	trx_path = argv[2];
 
-	trx = fopen(trx_path, "w+");
+	trx = fopen(trx_path, "w");
 	if (!trx) {
 		fprintf(stderr, "Couldn't open %s\n", trx_path);
 		err = -EACCES;
 		goto out;
 	}
 	fseek(trx, curr_offset, SEEK_SET);
+	payload_crc32 = 0;
 
 	optind = 3;
 	while ((c = getopt(argc, argv, "f:A:a:b:")) != -1) {
@@ -412,7 +476,7 @@ static int otrx_create(int argc, char **argv) {
 		curr_offset += sbytes;
 
 	hdr.length = curr_offset;
-	otrx_create_write_hdr(trx, &hdr);
+	err = otrx_create_write_hdr(trx, &hdr);
 err_close:
 	fclose(trx);
 out:
@@ -447,7 +511,7 @@ static void otrx_extract_parse_options(int argc, char **argv) {
 static int otrx_extract_copy(FILE *trx, size_t offset, size_t length, char *out_path) {
 	FILE *out;
 	size_t bytes;
-	uint8_t *buf;
+	size_t left = length;
 	int err = 0;
 
 	out = fopen(out_path, "w");
@@ -457,32 +521,25 @@ static int otrx_extract_copy(FILE *trx, size_t offset, size_t length, char *out_
 		goto out;
 	}
 
-	buf = malloc(length);
-	if (!buf) {
-		fprintf(stderr, "Couldn't alloc %zu B buffer\n", length);
-		err =  -ENOMEM;
-		goto err_close;
-	}
-
 	fseek(trx, offset, SEEK_SET);
-	bytes = fread(buf, 1, length, trx);
-	if (bytes != length) {
-		fprintf(stderr, "Couldn't read %zu B of data from %s\n", length, trx_path);
-		err =  -ENOMEM;
-		goto err_free_buf;
-	};
-
-	bytes = fwrite(buf, 1, length, out);
-	if (bytes != length) {
-		fprintf(stderr, "Couldn't write %zu B to %s\n", length, out_path);
-		err =  -ENOMEM;
-		goto err_free_buf;
+	while (left) {
+		bytes = fread(buf, 1, otrx_min(sizeof(buf), left), trx);
+		if (!bytes) {
+			fprintf(stderr, "Couldn't read %zu B of data from %s\n", length, trx_path);
+			err =  -EIO;
+			goto err_close;
+		}
+
+		if (fwrite(buf, 1, bytes, out) != bytes) {
+			fprintf(stderr, "Couldn't write %zu B to %s\n", length, out_path);
+			err =  -EIO;
+			goto err_close;
+		}
+		left -= bytes;
 	}
 
 	printf("Extracted 0x%zx bytes into %s\n", length, out_path);
 
-err_free_buf:
-	free(buf);
 err_close:
 	fclose(out);
 out:
@@ -31,6 +31,9 @@
 #include <ctype.h>
 #include <fcntl.h>
 #include <stdint.h>
+#include <errno.h>
+
+#include "image-lib.h"
 
 #if __BYTE_ORDER == __BIG_ENDIAN
 #define cpu_to_le32(x) bswap_32(x)
@@ -53,6 +56,7 @@ struct pte {
 struct partinfo {
 	unsigned long size;
 	int type;
+	const char *image;
 };
 
 int verbose = 0;
@@ -61,6 +65,7 @@ int heads = -1;
 int sectors = -1;
 int kb_align = 0;
 bool ignore_null_sized_partition = false;
+bool pad = false;
 struct partinfo parts[4];
 char *filename = NULL;
 
@@ -132,12 +137,43 @@ static inline unsigned long round_to_kb(long sect) {
         return ((sect - 1) / kb_align + 1) * kb_align;
 }
 
+/* write the payload of a partition, leaving unused space as holes */
+static int write_image(struct image_out *out, int i, unsigned long start, unsigned long len)
+{
+	struct stat st;
+
+	if (stat(parts[i].image, &st)) {
+		fprintf(stderr, "Can't open image '%s': %s\n", parts[i].image, strerror(errno));
+		return -1;
+	}
+
+	if (st.st_size > (off_t)len * 512) {
+		fprintf(stderr, "Image '%s' is too big for partition %d (%lld > %lld bytes)\n",
+			parts[i].image, i, (long long)st.st_size, (long long)len * 512);
+		return -1;
+	}
+
+	if (verbose)
+		fprintf(stderr, "Partition %d: writing %s\n", i, parts[i].image);
+
+	if (image_skip_to(out, (uint64_t)start * 512) ||
+	    image_append_sparse(out, parts[i].image) < 0) {
+		fprintf(stderr, "Can't write image '%s': %s\n", parts[i].image, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
 /* check the partition sizes and write the partition table */
 static int gen_ptable(uint32_t signature, int nr)
 {
 	struct pte pte[4];
 	unsigned long sect = 0;
-	int i, fd, ret = -1, start, len;
+	unsigned long starts[4] = {}, lens[4] = {};
+	uint8_t mbr[512];
+	struct image_out out;
+	int i, ret = -1, start, len;
 
 	memset(pte, 0, sizeof(struct pte) * 4);
 	for (i = 0; i < nr; i++) {
@@ -164,43 +200,66 @@ static int gen_ptable(uint32_t signature, int nr)
 		to_chs(start, pte[i].chs_start);
 		to_chs(start + len - 1, pte[i].chs_end);
 
+		starts[i] = start;
+		lens[i] = len;
+
 		if (verbose)
 			fprintf(stderr, "Partition %d: start=%ld, end=%ld, size=%ld\n", i, (long)start * 512, ((long)start + (long)len) * 512, (long)len * 512);
 		printf("%ld\n", (long)start * 512);
 		printf("%ld\n", (long)len * 512);
 	}
 
-	if ((fd = open(filename, O_WRONLY|O_CREAT|O_TRUNC, 0644)) < 0) {
+	if (image_open(&out, filename)) {
 		fprintf(stderr, "Can't open output file '%s'\n",filename);
 		return -1;
 	}
 
-	lseek(fd, 440, SEEK_SET);
-	if (write(fd, &signature, sizeof(signature)) != sizeof(signature)) {
+	memset(mbr, 0, sizeof(mbr));
+	memcpy(mbr + 440, &signature, sizeof(signature));
+	memcpy(mbr + 446, pte, sizeof(struct pte) * 4);
+	mbr[510] = 0x55;
+	mbr[511] = 0xaa;
+
+	if (image_write(&out, mbr, sizeof(mbr))) {
 		fprintf(stderr, "write failed.\n");
 		goto fail;
 	}
 
-	lseek(fd, 446, SEEK_SET);
-	if (write(fd, pte, sizeof(struct pte) * 4) != sizeof(struct pte) * 4) {
+	/* partitions are laid out in order, so the output is written front to back */
+	for (i = 0; i < nr; i++) {
+		if (!parts[i].image)
+			continue;
+
+		if (!lens[i]) {
+			fprintf(stderr, "No space for image '%s' in partition %d\n", parts[i].image, i);
+			goto fail;
+		}
+
+		if (write_image(&out, i, starts[i], lens[i]))
+			goto fail;
+	}
+
+	/* extend the image to the end of the last partition */
+	if (pad && sect * 512 > out.pos && image_skip_to(&out, (uint64_t)sect * 512)) {
 		fprintf(stderr, "write failed.\n");
 		goto fail;
 	}
-	lseek(fd, 510, SEEK_SET);
-	if (write(fd, "\x55\xaa", 2) != 2) {
+
+	if (image_close(&out)) {
 		fprintf(stderr, "write failed.\n");
 		goto fail;
 	}
 
-	ret = 0;
+	return 0;
+
 fail:
-	close(fd);
+	image_abort(&out);
 	return ret;
 }
 
 static void usage(char *prog)
 {
-	fprintf(stderr, "Usage: %s [-v] [-n] -h <heads> -s <sectors> -o <outputfile> [-a 0..4] [-l <align kB>] [[-t <type>] -p <size>...] \n", prog);
+	fprintf(stderr, "Usage: %s [-v] [-n] -h <heads> -s <sectors> -o <outputfile> [-a 0..4] [-l <align kB>] [-z] [[-t <type>] -p <size> [-i <image>]...] \n", prog);
 	exit(EXIT_FAILURE);
 }
 
@@ -211,7 +270,7 @@ int main (int argc, char **argv)
 	int part = 0;
 	uint32_t signature = 0x5452574F; /* 'OWRT' */
 
-	while ((ch = getopt(argc, argv, "h:s:p:a:t:o:vnl:S:")) != -1) {
+	while ((ch = getopt(argc, argv, "h:s:p:a:t:o:vnl:S:i:z")) != -1) {
 		switch (ch) {
 		case 'o':
 			filename = optarg;
@@ -236,6 +295,16 @@ int main (int argc, char **argv)
 			parts[part].size = to_kbytes(optarg);
 			parts[part++].type = type;
 			break;
+		case 'i':
+			if (!part) {
+				fprintf(stderr, "-i needs a preceding -p\n");
+				exit(EXIT_FAILURE);
+			}
+			parts[part - 1].image = optarg;
+			break;
+		case 'z':
+			pad = true;
+			break;
 		case 't':
 			type = (char)strtoul(optarg, NULL, 16);
 			break;
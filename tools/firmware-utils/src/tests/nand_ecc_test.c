@@ -0,0 +1,341 @@
+/*
+ * Checks nand_ecc against the original byte-wise ECC code.
+ *
+ * Single 256 byte blocks are compared first: random, all 0x00, all 0xff
+ * and every single bit flip of those. Then the tool itself is run on
+ * files and on pipes fed in odd sized chunks, with several page layouts,
+ * thread counts and inputs larger than one batch. Its output must match
+ * pages followed by an OOB area that is zero apart from the ECC bytes.
+ *
+ * Build and run on the host:
+ *   make -C tools/firmware-utils/src/tests check
+ */
+
+#define main nand_ecc_main
+#include "../nand_ecc.c"
+#undef main
+
+#include <sys/wait.h>
+
+static int failed;
+
+/* the byte-wise implementation nand_calculate_ecc() replaced */
+static void ref_calculate_ecc(const uint8_t *dat, uint8_t *ecc_code)
+{
+	uint8_t idx, reg1, reg2, reg3, tmp1, tmp2;
+	int i;
+
+	reg1 = reg2 = reg3 = 0;
+
+	for (i = 0; i < 256; i++) {
+		idx = nand_ecc_precalc_table[*dat++];
+		reg1 ^= (idx & 0x3f);
+
+		if (idx & 0x40) {
+			reg3 ^= (uint8_t) i;
+			reg2 ^= ~((uint8_t) i);
+		}
+	}
+
+	tmp1  = (reg3 & 0x80) >> 0;
+	tmp1 |= (reg2 & 0x80) >> 1;
+	tmp1 |= (reg3 & 0x40) >> 1;
+	tmp1 |= (reg2 & 0x40) >> 2;
+	tmp1 |= (reg3 & 0x20) >> 2;
+	tmp1 |= (reg2 & 0x20) >> 3;
+	tmp1 |= (reg3 & 0x10) >> 3;
+	tmp1 |= (reg2 & 0x10) >> 4;
+
+	tmp2  = (reg3 & 0x08) << 4;
+	tmp2 |= (reg2 & 0x08) << 3;
+	tmp2 |= (reg3 & 0x04) << 3;
+	tmp2 |= (reg2 & 0x04) << 2;
+	tmp2 |= (reg3 & 0x02) << 2;
+	tmp2 |= (reg2 & 0x02) << 1;
+	tmp2 |= (reg3 & 0x01) << 1;
+	tmp2 |= (reg2 & 0x01) << 0;
+
+#ifdef CONFIG_MTD_NAND_ECC_SMC
+	ecc_code[0] = ~tmp2;
+	ecc_code[1] = ~tmp1;
+#else
+	ecc_code[0] = ~tmp1;
+	ecc_code[1] = ~tmp2;
+#endif
+	ecc_code[2] = ((~reg1) << 2) | 0x03;
+}
+
+static void check_block(const uint8_t *dat, const char *what, int bit)
+{
+	uint8_t ecc[3], ref[3];
+
+	nand_calculate_ecc(dat, ecc);
+	ref_calculate_ecc(dat, ref);
+	if (memcmp(ecc, ref, sizeof(ecc))) {
+		fprintf(stderr, "block %s, bit %d: ECC %02x%02x%02x, "
+			"expected %02x%02x%02x\n", what, bit,
+			ecc[0], ecc[1], ecc[2], ref[0], ref[1], ref[2]);
+		failed++;
+	}
+}
+
+static void fill(uint8_t *buf, size_t len, int kind)
+{
+	size_t i;
+
+	switch (kind) {
+	case 0:
+		for (i = 0; i < len; i++)
+			buf[i] = rand();
+		break;
+	case 1:
+		memset(buf, 0xff, len);
+		break;
+	case 2:
+		memset(buf, 0, len);
+		break;
+	default:
+		/* erased flash with a few programmed bytes */
+		memset(buf, 0xff, len);
+		for (i = 0; i < len / 64; i++)
+			buf[rand() % len] = rand();
+		break;
+	}
+}
+
+static void test_blocks(void)
+{
+	static const char *const kinds[] = { "random", "0xff", "0x00", "sparse" };
+	uint8_t dat[256];
+	int kind, i, bit;
+
+	for (kind = 0; kind < 4; kind++) {
+		for (i = 0; i < 1000; i++) {
+			fill(dat, sizeof(dat), kind);
+			check_block(dat, kinds[kind], -1);
+		}
+
+		fill(dat, sizeof(dat), kind);
+		for (bit = 0; bit < 256 * 8; bit++) {
+			dat[bit / 8] ^= 1 << (bit % 8);
+			check_block(dat, kinds[kind], bit);
+			dat[bit / 8] ^= 1 << (bit % 8);
+		}
+	}
+}
+
+static uint8_t *expected(const uint8_t *in, size_t len, int psize, int osize,
+			 int offset, size_t *out_len)
+{
+	size_t pages = len / psize, i;
+	uint8_t *out, *p;
+	int j;
+
+	*out_len = pages * (psize + osize);
+	out = calloc(1, *out_len + 1);
+	if (!out) {
+		perror("calloc");
+		exit(1);
+	}
+
+	for (i = 0, p = out; i < pages; i++, p += psize + osize) {
+		memcpy(p, in + i * psize, psize);
+		for (j = 0; j < psize / 256; j++)
+			ref_calculate_ecc(p + j * 256, p + psize + offset + j * 3);
+	}
+
+	return out;
+}
+
+/* writes buf to fd in chunks of varying size, as a slow producer would */
+static void feed(int fd, const uint8_t *buf, size_t len)
+{
+	size_t chunk;
+
+	while (len) {
+		chunk = 1 + rand() % 7000;
+		if (chunk > len)
+			chunk = len;
+		if (write_full(fd, buf, chunk))
+			exit(1);
+		buf += chunk;
+		len -= chunk;
+	}
+}
+
+static int run_tool(const char *input, const char *output, int psize,
+		    int osize, int offset, int nthreads)
+{
+	char p[16], o[16], e[16], j[16];
+	char *argv[] = { "nand_ecc", "-p", p, "-o", o, "-e", e, "-j", j,
+			 (char *) input, (char *) output, NULL };
+	int status;
+	pid_t pid;
+
+	snprintf(p, sizeof(p), "%d", psize);
+	snprintf(o, sizeof(o), "%d", osize);
+	snprintf(e, sizeof(e), "%d", offset);
+	snprintf(j, sizeof(j), "%d", nthreads);
+
+	pid = fork();
+	if (!pid)
+		exit(nand_ecc_main(11, argv));
+	if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status))
+		return -1;
+
+	return WEXITSTATUS(status);
+}
+
+static uint8_t *read_file(const char *name, size_t *len)
+{
+	struct stat st;
+	uint8_t *buf;
+	int fd;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st)) {
+		perror(name);
+		exit(1);
+	}
+
+	buf = malloc(st.st_size + 1);
+	if (!buf || read_full(fd, buf, st.st_size) != st.st_size) {
+		perror(name);
+		exit(1);
+	}
+
+	close(fd);
+	*len = st.st_size;
+	return buf;
+}
+
+static void test_tool(const char *dir, size_t len, int kind, int psize,
+		      int osize, int offset, int nthreads, int piped)
+{
+	char input[256], output[256];
+	uint8_t *in, *out, *ref;
+	size_t out_len, ref_len;
+	int fds[2], fd, ret;
+	pid_t pid = 0;
+
+	in = malloc(len + 1);
+	if (!in) {
+		perror("malloc");
+		exit(1);
+	}
+	fill(in, len, kind);
+
+	snprintf(output, sizeof(output), "%s/out", dir);
+	if (piped) {
+		if (pipe(fds)) {
+			perror("pipe");
+			exit(1);
+		}
+		pid = fork();
+		if (!pid) {
+			close(fds[0]);
+			feed(fds[1], in, len);
+			exit(0);
+		}
+		close(fds[1]);
+		snprintf(input, sizeof(input), "/dev/fd/%d", fds[0]);
+	} else {
+		snprintf(input, sizeof(input), "%s/in", dir);
+		fd = open(input, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0 || write_full(fd, in, len) || close(fd)) {
+			perror(input);
+			exit(1);
+		}
+	}
+
+	ret = run_tool(input, output, psize, osize, offset, nthreads);
+	if (piped) {
+		close(fds[0]);
+		waitpid(pid, NULL, 0);
+	}
+
+	ref = expected(in, len, psize, osize, offset, &ref_len);
+	out = ret ? NULL : read_file(output, &out_len);
+	if (ret || out_len != ref_len || memcmp(out, ref, ref_len)) {
+		fprintf(stderr, "%zu bytes of %s, %d/%d/%d, -j %d%s: ",
+			len, kind == 1 ? "0xff" : kind == 2 ? "0x00" :
+			kind == 3 ? "sparse data" : "random data",
+			psize, osize, offset, nthreads, piped ? ", piped" : "");
+		if (ret)
+			fprintf(stderr, "exit status %d\n", ret);
+		else
+			fprintf(stderr, "output differs\n");
+		failed++;
+	}
+
+	free(in);
+	free(out);
+	free(ref);
+}
+
+int main(int argc, char **argv)
+{
+	static const int layouts[][3] = {
+		{ 512, 16, 0 },
+		{ 2048, 64, 0x28 },
+		{ 4096, 128, 40 },
+	};
+	static const int thread_counts[] = { 1, 3, 16 };
+	char dir[] = "/tmp/nand_ecc_test.XXXXXX", path[64];
+	size_t sizes[5], len;
+	int l, t, s, kind, piped;
+
+	srand(1);
+	test_blocks();
+
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+
+	for (l = 0; l < 3; l++) {
+		int psize = layouts[l][0];
+
+		/* empty, short, one page, spans batches, partial last page */
+		sizes[0] = 0;
+		sizes[1] = psize - 1;
+		sizes[2] = psize;
+		sizes[3] = 300 * psize + 17;
+		sizes[4] = BATCH_SIZE + 5 * psize + psize / 2;
+
+		for (s = 0; s < 5; s++) {
+			len = sizes[s];
+			kind = s % 4;
+			for (t = 0; t < 3; t++)
+				for (piped = 0; piped < 2; piped++)
+					test_tool(dir, len, kind, psize,
+						  layouts[l][1], layouts[l][2],
+						  thread_counts[t], piped);
+		}
+
+		/* every kind of content through the threaded batch path */
+		for (kind = 0; kind < 4; kind++)
+			test_tool(dir, sizes[4], kind, psize, layouts[l][1],
+				  layouts[l][2], 3, 0);
+	}
+
+	/* an ECC layout that does not fit into the OOB area is refused */
+	if (run_tool("/dev/null", "/dev/null", 2048, 64, 60, 1) != 1) {
+		fprintf(stderr, "oversized ECC layout accepted\n");
+		failed++;
+	}
+
+	snprintf(path, sizeof(path), "%s/in", dir);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/out", dir);
+	unlink(path);
+	rmdir(dir);
+
+	if (failed) {
+		fprintf(stderr, "%d checks failed\n", failed);
+		return 1;
+	}
+
+	printf("all checks passed\n");
+	return 0;
+}
@@ -46,6 +46,7 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <limits.h>
 
 #include "md5.h"
@@ -61,6 +62,18 @@ struct image_partition_entry {
 	const char *name;
 	size_t size;
 	uint8_t *data;
+
+	/** When set, the partition data is streamed from this file instead of data */
+	const char *filename;
+	size_t file_size;
+	bool add_jffs2_eof;
+};
+
+/** Output state while an image is written */
+struct image_writer {
+	int fd;
+	bool hash;
+	MD5_CTX ctx;
 };
 
 /** A flash partition table entry */
@@ -1474,7 +1487,11 @@ static struct image_partition_entry make_support_list(struct device_info *info)
 	return entry;
 }
 
-/** Creates a new image partition with an arbitrary name from a file */
+/**
+   Creates a new image partition with an arbitrary name from a file
+
+   The file is not read here, its contents are copied to the output when the image is written.
+*/
 static struct image_partition_entry read_file(const char *part_name, const char *filename, bool add_jffs2_eof, struct flash_partition_entry *file_system_partition) {
 	struct stat statbuf;
 
@@ -1483,29 +1500,20 @@ static struct image_partition_entry read_file(const char *part_name, const char
 
 	size_t len = statbuf.st_size;
 
-	if (add_jffs2_eof)
+	if (add_jffs2_eof) {
 		if (file_system_partition)
 			len = ALIGN(len + file_system_partition->base, 0x10000) + sizeof(jffs2_eof_mark) - file_system_partition->base;
 		else
 			len = ALIGN(len, 0x10000) + sizeof(jffs2_eof_mark);
-
-	struct image_partition_entry entry = alloc_image_partition(part_name, len);
-
-	FILE *file = fopen(filename, "rb");
-	if (!file)
-		error(1, errno, "unable to open file `%s'", filename);
-
-	if (fread(entry.data, statbuf.st_size, 1, file) != 1)
-		error(1, errno, "unable to read file `%s'", filename);
-
-	if (add_jffs2_eof) {
-		uint8_t *eof = entry.data + statbuf.st_size, *end = entry.data+entry.size;
-
-		memset(eof, 0xff, end - eof - sizeof(jffs2_eof_mark));
-		memcpy(end - sizeof(jffs2_eof_mark), jffs2_eof_mark, sizeof(jffs2_eof_mark));
 	}
 
-	fclose(file);
+	struct image_partition_entry entry = {
+		.name = part_name,
+		.size = len,
+		.filename = filename,
+		.file_size = statbuf.st_size,
+		.add_jffs2_eof = add_jffs2_eof,
+	};
 
 	return entry;
 }
@@ -1563,8 +1571,6 @@ static void put_partitions(uint8_t *buffer, const struct flash_partition_entry *
 
 		assert(flash_parts[j].name);
 
-		memcpy(buffer + base, parts[i].data, parts[i].size);
-
 		size_t len = end-image_pt;
 		size_t w = snprintf(image_pt, len, "fwup-ptn %s base 0x%05x size 0x%05x\t\r\n", parts[i].name, (unsigned)base, (unsigned)parts[i].size);
 
@@ -1577,14 +1583,97 @@ static void put_partitions(uint8_t *buffer, const struct flash_partition_entry *
 	}
 }
 
-/** Generates and writes the image MD5 checksum */
-static void put_md5(uint8_t *md5, uint8_t *buffer, unsigned int len) {
-	MD5_CTX ctx;
+/** Writes data to the output, updating the image MD5 checksum if enabled */
+static void write_data(struct image_writer *w, const void *buf, size_t len) {
+	const uint8_t *p = buf;
 
-	MD5_Init(&ctx);
-	MD5_Update(&ctx, md5_salt, (unsigned int)sizeof(md5_salt));
-	MD5_Update(&ctx, buffer, len);
-	MD5_Final(md5, &ctx);
+	if (w->hash)
+		MD5_Update(&w->ctx, buf, len);
+
+	while (len) {
+		ssize_t n = write(w->fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			error(1, errno, "unable to write output file");
+		}
+
+		p += n;
+		len -= n;
+	}
+}
+
+/** Writes len bytes of 0xff padding to the output */
+static void write_padding(struct image_writer *w, size_t len) {
+	static uint8_t ff[0x10000];
+
+	if (ff[0] != 0xff)
+		memset(ff, 0xff, sizeof(ff));
+
+	while (len) {
+		size_t n = len < sizeof(ff) ? len : sizeof(ff);
+
+		write_data(w, ff, n);
+		len -= n;
+	}
+}
+
+/** Writes an image partition to the output, copying its data from the input file if necessary */
+static void write_image_partition(struct image_writer *w, const struct image_partition_entry *part) {
+	static uint8_t buf[0x100000];
+
+	if (!part->filename) {
+		write_data(w, part->data, part->size);
+		return;
+	}
+
+	int fd = open(part->filename, O_RDONLY);
+	if (fd < 0)
+		error(1, errno, "unable to open file `%s'", part->filename);
+
+	size_t left = part->file_size;
+	while (left) {
+		ssize_t n = read(fd, buf, left < sizeof(buf) ? left : sizeof(buf));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			error(1, errno, "unable to read file `%s'", part->filename);
+
+		write_data(w, buf, n);
+		left -= n;
+	}
+
+	close(fd);
+
+	if (part->add_jffs2_eof) {
+		write_padding(w, part->size - part->file_size - sizeof(jffs2_eof_mark));
+		write_data(w, jffs2_eof_mark, sizeof(jffs2_eof_mark));
+	}
+}
+
+/** Opens the output file; called once the image layout has been validated */
+static void open_output(struct image_writer *w, const char *output) {
+	w->fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (w->fd < 0)
+		error(1, errno, "unable to open output file");
+}
+
+/** Starts the image MD5 checksum, all data written from now on is hashed */
+static void start_md5(struct image_writer *w) {
+	MD5_Init(&w->ctx);
+	MD5_Update(&w->ctx, md5_salt, (unsigned int)sizeof(md5_salt));
+	w->hash = true;
+}
+
+/** Finishes the image MD5 checksum and stores it at the given offset of the output */
+static void put_md5(struct image_writer *w, off_t offset) {
+	uint8_t md5[16];
+
+	MD5_Final(md5, &w->ctx);
+	w->hash = false;
+
+	if (pwrite(w->fd, md5, sizeof(md5), offset) != sizeof(md5))
+		error(1, errno, "unable to write output file");
 }
 
 
@@ -1603,30 +1692,34 @@ static void put_md5(uint8_t *md5, uint8_t *buffer, unsigned int len) {
      1014-1813    Image partition table (2048 bytes, padded with 0xff)
      1814-xxxx    Firmware partitions
 */
-static void * generate_factory_image(struct device_info *info, const struct image_partition_entry *parts, size_t *len) {
-	*len = 0x1814;
+static void generate_factory_image(struct device_info *info, const struct image_partition_entry *parts, struct image_writer *w, const char *output) {
+	size_t len = 0x1814;
+	uint8_t header[0x1814];
 
 	size_t i;
 	for (i = 0; parts[i].name; i++)
-		*len += parts[i].size;
+		len += parts[i].size;
 
-	uint8_t *image = malloc(*len);
-	if (!image)
-		error(1, errno, "malloc");
-
-	memset(image, 0xff, *len);
-	put32(image, *len);
+	memset(header, 0xff, sizeof(header));
+	put32(header, len);
 
 	if (info->vendor) {
 		size_t vendor_len = strlen(info->vendor);
-		put32(image+0x14, vendor_len);
-		memcpy(image+0x18, info->vendor, vendor_len);
+		put32(header+0x14, vendor_len);
+		memcpy(header+0x18, info->vendor, vendor_len);
 	}
 
-	put_partitions(image + 0x1014, info->partitions, parts);
-	put_md5(image+0x04, image+0x14, *len-0x14);
+	put_partitions(header + 0x1014, info->partitions, parts);
+
+	open_output(w, output);
+	write_data(w, header, 0x14);
+	start_md5(w);
+	write_data(w, header + 0x14, sizeof(header) - 0x14);
 
-	return image;
+	for (i = 0; parts[i].name; i++)
+		write_image_partition(w, &parts[i]);
+
+	put_md5(w, 0x04);
 }
 
 /**
@@ -1636,7 +1729,7 @@ static void * generate_factory_image(struct device_info *info, const struct imag
    should be generalized when TP-LINK starts building its safeloader into hardware with
    different flash layouts.
 */
-static void * generate_sysupgrade_image(struct device_info *info, const struct image_partition_entry *image_parts, size_t *len) {
+static void generate_sysupgrade_image(struct device_info *info, const struct image_partition_entry *image_parts, struct image_writer *w, const char *output) {
 	size_t i, j;
 	size_t flash_first_partition_index = 0;
 	size_t flash_last_partition_index = 0;
@@ -1668,28 +1761,40 @@ static void * generate_sysupgrade_image(struct device_info *info, const struct i
 
 	assert(image_last_partition);
 
-	*len = flash_last_partition->base - flash_first_partition->base + image_last_partition->size;
-
-	uint8_t *image = malloc(*len);
-	if (!image)
-		error(1, errno, "malloc");
-
-	memset(image, 0xff, *len);
-
+	/** The image is written front to back, so check the layout before creating the output */
+	size_t pos = 0;
 	for (i = flash_first_partition_index; i <= flash_last_partition_index; i++) {
 		for (j = 0; image_parts[j].name; j++) {
 			if (!strcmp(info->partitions[i].name, image_parts[j].name)) {
 				if (image_parts[j].size > info->partitions[i].size)
 					error(1, 0, "%s partition too big (more than %u bytes)", info->partitions[i].name, (unsigned)info->partitions[i].size);
-				memcpy(image + info->partitions[i].base - flash_first_partition->base, image_parts[j].data, image_parts[j].size);
+
+				size_t offset = info->partitions[i].base - flash_first_partition->base;
+				if (offset < pos)
+					error(1, 0, "%s partition overlaps the previous partition", info->partitions[i].name);
+
+				pos = offset + image_parts[j].size;
 				break;
 			}
-
-			assert(image_parts[j].name);
 		}
 	}
 
-	return image;
+	open_output(w, output);
+
+	/** Unused flash space between the partitions is filled with 0xff */
+	pos = 0;
+	for (i = flash_first_partition_index; i <= flash_last_partition_index; i++) {
+		for (j = 0; image_parts[j].name; j++) {
+			if (!strcmp(info->partitions[i].name, image_parts[j].name)) {
+				size_t offset = info->partitions[i].base - flash_first_partition->base;
+
+				write_padding(w, offset - pos);
+				write_image_partition(w, &image_parts[j]);
+				pos = offset + image_parts[j].size;
+				break;
+			}
+		}
+	}
 }
 
 /** Generates an image according to a given layout and writes it to a file */
@@ -1772,23 +1877,14 @@ static void build_image(const char *output,
 		parts[5] = put_data("extra-para", mdat, 11);
 	}
 
-	size_t len;
-	void *image;
+	struct image_writer w = {};
 	if (sysupgrade)
-		image = generate_sysupgrade_image(info, parts, &len);
+		generate_sysupgrade_image(info, parts, &w, output);
 	else
-		image = generate_factory_image(info, parts, &len);
-
-	FILE *file = fopen(output, "wb");
-	if (!file)
-		error(1, errno, "unable to open output file");
-
-	if (fwrite(image, len, 1, file) != 1)
-		error(1, 0, "unable to write output file");
-
-	fclose(file);
+		generate_factory_image(info, parts, &w, output);
 
-	free(image);
+	if (close(w.fd))
+		error(1, errno, "unable to write output file");
 
 	for (i = 0; parts[i].name; i++)
 		free_image_partition(parts[i]);
@@ -7,6 +7,8 @@
  *
  */
 
+#define _GNU_SOURCE
+
 #include <errno.h>
 #include <fcntl.h>
 #include <libgen.h>
@@ -19,6 +21,10 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
 static char *progname;
 static unsigned int xtra_offset;
 static unsigned char eof_mark[4] = {0xde, 0xad, 0xc0, 0xde};
@@ -27,6 +33,7 @@ static unsigned char jffs2_pad_le[] = "\x85\x19\x04\x20\x00\x00\x00\x04\xa8\xfb\
 static unsigned char *pad = eof_mark;
 static int pad_len = sizeof(eof_mark);
 static bool pad_to_stdout = false;
+static char *out_name;
 
 #define ERR(fmt, ...) do { \
 	fflush(0); \
@@ -41,48 +48,25 @@ static bool pad_to_stdout = false;
 			progname, ## __VA_ARGS__, strerror(save)); \
 } while (0)
 
-#define BUF_SIZE	(64 * 1024)
+#define BUF_SIZE	(1024 * 1024)
 #define ALIGN(_x,_y)	(((_x) + ((_y) - 1)) & ~((_y) - 1))
 
-static int pad_image(char *name, uint32_t pad_mask)
+/*
+ * Work out the padded image layout up front: every alignment step pads with
+ * 0xff up to the next boundary and is followed by the end-of-filesystem
+ * mark. The whole tail is then assembled in one buffer and written with a
+ * single pwrite() instead of 64k writes per step.
+ */
+static unsigned char *build_padding(off_t in_len, uint32_t pad_mask, size_t *tail_len)
 {
-	char *buf;
-	int fd;
-	int outfd;
-	ssize_t in_len;
-	ssize_t out_len;
-	int ret = -1;
-
-	buf = malloc(BUF_SIZE);
-	if (!buf) {
-		ERR("No memory for buffer");
-		goto out;
-	}
-
-	fd = open(name, O_RDWR);
-	if (fd < 0) {
-		ERRS("Unable to open %s", name);
-		goto free_buf;
-	}
+	off_t marks[32];
+	off_t out_len = in_len;
+	unsigned char *tail;
+	int n = 0;
+	int i;
 
-	in_len = lseek(fd, 0, SEEK_END);
-	if (in_len < 0)
-		goto close;
-
-	if (!pad_to_stdout)
-		outfd = fd;
-	else
-		outfd = STDOUT_FILENO;
-
-	memset(buf, '\xff', BUF_SIZE);
-
-	in_len += xtra_offset;
-
-	out_len = in_len;
 	while (pad_mask) {
 		uint32_t mask;
-		ssize_t t;
-		int i;
 
 		for (i = 10; i < 32; i++) {
 			mask = 1UL << i;
@@ -90,47 +74,168 @@ static int pad_image(char *name, uint32_t pad_mask)
 				break;
 		}
 
-		in_len = ALIGN(in_len, mask);
+		out_len = ALIGN(out_len, (off_t) mask);
 
 		for (i = 10; i < 32; i++) {
 			mask = 1UL << i;
-			if ((in_len & (mask - 1)) == 0)
+			if ((out_len & (mask - 1)) == 0)
 				pad_mask &= ~mask;
 		}
 
-		fprintf(stderr, "padding image to %08x\n", (unsigned int) in_len - xtra_offset);
+		fprintf(stderr, "padding image to %08x\n", (unsigned int) (out_len - xtra_offset));
+
+		marks[n++] = out_len - in_len;
+		out_len += pad_len;
+	}
+
+	*tail_len = out_len - in_len;
+	tail = malloc(*tail_len ? *tail_len : 1);
+	if (!tail)
+		return NULL;
+
+	memset(tail, 0xff, *tail_len);
+	for (i = 0; i < n; i++)
+		memcpy(tail + marks[i], pad, pad_len);
+
+	return tail;
+}
+
+/* pwrite() the whole buffer, or write() it when ofs is negative (stdout) */
+static int write_full(int fd, const unsigned char *buf, size_t len, off_t ofs)
+{
+	while (len) {
+		ssize_t t;
+
+		if (ofs < 0)
+			t = write(fd, buf, len);
+		else
+			t = pwrite(fd, buf, len, ofs);
+
+		if (t < 0 && errno == EINTR)
+			continue;
+		if (t <= 0)
+			return -1;
+
+		buf += t;
+		len -= t;
+		if (ofs >= 0)
+			ofs += t;
+	}
+
+	return 0;
+}
+
+/* copy the image into the output file, sharing extents where possible */
+static int copy_image(int fd, int outfd, off_t len)
+{
+	unsigned char *buf;
+	off_t ofs = 0;
+
+#if defined(__linux__) && defined(SYS_copy_file_range)
+	while (ofs < len) {
+		loff_t in_ofs = ofs, out_ofs = ofs;
+		ssize_t t;
 
-		while (out_len < in_len) {
-			ssize_t len;
+		t = syscall(SYS_copy_file_range, fd, &in_ofs, outfd, &out_ofs,
+			    len - ofs > (1 << 30) ? (1 << 30) : len - ofs, 0);
+		if (t < 0 && errno == EINTR)
+			continue;
+		if (t <= 0)
+			break;
 
-			len = in_len - out_len;
-			if (len > BUF_SIZE)
-				len = BUF_SIZE;
+		ofs += t;
+	}
 
-			t = write(outfd, buf, len);
-			if (t != len) {
-				ERRS("Unable to write to %s", name);
-				goto close;
-			}
+	if (ofs == len)
+		return 0;
+#endif
 
-			out_len += len;
+	/* not supported for this pair of files, copy the rest by hand */
+	buf = malloc(BUF_SIZE);
+	if (!buf)
+		return -1;
+
+	while (ofs < len) {
+		ssize_t t = pread(fd, buf, BUF_SIZE, ofs);
+
+		if (t < 0 && errno == EINTR)
+			continue;
+		if (t <= 0 || write_full(outfd, buf, t, ofs)) {
+			free(buf);
+			return -1;
 		}
 
-		/* write out the JFFS end-of-filesystem marker */
-		t = write(outfd, pad, pad_len);
-		if (t != pad_len) {
-			ERRS("Unable to write to %s", name);
+		ofs += t;
+	}
+
+	free(buf);
+	return 0;
+}
+
+static int pad_image(char *name, uint32_t pad_mask)
+{
+	unsigned char *tail;
+	size_t tail_len;
+	int fd;
+	int outfd;
+	off_t in_len;
+	off_t ofs;
+	int ret = -1;
+
+	fd = open(name, out_name ? O_RDONLY : O_RDWR);
+	if (fd < 0) {
+		ERRS("Unable to open %s", name);
+		goto out;
+	}
+
+	in_len = lseek(fd, 0, SEEK_END);
+	if (in_len < 0)
+		goto close;
+
+	if (out_name) {
+		outfd = open(out_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (outfd < 0) {
+			ERRS("Unable to open %s", out_name);
 			goto close;
 		}
-		out_len += pad_len;
+
+		if (copy_image(fd, outfd, in_len)) {
+			ERRS("Unable to copy %s to %s", name, out_name);
+			goto close_out;
+		}
+
+		name = out_name;
+		ofs = in_len;
+	} else if (pad_to_stdout) {
+		outfd = STDOUT_FILENO;
+		ofs = -1;
+	} else {
+		outfd = fd;
+		ofs = in_len;
+	}
+
+	tail = build_padding(in_len + xtra_offset, pad_mask, &tail_len);
+	if (!tail) {
+		ERR("No memory for buffer");
+		goto close_out;
+	}
+
+	if (write_full(outfd, tail, tail_len, ofs)) {
+		ERRS("Unable to write to %s", name);
+		goto free_tail;
 	}
 
 	ret = 0;
 
+free_tail:
+	free(tail);
+close_out:
+	if (outfd != fd && outfd != STDOUT_FILENO && close(outfd) && !ret) {
+		ERRS("Unable to write to %s", name);
+		ret = -1;
+	}
 close:
 	close(fd);
-free_buf:
-	free(buf);
 out:
 	return ret;
 }
@@ -146,6 +251,8 @@ static int usage(void)
 		"                        try to parse the entire firmware area as one big jffs2\n"
 		"  -j:                   (like -J, but little-endian instead of big-endian)\n"
 		"  -c:                   write padding to stdout\n"
+		"  -o <file>:            copy the image to <file> and pad the copy,\n"
+		"                        leaving the image itself untouched\n"
 		"\n",
 		progname);
 	return EXIT_FAILURE;
@@ -169,7 +276,7 @@ int main(int argc, char* argv[])
 	argc--;
 
 	pad_mask = 0;
-	while ((ch = getopt(argc, argv, "x:Jjc")) != -1) {
+	while ((ch = getopt(argc, argv, "x:Jjco:")) != -1) {
 		switch (ch) {
 		case 'x':
 			xtra_offset = strtoul(optarg, NULL, 0);
@@ -187,6 +294,9 @@ int main(int argc, char* argv[])
 		case 'c':
 			pad_to_stdout = true;
 			break;
+		case 'o':
+			out_name = optarg;
+			break;
 		default:
 			return usage();
 		}
@@ -0,0 +1,492 @@
+/*
+ * rstrip: native replacement for scripts/rstrip.sh
+ *
+ * Copyright (C) 2020 OpenWrt.org
+ *
+ * This is free software, licensed under the GNU General Public License v2.
+ * See /LICENSE for more information.
+ *
+ * Walks the given paths and strips every ELF executable, shared object
+ * and relocatable object below them, like rstrip.sh does:
+ *
+ *  - relocatable objects (kernel modules) are passed to $STRIP_KMOD
+ *  - when $PATCHELF and $TOPDIR are set, rpath entries outside of /lib,
+ *    /usr/lib and $ORIGIN are removed, the same way
+ *    `patchelf --set-rpath` does it for a shorter rpath
+ *  - everything else is stripped with $STRIP and gets its permissions
+ *    restored if stripping changed them
+ *
+ * ELF files are recognised from their header instead of running file(1),
+ * the rpath is rewritten in place and, if $STRIP is sstrip, stripping is
+ * done in-process. Files are distributed over a pool of worker processes.
+ * Other strip commands are run once per batch of files.
+ */
+
+#define _GNU_SOURCE
+#define SSTRIP_LIB
+
+#include <endian.h>
+
+#include "sstrip.c"
+
+#include <ftw.h>
+#include <libgen.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define STRIP_BATCH	256
+
+static char const *strip_cmd;
+static char const *strip_kmod_cmd;
+static int fix_rpath;
+static int strip_inprocess;
+
+static char **files;
+static size_t nfiles, files_size;
+static unsigned long *next_file;
+
+struct batch_entry {
+	char const *name;
+	mode_t mode;
+};
+
+static struct batch_entry batch[STRIP_BATCH];
+static int nbatch;
+
+#define RPATH_FUNCTIONS(CLASS) \
+ \
+/* fixrpath() looks up the rpath the way patchelf does (DT_RUNPATH \
+ * before DT_RPATH, via the .dynamic and .dynstr sections) and filters \
+ * it in place. A changed DT_RPATH is converted to DT_RUNPATH, as \
+ * patchelf --set-rpath does. \
+ */ \
+static int fixrpath ## CLASS (char *map, size_t size) \
+{ \
+	Elf ## CLASS ## _Ehdr *ehdr = (Elf ## CLASS ## _Ehdr *)map; \
+	Elf ## CLASS ## _Shdr *shdrs, *dynsec = NULL, *strsec = NULL; \
+	Elf ## CLASS ## _Dyn *dyn, *rpath = NULL, *runpath = NULL; \
+	char const *shstrtab, *name; \
+	uint64_t off, n, i, strndx, shnum; \
+ \
+	if (size < sizeof(*ehdr)) \
+		return FALSE; \
+ \
+	off = EGET(ehdr->e_shoff); \
+	shnum = EGET(ehdr->e_shnum); \
+	strndx = EGET(ehdr->e_shstrndx); \
+	if (!off || off + shnum * sizeof(*shdrs) > size || strndx >= shnum) \
+		return FALSE; \
+	shdrs = (Elf ## CLASS ## _Shdr *)(map + off); \
+ \
+	off = EGET(shdrs[strndx].sh_offset); \
+	if (off >= size) \
+		return FALSE; \
+	shstrtab = map + off; \
+	for (i = 0; i < shnum; i++) { \
+		off = EGET(shdrs[i].sh_name); \
+		if (shstrtab + off >= map + size) \
+			continue; \
+		name = shstrtab + off; \
+		if (!strncmp(name, ".dynamic", map + size - name)) \
+			dynsec = &shdrs[i]; \
+		else if (!strncmp(name, ".dynstr", map + size - name)) \
+			strsec = &shdrs[i]; \
+	} \
+	if (!dynsec || !strsec || \
+		EGET(dynsec->sh_offset) + EGET(dynsec->sh_size) > size || \
+		EGET(strsec->sh_offset) + EGET(strsec->sh_size) > size) \
+		return FALSE; \
+ \
+	dyn = (Elf ## CLASS ## _Dyn *)(map + EGET(dynsec->sh_offset)); \
+	n = EGET(dynsec->sh_size) / sizeof(*dyn); \
+	for (i = 0; i < n && EGET(dyn[i].d_tag) != DT_NULL; i++) { \
+		if (EGET(dyn[i].d_tag) == DT_RUNPATH) \
+			runpath = &dyn[i]; \
+		else if (EGET(dyn[i].d_tag) == DT_RPATH) \
+			rpath = &dyn[i]; \
+	} \
+	if (!runpath && !rpath) \
+		return FALSE; \
+ \
+	off = EGET((runpath ? runpath : rpath)->d_un.d_val); \
+	if (off >= EGET(strsec->sh_size)) \
+		return FALSE; \
+	if (!filterrpath(map + EGET(strsec->sh_offset) + off, \
+					 EGET(strsec->sh_size) - off)) \
+		return FALSE; \
+ \
+	if (!runpath) \
+		ESET(rpath->d_tag, DT_RUNPATH); \
+	return TRUE; \
+}
+
+/* keeprpath() returns TRUE for the rpath entries rstrip.sh keeps: /lib/ or
+ * /usr/lib/ followed by anything not starting with a slash, $ORIGIN and
+ * anything below $ORIGIN/.
+ */
+static int keeprpath(char const *path, size_t len)
+{
+	if (len > 5 && !strncmp(path, "/lib/", 5) && path[5] != '/')
+		return TRUE;
+	if (len > 9 && !strncmp(path, "/usr/lib/", 9) && path[9] != '/')
+		return TRUE;
+	if (len == 7 && !strncmp(path, "$ORIGIN", 7))
+		return TRUE;
+	if (len >= 8 && !strncmp(path, "$ORIGIN/", 8))
+		return TRUE;
+	return FALSE;
+}
+
+/* filterrpath() drops the rpath entries that are not kept and writes the
+ * result over the old string. Like a shell loop splitting on IFS=":", a
+ * trailing empty entry is ignored. Returns TRUE if the rpath changed.
+ */
+static int filterrpath(char *rpath, size_t maxlen)
+{
+	char const *p, *end, *sep;
+	char *new, *q;
+	size_t len;
+
+	len = strnlen(rpath, maxlen);
+	if (!len || len == maxlen)
+		return FALSE;
+
+	new = q = malloc(len + 1);
+	if (!new)
+		return err("Out of memory!");
+
+	for (p = rpath, end = rpath + len; p < end; p = sep + 1) {
+		sep = memchr(p, ':', end - p);
+		if (!sep)
+			sep = end;
+		if (keeprpath(p, sep - p)) {
+			if (q != new)
+				*q++ = ':';
+			memcpy(q, p, sep - p);
+			q += sep - p;
+		} else {
+			printf("%s: %s: removing rpath %.*s\n", progname, filename,
+				   (int)(sep - p), p);
+		}
+	}
+	*q = '\0';
+
+	if (!strcmp(new, rpath)) {
+		free(new);
+		return FALSE;
+	}
+
+	memset(rpath, 'X', len);
+	strcpy(rpath, new);
+	free(new);
+	return TRUE;
+}
+
+RPATH_FUNCTIONS(32)
+
+RPATH_FUNCTIONS(64)
+
+static void fixrpath(int fd, int class, size_t size)
+{
+	char *map;
+
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		ferr("cannot map file");
+		return;
+	}
+
+	if (class == ELFCLASS32)
+		fixrpath32(map, size);
+	else
+		fixrpath64(map, size);
+
+	munmap(map, size);
+}
+
+/* elftype() returns the ELF class if the file is an executable, shared
+ * object or relocatable object, 0 otherwise. Sets the endianness for
+ * EGET() and the type description printed for the file.
+ */
+static int elftype(int fd, int *type, char const **desc)
+{
+	unsigned char ident[EI_NIDENT + 2];
+
+	if (pread(fd, ident, sizeof(ident), 0) != sizeof(ident))
+		return 0;
+	if (memcmp(ident, ELFMAG, SELFMAG))
+		return 0;
+	if (ident[EI_CLASS] != ELFCLASS32 && ident[EI_CLASS] != ELFCLASS64)
+		return 0;
+
+	if (ident[EI_DATA] == ELFDATA2LSB)
+		*type = ident[EI_NIDENT] | ident[EI_NIDENT + 1] << 8;
+	else if (ident[EI_DATA] == ELFDATA2MSB)
+		*type = ident[EI_NIDENT] << 8 | ident[EI_NIDENT + 1];
+	else
+		return 0;
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	do_reverse_endian = ident[EI_DATA] != ELFDATA2LSB;
+#else
+	do_reverse_endian = ident[EI_DATA] != ELFDATA2MSB;
+#endif
+
+	switch (*type) {
+	case ET_EXEC:
+		*desc = "executable";
+		break;
+	case ET_DYN:
+		*desc = "shared object";
+		break;
+	case ET_REL:
+		*desc = "relocatable";
+		break;
+	default:
+		return 0;
+	}
+
+	return ident[EI_CLASS];
+}
+
+/* run() runs a shell command with the given files appended as arguments.
+ */
+static void run(char const *cmd, char **args, int nargs)
+{
+	char const **argv;
+	char *script;
+	pid_t pid;
+	int i;
+
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0) {
+		perror(progname);
+		return;
+	}
+	if (pid) {
+		waitpid(pid, NULL, 0);
+		return;
+	}
+
+	argv = calloc(nargs + 5, sizeof(*argv));
+	script = malloc(strlen(cmd) + sizeof(" \"$@\""));
+	if (!argv || !script)
+		_exit(1);
+	sprintf(script, "%s \"$@\"", cmd);
+
+	argv[0] = "sh";
+	argv[1] = "-c";
+	argv[2] = script;
+	argv[3] = "sh";
+	for (i = 0; i < nargs; i++)
+		argv[4 + i] = args[i];
+
+	execv("/bin/sh", (char **)argv);
+	_exit(127);
+}
+
+static void restoremode(char const *name, mode_t mode)
+{
+	struct stat st;
+
+	if (!stat(name, &st) && (st.st_mode & 07777) != mode)
+		chmod(name, mode);
+}
+
+static void flushbatch(void)
+{
+	char *args[STRIP_BATCH];
+	int i;
+
+	if (!nbatch)
+		return;
+
+	for (i = 0; i < nbatch; i++)
+		args[i] = (char *)batch[i].name;
+	run(strip_cmd, args, nbatch);
+
+	for (i = 0; i < nbatch; i++)
+		restoremode(batch[i].name, batch[i].mode);
+	nbatch = 0;
+}
+
+static void process(char *name)
+{
+	char const *desc;
+	struct stat st;
+	int fd, class, type;
+
+	filename = name;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0)
+		return;
+	class = elftype(fd, &type, &desc);
+	close(fd);
+	if (!class)
+		return;
+
+	printf("%s: %s: %s\n", progname, name, desc);
+
+	if (type == ET_REL) {
+		if (strip_kmod_cmd)
+			run(strip_kmod_cmd, &name, 1);
+		return;
+	}
+
+	fd = open(name, O_RDWR);
+	if (fd < 0) {
+		ferr("can't open");
+		return;
+	}
+	if (fstat(fd, &st)) {
+		close(fd);
+		return;
+	}
+
+	if (fix_rpath && st.st_size > 0)
+		fixrpath(fd, class, st.st_size);
+
+	if (strip_inprocess) {
+		sstrip(fd);
+		close(fd);
+		restoremode(name, st.st_mode & 07777);
+		return;
+	}
+	close(fd);
+
+	batch[nbatch].name = name;
+	batch[nbatch].mode = st.st_mode & 07777;
+	if (++nbatch == STRIP_BATCH)
+		flushbatch();
+}
+
+static void worker(void)
+{
+	unsigned long i;
+
+	while ((i = __atomic_fetch_add(next_file, 1, __ATOMIC_RELAXED)) < nfiles)
+		process(files[i]);
+	flushbatch();
+	fflush(stdout);
+}
+
+static int addfile(char const *path, struct stat const *st, int flag,
+				   struct FTW *ftw)
+{
+	if (flag != FTW_F || !S_ISREG(st->st_mode))
+		return 0;
+
+	if (nfiles == files_size) {
+		files_size = files_size ? 2 * files_size : 256;
+		files = realloc(files, files_size * sizeof(*files));
+		if (!files) {
+			perror(progname);
+			exit(EXIT_FAILURE);
+		}
+	}
+	files[nfiles] = strdup(path);
+	if (!files[nfiles]) {
+		perror(progname);
+		exit(EXIT_FAILURE);
+	}
+	nfiles++;
+	return 0;
+}
+
+/* issstrip() returns TRUE if the strip command is a plain sstrip binary.
+ */
+static int issstrip(char const *cmd)
+{
+	char const *base = strrchr(cmd, '/');
+
+	base = base ? base + 1 : cmd;
+	return !strpbrk(cmd, " \t\n") && !strcmp(base, "sstrip");
+}
+
+int main(int argc, char *argv[])
+{
+	long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	char const *patchelf, *topdir;
+	int i, opt;
+
+	progname = basename(argv[0]);
+
+	while ((opt = getopt(argc, argv, "j:")) != -1) {
+		switch (opt) {
+		case 'j':
+			jobs = atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-j jobs] [PATH...]\n", progname);
+			return EXIT_FAILURE;
+		}
+	}
+
+	strip_cmd = getenv("STRIP");
+	if (!strip_cmd || !*strip_cmd) {
+		fprintf(stderr, "%s: strip command not defined (STRIP variable not set)\n",
+				progname);
+		return EXIT_FAILURE;
+	}
+
+	if (optind == argc) {
+		fprintf(stderr, "%s: no directories / files specified\n", progname);
+		fprintf(stderr, "usage: %s [-j jobs] [PATH...]\n", progname);
+		return EXIT_FAILURE;
+	}
+
+	strip_kmod_cmd = getenv("STRIP_KMOD");
+	if (strip_kmod_cmd && !*strip_kmod_cmd)
+		strip_kmod_cmd = NULL;
+	patchelf = getenv("PATCHELF");
+	topdir = getenv("TOPDIR");
+	fix_rpath = patchelf && *patchelf && topdir && *topdir;
+	strip_inprocess = issstrip(strip_cmd);
+
+	for (i = optind; i < argc; i++)
+		if (nftw(argv[i], addfile, 16, FTW_PHYS))
+			fprintf(stderr, "%s: %s: %s\n", progname, argv[i],
+					strerror(errno));
+
+	next_file = mmap(NULL, sizeof(*next_file), PROT_READ | PROT_WRITE,
+					 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (next_file == MAP_FAILED) {
+		perror(progname);
+		return EXIT_FAILURE;
+	}
+	*next_file = 0;
+
+	/* one line per write, so that output of the workers does not mix */
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	if (jobs > (long)nfiles)
+		jobs = nfiles;
+	if (jobs <= 1) {
+		worker();
+		return EXIT_SUCCESS;
+	}
+
+	fflush(stdout);
+	for (i = 0; i < jobs; i++) {
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			perror(progname);
+			break;
+		}
+		if (!pid) {
+			worker();
+			_exit(EXIT_SUCCESS);
+		}
+	}
+	while (wait(NULL) > 0)
+		;
+
+	/* pick up whatever is left if forking failed */
+	worker();
+
+	return EXIT_SUCCESS;
+}
@@ -396,12 +396,11 @@ static int truncatezeros(int fd, unsigned long *newsize)
 	return TRUE;
 }
 
-/* main() loops over the cmdline arguments, leaving all the real work
- * to the other functions.
+/* sstrip() strips the open file fd, printing errors against the current
+ * filename. TRUE is returned on success.
  */
-int main(int argc, char *argv[])
+static int sstrip(int fd)
 {
-	int				fd;
 	union {
 		Elf32_Ehdr	ehdr32;
 		Elf64_Ehdr	ehdr64;
@@ -411,6 +410,42 @@ int main(int argc, char *argv[])
 		Elf64_Phdr	*phdrs64;
 	} p;
 	unsigned long	newsize;
+	int				ok;
+
+	p.phdrs64 = NULL;
+	switch (readelfheaderident(fd, &e.ehdr32)) {
+		case ELFCLASS32:
+			ok = readelfheader32(fd, &e.ehdr32)					&&
+				 readphdrtable32(fd, &e.ehdr32, &p.phdrs32)		&&
+				 getmemorysize32(&e.ehdr32, p.phdrs32, &newsize)	&&
+				 truncatezeros(fd, &newsize)						&&
+				 modifyheaders32(&e.ehdr32, p.phdrs32, newsize)	&&
+				 commitchanges32(fd, &e.ehdr32, p.phdrs32, newsize);
+			break;
+		case ELFCLASS64:
+			ok = readelfheader64(fd, &e.ehdr64)					&&
+				 readphdrtable64(fd, &e.ehdr64, &p.phdrs64)		&&
+				 getmemorysize64(&e.ehdr64, p.phdrs64, &newsize)	&&
+				 truncatezeros(fd, &newsize)						&&
+				 modifyheaders64(&e.ehdr64, p.phdrs64, newsize)	&&
+				 commitchanges64(fd, &e.ehdr64, p.phdrs64, newsize);
+			break;
+		default:
+			ok = FALSE;
+			break;
+	}
+	free(p.phdrs64);
+
+	return ok;
+}
+
+#ifndef SSTRIP_LIB
+/* main() loops over the cmdline arguments, leaving all the real work
+ * to the other functions.
+ */
+int main(int argc, char *argv[])
+{
+	int				fd;
 	char			**arg;
 	int				failures = 0;
 
@@ -436,31 +471,11 @@ int main(int argc, char *argv[])
 			continue;
 		}
 
-		switch (readelfheaderident(fd, &e.ehdr32)) {
-			case ELFCLASS32:
-				if (!(readelfheader32(fd, &e.ehdr32)					&&
-					  readphdrtable32(fd, &e.ehdr32, &p.phdrs32)		&&
-					  getmemorysize32(&e.ehdr32, p.phdrs32, &newsize)	&&
-					  truncatezeros(fd, &newsize)						&&
-					  modifyheaders32(&e.ehdr32, p.phdrs32, newsize)	&&
-					  commitchanges32(fd, &e.ehdr32, p.phdrs32, newsize)))
-					++failures;
-				break;
-			case ELFCLASS64:
-				if (!(readelfheader64(fd, &e.ehdr64)					&&
-					  readphdrtable64(fd, &e.ehdr64, &p.phdrs64)		&&
-					  getmemorysize64(&e.ehdr64, p.phdrs64, &newsize)	&&
-					  truncatezeros(fd, &newsize)						&&
-					  modifyheaders64(&e.ehdr64, p.phdrs64, newsize)	&&
-					  commitchanges64(fd, &e.ehdr64, p.phdrs64, newsize)))
-					++failures;
-				break;
-			default:
-				++failures;
-				break;
-		}
+		if (!sstrip(fd))
+			++failures;
 		close(fd);
 	}
 
 	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
 }
+#endif